@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <utility>
+
+import cpp_matrix;
+import webgpu;
+
+using namespace cpp_matrix;
+
+// Measures wall time and process CPU time per GPU operation for every wait mode.
+//
+//   $ ./build/bench/gpu_wait_bench [size] [iterations]
+int main(int argc, char* argv[])
+{
+    auto size = argc > 1 ? (size_t)atoi(argv[1]) : 512u;
+    auto iterations = argc > 2 ? atoi(argv[2]) : 200;
+
+    auto x = WebGpuMatrix<std::float32_t>::Random(size, size);
+    auto y = WebGpuMatrix<std::float32_t>::Random(size, size);
+
+    // Warm up, so shader compilation is not measured.
+    auto z = x + y;
+    z = x * y;
+
+    std::pair<const char*, webgpu::WaitMode> modes[] = {
+        { "spin", webgpu::WaitMode::Spin },
+        { "hybrid", webgpu::WaitMode::Hybrid },
+        { "block", webgpu::WaitMode::Block },
+    };
+
+    printf("%-8s %-6s %14s %14s %10s\n", "mode", "op", "wall us/op", "cpu us/op", "cpu/wall");
+    for (const auto& [name, mode] : modes) {
+        webgpu::SetWaitMode(mode);
+        auto measure = [&](const char* op, auto&& fn) {
+            auto wallStart = std::chrono::steady_clock::now();
+            auto cpuStart = std::clock();
+            for (auto i = 0; i < iterations; ++i) {
+                fn();
+            }
+            auto cpu = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC * 1e6 / iterations;
+            auto wall = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - wallStart).count()
+                / iterations;
+            printf("%-8s %-6s %14.1f %14.1f %10.2f\n", name, op, wall, cpu, cpu / wall);
+        };
+        measure("add", [&] { z = x + y; });
+        measure("mul", [&] { z = x * y; });
+        measure("read", [&] { z.Read(); });
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+import cpp_matrix;
+
+using namespace cpp_matrix;
+
+// Benchmarks every Matrix op on every backend and element type over a sweep of square shapes.
+//
+//   $ ./build/bench/cpp_matrix_bench [--sizes 16,64,256] [--filter MatMul] [--min-time 0.2]
+//         [--json out.json] [--baseline baseline.json] [--threshold 0.1]
+//
+// With --baseline, benchmarks which are slower than the baseline by more than threshold are reported and the exit code
+// is 1, so it can gate a release.
+
+struct Options {
+    std::vector<size_t> sizes { 16, 64, 256, 1024 };
+    std::string filter;
+    double minTime { 0.2 };
+    std::string jsonFile;
+    std::string baselineFile;
+    double threshold { 0.1 };
+};
+
+struct Result {
+    std::string name;
+    size_t iterations {};
+    double microseconds {};
+    double gflops {};
+    double gbps {};
+};
+
+static Options parse_options(int argc, char* argv[])
+{
+    auto options = Options {};
+    for (int i = 0; i < argc; ++i) {
+        if (!strcmp(argv[i], "--sizes")) {
+            options.sizes.clear();
+            auto ss = std::stringstream { argv[++i] };
+            for (std::string size; std::getline(ss, size, ',');) {
+                options.sizes.push_back(std::stoul(size));
+            }
+        } else if (!strcmp(argv[i], "--filter")) {
+            options.filter = argv[++i];
+        } else if (!strcmp(argv[i], "--min-time")) {
+            options.minTime = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--json")) {
+            options.jsonFile = argv[++i];
+        } else if (!strcmp(argv[i], "--baseline")) {
+            options.baselineFile = argv[++i];
+        } else if (!strcmp(argv[i], "--threshold")) {
+            options.threshold = atof(argv[++i]);
+        } else {
+            throw std::runtime_error { std::format("Unknown options: {}", argv[i]) };
+        }
+    }
+    return options;
+}
+
+// Run fn until it took minTime seconds (at least 3 times), after one run to warm up (e.g. compile kernels).
+template <typename F>
+static std::pair<size_t, double> measure(double minTime, F&& fn)
+{
+    fn();
+    auto iterations = size_t {};
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double> {};
+    do {
+        fn();
+        ++iterations;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (iterations < 3 || elapsed.count() < minTime);
+    return { iterations, elapsed.count() * 1e6 / iterations };
+}
+
+template <typename Matrix>
+static void run(const char* backend, const char* dtype, const Options& options, std::vector<Result>& results)
+{
+    using T = typename Matrix::ElementType;
+    for (auto n : options.sizes) {
+        auto x = Matrix::Random(n, n);
+        auto y = Matrix::Random(n, n);
+        auto data = x.Read();
+        auto elements = (double)n * n;
+        auto bytes = elements * sizeof(T);
+
+        // flops and bytes are per run, bytes counts every matrix read or written once.
+        auto bench = [&](const char* op, double flops, double bytesMoved, auto&& fn) {
+            auto name = std::format("{}/{}/{}/{}", op, backend, dtype, n);
+            if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+                return;
+            }
+
+            auto [iterations, microseconds] = measure(options.minTime, fn);
+            auto& result = results.emplace_back(Result { name, iterations, microseconds });
+            result.gflops = flops / microseconds / 1e3;
+            result.gbps = bytesMoved / microseconds / 1e3;
+            printf("%-36s %10zu %14.1f %10.2f %10.2f\n", name.c_str(), iterations, microseconds, result.gflops,
+                result.gbps);
+        };
+
+        auto z = Matrix { n, n };
+        bench("MatMul", 2 * elements * n, 3 * bytes, [&] { z = x * y; });
+        bench("Add", elements, 3 * bytes, [&] { z = x + y; });
+        bench("Sub", elements, 3 * bytes, [&] { z = x - y; });
+        bench("ElementProduct", elements, 3 * bytes, [&] { z = x.ElementProduct(y); });
+        bench("Transpose", 0, 2 * bytes, [&] { z = x.Transpose(); });
+        bench("Sigmoid", 4 * elements, 2 * bytes, [&] { z = x.Sigmoid(); });
+        bench("Relu", elements, 2 * bytes, [&] { z = x.Relu(); });
+        bench("Read", 0, bytes, [&] { data = x.Read(); });
+        bench("Write", 0, bytes, [&] { z.Write(std::span<T> { data }); });
+        bench("Random", 0, bytes, [&] { z = Matrix::Random(n, n); });
+    }
+}
+
+static void write_json(const std::string& filename, const std::vector<Result>& results)
+{
+    auto out = std::ofstream { filename };
+    out << "{\n  \"benchmarks\": [\n";
+    for (auto i = 0u; i < results.size(); ++i) {
+        const auto& r = results[i];
+        out << std::format(
+            R"(    {{"name": "{}", "iterations": {}, "time_us": {:.3f}, "gflops": {:.3f}, "gbps": {:.3f}}}{})", r.name,
+            r.iterations, r.microseconds, r.gflops, r.gbps, i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    if (!out) {
+        throw std::runtime_error { std::format("Can't write {}.", filename) };
+    }
+}
+
+// Only reads what write_json() writes: one benchmark per line.
+static std::map<std::string, double> read_json(const std::string& filename)
+{
+    auto in = std::ifstream { filename };
+    if (!in) {
+        throw std::runtime_error { std::format("Can't read {}.", filename) };
+    }
+
+    auto times = std::map<std::string, double> {};
+    auto pattern = std::regex { R"re("name": "([^"]+)".*"time_us": ([0-9.eE+-]+))re" };
+    auto line = std::string {};
+    while (std::getline(in, line)) {
+        if (auto match = std::smatch {}; std::regex_search(line, match, pattern)) {
+            times[match[1]] = std::stod(match[2]);
+        }
+    }
+    return times;
+}
+
+// Returns the number of regressions.
+static int compare(const std::map<std::string, double>& baseline, const std::vector<Result>& results, double threshold)
+{
+    auto regressions = 0;
+    printf("\n%-36s %14s %14s %9s\n", "benchmark", "baseline us", "current us", "change");
+    for (const auto& r : results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end()) {
+            continue;
+        }
+
+        auto change = r.microseconds / it->second - 1;
+        auto isRegression = change > threshold;
+        regressions += isRegression;
+        printf("%-36s %14.1f %14.1f %+8.1f%%%s\n", r.name.c_str(), it->second, r.microseconds, change * 100,
+            isRegression ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+    auto options = parse_options(argc - 1, argv + 1);
+    auto results = std::vector<Result> {};
+
+    printf("%-36s %10s %14s %10s %10s\n", "benchmark", "iterations", "time us", "GFLOP/s", "GB/s");
+    run<CpuMatrix<std::float32_t>>("Cpu", "f32", options, results);
+    run<CpuMatrix<std::float16_t>>("Cpu", "f16", options, results);
+    run<CpuMatrix<std::bfloat16_t>>("Cpu", "bf16", options, results);
+#if CPP_MATRIX_WITH_WEBGPU
+    run<WebGpuMatrix<std::float32_t>>("WebGpu", "f32", options, results);
+    run<WebGpuMatrix<std::float16_t>>("WebGpu", "f16", options, results);
+    run<WebGpuMatrix<std::bfloat16_t>>("WebGpu", "bf16", options, results);
+    run<AutoMatrix<std::float32_t>>("Auto", "f32", options, results);
+    run<AutoMatrix<std::float16_t>>("Auto", "f16", options, results);
+    run<AutoMatrix<std::bfloat16_t>>("Auto", "bf16", options, results);
+#endif
+
+    if (!options.jsonFile.empty()) {
+        write_json(options.jsonFile, results);
+    }
+
+    if (!options.baselineFile.empty()) {
+        auto regressions = compare(read_json(options.baselineFile), results, options.threshold);
+        if (regressions) {
+            printf("%d benchmarks regressed by more than %g%%\n", regressions, options.threshold * 100);
+            return 1;
+        }
+    }
+    return 0;
+}
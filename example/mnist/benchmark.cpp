@@ -0,0 +1,209 @@
+module;
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+export module benchmark;
+import cpp_matrix;
+import neural_network;
+
+using namespace cpp_matrix;
+
+export struct BenchmarkOptions {
+    size_t trainingSamples { 1000 };
+    size_t testSamples { 1000 };
+    std::vector<size_t> batchSizes { 1, 16, 64 };
+    int epochs { 1 };
+};
+
+export struct BenchmarkResult {
+    std::string backend;
+    std::string dtype;
+    size_t batchSize {};
+    double trainSamplesPerSecond {};
+    double querySamplesPerSecond {};
+
+    // Latency of the batch a sample belongs to, every sample of a batch gets its result at the same time.
+    double p50LatencyMicroseconds {};
+    double p99LatencyMicroseconds {};
+
+    // Peak while this configuration ran, it includes what the process held before it (e.g. the dataset). Where the peak
+    // can't be reset (not Linux), it is the peak of the whole process so far.
+    long peakRssKilobytes {};
+    double accuracy {};
+};
+
+constexpr size_t kInputNodes = 784;
+constexpr size_t kHiddenNodes = 200;
+constexpr size_t kOutputNodes = 10;
+constexpr float kLearningRate = 0.1f;
+
+struct Sample {
+    size_t label {};
+    std::vector<float> pixels;
+};
+
+// MNIST shaped samples: label i % 10 lights up a band of rows which depends on the label, plus noise. The same seed
+// gives the same dataset, so runs are comparable and the network can actually learn it.
+std::vector<Sample> SynthesizeDataset(size_t count, unsigned seed)
+{
+    auto random = std::mt19937 { seed };
+    auto noise = std::uniform_int_distribution<int> { 0, 63 };
+    auto samples = std::vector<Sample> {};
+    for (auto i = 0u; i < count; ++i) {
+        auto& sample = samples.emplace_back(Sample { i % 10, std::vector<float>(kInputNodes) });
+        for (auto pixel = 0u; pixel < kInputNodes; ++pixel) {
+            auto row = pixel / 28;
+            auto value = noise(random) + (row >= sample.label * 2 + 4 && row < sample.label * 2 + 8 ? 192 : 0);
+
+            // Same scaling as the csv files.
+            sample.pixels[pixel] = value / 255.f * 0.99f + 0.01f;
+        }
+    }
+    return samples;
+}
+
+// Flatten batchSize samples from begin, one sample after another.
+template <typename T>
+void Flatten(const std::vector<Sample>& samples, size_t begin, size_t batchSize, std::vector<T>& inputs,
+    std::vector<T>* pTargets)
+{
+    inputs.clear();
+    if (pTargets) {
+        pTargets->assign(batchSize * kOutputNodes, T(0.01f));
+    }
+    for (auto n = 0u; n < batchSize; ++n) {
+        const auto& sample = samples[begin + n];
+        inputs.insert(inputs.end(), sample.pixels.begin(), sample.pixels.end());
+        if (pTargets) {
+            (*pTargets)[n * kOutputNodes + sample.label] = T(0.99f);
+        }
+    }
+}
+
+// Reset the peak RSS (VmHWM) of the process to its current RSS, see proc(5) clear_refs.
+void ResetPeakRss()
+{
+    auto file = std::ofstream { "/proc/self/clear_refs" };
+    file << "5";
+}
+
+long ReadPeakRssKilobytes()
+{
+    auto file = std::ifstream { "/proc/self/status" };
+    for (auto line = std::string {}; std::getline(file, line);) {
+        if (line.starts_with("VmHWM:")) {
+            return std::stol(line.substr(6));
+        }
+    }
+
+    auto usage = rusage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+template <typename Matrix>
+BenchmarkResult RunOne(const char* backend, const char* dtype, size_t batchSize, const BenchmarkOptions& options,
+    const std::vector<Sample>& training, const std::vector<Sample>& test)
+{
+    using T = typename Matrix::ElementType;
+    using Clock = std::chrono::steady_clock;
+    ResetPeakRss();
+    auto network = NeuralNetwork<Matrix> { kInputNodes, kHiddenNodes, kOutputNodes, kLearningRate };
+    auto result = BenchmarkResult { backend, dtype, batchSize };
+    auto inputs = std::vector<T> {};
+    auto targets = std::vector<T> {};
+
+    // Partial batches at the end are dropped, so every batch has the same shape.
+    auto trained = size_t {};
+    auto start = Clock::now();
+    for (int epoch = 0; epoch < options.epochs; ++epoch) {
+        for (auto begin = 0u; begin + batchSize <= training.size(); begin += batchSize) {
+            Flatten(training, begin, batchSize, inputs, &targets);
+            network.TrainBatch(inputs, targets, batchSize);
+            trained += batchSize;
+        }
+    }
+    result.trainSamplesPerSecond = trained / std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto latencies = std::vector<double> {};
+    auto correct = size_t {};
+    start = Clock::now();
+    for (auto begin = 0u; begin + batchSize <= test.size(); begin += batchSize) {
+        auto batchStart = Clock::now();
+        Flatten(test, begin, batchSize, inputs, nullptr);
+        auto labels = network.PredictBatchAsync(inputs, batchSize).get();
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - batchStart).count());
+        for (auto n = 0u; n < batchSize; ++n) {
+            correct += labels[n] == test[begin + n].label;
+        }
+    }
+    auto queried = latencies.size() * batchSize;
+    result.querySamplesPerSecond = queried / std::chrono::duration<double>(Clock::now() - start).count();
+    result.accuracy = queried ? (double)correct / queried : 0;
+
+    // Every sample of a batch has the batch's latency, so percentiles over batches are percentiles over samples.
+    std::ranges::sort(latencies);
+    if (!latencies.empty()) {
+        result.p50LatencyMicroseconds = latencies[latencies.size() / 2];
+        result.p99LatencyMicroseconds = latencies[std::min(latencies.size() * 99 / 100, latencies.size() - 1)];
+    }
+
+    result.peakRssKilobytes = ReadPeakRssKilobytes();
+    return result;
+}
+
+/// @brief Train and query the network on every backend, element type and batch size with a synthesized dataset.
+export std::vector<BenchmarkResult> RunBenchmarks(const BenchmarkOptions& options)
+{
+    // A batch of zero samples would never advance through the dataset.
+    if (std::ranges::find(options.batchSizes, size_t {}) != options.batchSizes.end()) {
+        throw std::runtime_error { "Batch sizes must be positive." };
+    }
+
+    auto training = SynthesizeDataset(options.trainingSamples, /*seed=*/1);
+    auto test = SynthesizeDataset(options.testSamples, /*seed=*/2);
+    auto results = std::vector<BenchmarkResult> {};
+    for (auto batchSize : options.batchSizes) {
+        auto add = [&](BenchmarkResult result) {
+            fprintf(stderr, "%-6s %s batch %4zu: train %10.1f samples/s, query %10.1f samples/s, accuracy %.3f\n",
+                result.backend.c_str(), result.dtype.c_str(), result.batchSize, result.trainSamplesPerSecond,
+                result.querySamplesPerSecond, result.accuracy);
+            results.push_back(std::move(result));
+        };
+        add(RunOne<CpuMatrix<std::float32_t>>("Cpu", "f32", batchSize, options, training, test));
+        add(RunOne<CpuMatrix<std::float16_t>>("Cpu", "f16", batchSize, options, training, test));
+        add(RunOne<CpuMatrix<std::bfloat16_t>>("Cpu", "bf16", batchSize, options, training, test));
+#if CPP_MATRIX_WITH_WEBGPU
+        add(RunOne<WebGpuMatrix<std::float32_t>>("WebGpu", "f32", batchSize, options, training, test));
+        add(RunOne<WebGpuMatrix<std::float16_t>>("WebGpu", "f16", batchSize, options, training, test));
+        add(RunOne<WebGpuMatrix<std::bfloat16_t>>("WebGpu", "bf16", batchSize, options, training, test));
+        add(RunOne<AutoMatrix<std::float32_t>>("Auto", "f32", batchSize, options, training, test));
+        add(RunOne<AutoMatrix<std::float16_t>>("Auto", "f16", batchSize, options, training, test));
+        add(RunOne<AutoMatrix<std::bfloat16_t>>("Auto", "bf16", batchSize, options, training, test));
+#endif
+    }
+    return results;
+}
+
+export std::string ToJson(const std::vector<BenchmarkResult>& results)
+{
+    auto json = std::string { "[\n" };
+    for (auto i = 0u; i < results.size(); ++i) {
+        const auto& r = results[i];
+        json += std::format(R"(  {{"backend": "{}", "dtype": "{}", "batch_size": {}, "train_samples_per_sec": {:.1f}, )"
+                            R"("query_samples_per_sec": {:.1f}, "p50_latency_us": {:.1f}, "p99_latency_us": {:.1f}, )"
+                            R"("peak_rss_kb": {}, "accuracy": {:.4f}}}{})",
+            r.backend, r.dtype, r.batchSize, r.trainSamplesPerSecond, r.querySamplesPerSecond, r.p50LatencyMicroseconds,
+            r.p99LatencyMicroseconds, r.peakRssKilobytes, r.accuracy, i + 1 < results.size() ? ",\n" : "\n");
+    }
+    return json + "]\n";
+}
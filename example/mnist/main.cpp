@@ -1,34 +1,125 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <filesystem>
 #include <format>
 #include <fstream>
+#include <future>
+#include <optional>
 #include <span>
 #include <sstream>
+#include <utility>
 #include <vector>
 
+import benchmark;
 import neural_network;
 import cpp_matrix;
+#if CPP_MATRIX_WITH_WEBGPU
+import webgpu;
+#endif
 
 using namespace cpp_matrix;
 
+static auto s_startTime = std::chrono::steady_clock::now();
+
+// How many shaders the pipeline cache had when the process started, see describe_pipeline_cache().
+static std::string s_pipelineCacheState = "none";
+
+constexpr size_t kInputNodes = 784;
+constexpr size_t kHiddenNodes = 200;
+constexpr size_t kOutputNodes = 10;
+constexpr float kLearningRate = 0.1f;
+
+// Samples which set the activation ranges of the int8 network.
+constexpr size_t kCalibrationSamples = 500;
+
 struct Options {
     int epochs { 1 };
     std::string training_file;
     std::string test_file;
     bool useF16 {};
+    bool useBf16 {};
+    bool mixedPrecision {};
     bool useWebGpuMatrix {};
+    bool useAutoMatrix {};
+    bool calibrate {};
+    std::string gpuCacheDir;
+    bool warmUp {};
+    bool benchmark {};
+    BenchmarkOptions benchmarkOptions {};
+    std::string jsonFile;
+    bool memReport {};
+    std::string loadFile;
+    std::string saveFile;
+    bool saveF16 {};
+    bool quantize {};
 };
 
+// A comma separated list of positive sizes, e.g. "1,32,256".
+static std::vector<size_t> parse_sizes(const char* list)
+{
+    auto sizes = std::vector<size_t> {};
+    auto ss = std::stringstream { list };
+    for (std::string size; std::getline(ss, size, ',');) {
+        auto value = size_t {};
+        auto [pEnd, error] = std::from_chars(size.data(), size.data() + size.size(), value);
+        if (error != std::errc {} || pEnd != size.data() + size.size() || !value) {
+            throw std::runtime_error { std::format(
+                "Invalid size \"{}\" in \"{}\", sizes must be positive integers separated by commas.", size, list) };
+        }
+        sizes.push_back(value);
+    }
+    if (sizes.empty()) {
+        throw std::runtime_error { std::format("No size in \"{}\".", list) };
+    }
+    return sizes;
+}
+
 static Options parse_options(int argc, char* argv[])
 {
     auto options = Options {};
     for (int i = 0; i < argc; ++i) {
         if (!strcmp(argv[i], "--use-webgpu")) {
             options.useWebGpuMatrix = true;
+        } else if (!strcmp(argv[i], "--use-auto")) {
+            options.useAutoMatrix = true;
+        } else if (!strcmp(argv[i], "--calibrate")) {
+            options.calibrate = true;
         } else if (!strcmp(argv[i], "--use-f16")) {
             options.useF16 = true;
+        } else if (!strcmp(argv[i], "--use-bf16")) {
+            options.useBf16 = true;
+        } else if (!strcmp(argv[i], "--mixed-precision")) {
+            options.mixedPrecision = true;
         } else if (!strcmp(argv[i], "--epochs")) {
             options.epochs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--gpu-cache-dir")) {
+            options.gpuCacheDir = argv[++i];
+        } else if (!strcmp(argv[i], "--warm-up")) {
+            options.warmUp = true;
+        } else if (!strcmp(argv[i], "--benchmark")) {
+            options.benchmark = true;
+        } else if (!strcmp(argv[i], "--training-samples")) {
+            options.benchmarkOptions.trainingSamples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--test-samples")) {
+            options.benchmarkOptions.testSamples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--batch-sizes")) {
+            options.benchmarkOptions.batchSizes = parse_sizes(argv[++i]);
+        } else if (!strcmp(argv[i], "--json")) {
+            options.jsonFile = argv[++i];
+        } else if (!strcmp(argv[i], "--mem-report")) {
+            options.memReport = true;
+        } else if (!strcmp(argv[i], "--load")) {
+            options.loadFile = argv[++i];
+        } else if (!strcmp(argv[i], "--save")) {
+            options.saveFile = argv[++i];
+        } else if (!strcmp(argv[i], "--save-f16")) {
+            options.saveF16 = true;
+        } else if (!strcmp(argv[i], "--quantize")) {
+            options.quantize = true;
         } else if (options.training_file.empty()) {
             options.training_file = argv[i];
         } else if (options.test_file.empty()) {
@@ -37,6 +128,15 @@ static Options parse_options(int argc, char* argv[])
             throw std::runtime_error { std::format("Unknown options: {}", argv[i]) };
         }
     }
+
+    if (options.mixedPrecision && !options.useF16 && !options.useBf16) {
+        throw std::runtime_error { "--mixed-precision needs --use-f16 or --use-bf16." };
+    }
+
+    // Nothing is trained with --load, so its only file is the test file.
+    if (!options.loadFile.empty() && options.test_file.empty()) {
+        std::swap(options.training_file, options.test_file);
+    }
     return options;
 }
 
@@ -67,45 +167,196 @@ std::vector<std::pair<int, std::vector<T>>> read_data_from_file(std::string file
 
 static void print_help(const char* appname)
 {
-    printf("%s [--use-gpu] [--use-f16] [--epochs x] training_file test_file\n", appname);
+    printf("%s [--use-webgpu | --use-auto [--calibrate]] [--use-f16 | --use-bf16 [--mixed-precision]] [--epochs x] "
+           "[--gpu-cache-dir dir] [--warm-up] [--mem-report] [--save file [--save-f16]] [--quantize] training_file "
+           "test_file\n",
+        appname);
+    printf("%s [--use-webgpu | --use-auto] [--use-f16 | --use-bf16] [--mem-report] [--quantize] --load file "
+           "test_file\n",
+        appname);
+    printf("%s --benchmark [--epochs x] [--training-samples n] [--test-samples n] [--batch-sizes 1,16,64] "
+           "[--json file] [--mem-report]\n",
+        appname);
+}
+
+// The inputs of the first count samples one after another, and how many there are.
+template <MatrixElementType T>
+std::pair<std::vector<T>, size_t> first_inputs(const std::vector<std::pair<int, std::vector<T>>>& datas, size_t count)
+{
+    count = std::min(count, datas.size());
+    auto inputs = std::vector<T> {};
+    for (auto i = 0u; i < count; ++i) {
+        inputs.insert(inputs.end(), datas[i].second.begin(), datas[i].second.end());
+    }
+    return { std::move(inputs), count };
+}
+
+// Compare the accuracy of the int8 network with the one it was made from, both on the test samples from scoredBegin.
+template <typename Matrix>
+void run_quantized(NeuralNetwork<Matrix>& network,
+    const std::vector<std::pair<int, std::vector<typename Matrix::ElementType>>>& test_data, size_t scoredBegin,
+    std::pair<std::vector<typename Matrix::ElementType>, size_t> calibration)
+{
+    auto quantized = network.Quantize(std::move(calibration.first), calibration.second);
+    auto scored = std::span { test_data }.subspan(scoredBegin);
+    int quantizedCorrect {}, correct {};
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& [v, inputs] : scored) {
+        if (quantized.Predict(inputs) == (size_t)v) {
+            ++quantizedCorrect;
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    for (const auto& [v, inputs] : scored) {
+        if (network.PredictAsync(inputs).get() == (size_t)v) {
+            ++correct;
+        }
+    }
+    printf("int8 performance = %g, %s performance = %g on %zu samples, int8 queries took %g ms\n",
+        (double)quantizedCorrect / scored.size(), ElementTypeName<typename Matrix::ElementType>(),
+        (double)correct / scored.size(), scored.size(), elapsed.count());
 }
 
 template <typename Matrix>
 void run(NeuralNetwork<Matrix> network, const Options& options)
 {
-    auto training_data = read_data_from_file<typename Matrix::ElementType>(options.training_file);
+    auto trainTag = std::optional<backend::MemoryTag> { "train" };
+    auto calibration = std::pair<std::vector<typename Matrix::ElementType>, size_t> {};
+    if (options.loadFile.empty()) {
+        auto training_data = read_data_from_file<typename Matrix::ElementType>(options.training_file);
+        if (options.quantize) {
+            calibration = first_inputs(training_data, kCalibrationSamples);
+        }
+        // Mixed precision saves the f32 master weights, so they are stored as f32 unless --save-f16 is given.
+        auto dataType = options.saveF16 ? MatrixDataType::Float16
+            : options.mixedPrecision    ? MatrixDataType::Float32
+                                        : DataTypeOf<typename Matrix::ElementType>();
+        if (options.mixedPrecision) {
+            network.EnableMixedPrecision();
+        }
 
-    for (int i = 0; i < options.epochs; ++i) {
-        for (const auto& [v, inputs] : training_data) {
-            std::vector<typename Matrix::ElementType> targets(10, 0.01f);
-            targets[v] = 0.99f;
-            network.Train(inputs, targets);
+        // Snapshot after every epoch, written while the next epoch trains.
+        auto snapshot = std::future<void> {};
+        for (int i = 0; i < options.epochs; ++i) {
+            for (const auto& [v, inputs] : training_data) {
+                std::vector<typename Matrix::ElementType> targets(10, 0.01f);
+                targets[v] = 0.99f;
+                network.Train(inputs, targets);
+            }
+
+            if (!options.saveFile.empty()) {
+                if (snapshot.valid()) {
+                    snapshot.get();
+                }
+                snapshot = network.SaveAsync(options.saveFile, dataType);
+            }
+        }
+        if (snapshot.valid()) {
+            snapshot.get();
+        }
+        if (options.mixedPrecision) {
+            auto [lossScale, skippedSteps] = network.GetLossScaleState();
+            printf("loss scale = %g, %zu steps skipped for overflow\n", lossScale, skippedSteps);
         }
     }
 
+    trainTag.reset();
+
     // test the network
+    auto queryTag = backend::MemoryTag { "query" };
     auto test_data = read_data_from_file<typename Matrix::ElementType>(options.test_file);
     int total {}, correct {};
-    for (const auto& [v, inputs] : test_data) {
-        auto res = network.Query(inputs);
-        if (res.size() != 10) {
-            throw std::runtime_error { "Bad prediction result." };
-        }
+    auto check = [&total, &correct, &options](int v, size_t prediction) {
+        printf("prediction result: %zu, actual result: %d %c\n", prediction, v, (prediction == (size_t)v ? 'o' : 'x'));
 
-        auto maxIndex = 0;
-        for (int i = 1; i < res.size(); ++i) {
-            if (res[i] > res[maxIndex]) {
-                maxIndex = i;
-            }
+        // The cold start of a loaded network, from process start to its first query. After training it would be the
+        // training time.
+        if (!total && !options.loadFile.empty()) {
+            auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s_startTime);
+            printf("time to first result = %g ms, pipeline cache: %s\n", elapsed.count(), s_pipelineCacheState.c_str());
         }
-        printf("prediction result: %d, actual result: %d %c\n", maxIndex, v, (maxIndex == v ? 'o' : 'x'));
-
         ++total;
-        if (maxIndex == v) {
+        if (prediction == (size_t)v) {
             ++correct;
         }
+    };
+
+    // Keep one query in flight, so downloading its result overlaps with computing the next one.
+    auto pending = std::optional<std::pair<int, std::future<size_t>>> {};
+    for (const auto& [v, inputs] : test_data) {
+        auto res = network.PredictAsync(inputs);
+        if (pending) {
+            check(pending->first, pending->second.get());
+        }
+        pending.emplace(v, std::move(res));
+    }
+    if (pending) {
+        check(pending->first, pending->second.get());
     }
     printf("performance = %g\n", (double)((typename Matrix::ElementType)correct / total));
+
+    // A loaded network has no training data, so it is calibrated with the first test samples (at most half of them),
+    // which are then left out of both accuracies rather than scoring the int8 network on its own calibration data.
+    if (options.quantize) {
+        auto scoredBegin = size_t {};
+        if (!calibration.second) {
+            calibration = first_inputs(test_data, std::min(kCalibrationSamples, test_data.size() / 2));
+            scoredBegin = calibration.second;
+        }
+        run_quantized(network, test_data, scoredBegin, std::move(calibration));
+    }
+
+    // While the network is still alive, so its weights are among the live allocations.
+    if (options.memReport) {
+        backend::MemoryTracker::GetInstance().Dump(stdout);
+    }
+}
+
+template <typename Matrix>
+void run(const Options& options)
+{
+    // A loaded network is trained already, so it only runs the test.
+    if (!options.loadFile.empty()) {
+        run(NeuralNetwork<Matrix> { MatrixFile::Open(options.loadFile) }, options);
+        return;
+    }
+
+    run(NeuralNetwork<Matrix> { kInputNodes, kHiddenNodes, kOutputNodes, kLearningRate }, options);
+}
+
+#if CPP_MATRIX_WITH_WEBGPU
+// "cold" or "warm (n shaders)", by the shaders the cache directory holds before this process adds any.
+static std::string describe_pipeline_cache(std::string directory)
+{
+    if (directory.empty()) {
+        const auto* env = std::getenv("CPP_MATRIX_GPU_CACHE_DIR");
+        directory = env ? env : "";
+    }
+    if (directory.empty()) {
+        return "none";
+    }
+
+    auto count = size_t {};
+    std::error_code ec {};
+    auto shaders = std::filesystem::path { directory } / "shaders";
+    for (const auto& entry : std::filesystem::directory_iterator { shaders, ec }) {
+        count += entry.path().extension() == ".wgsl";
+    }
+    return count ? std::format("warm ({} shaders)", count) : "cold";
+}
+#endif
+
+// Call f.template operator()<T>() with the element type chosen by the options.
+template <typename F>
+void with_element_type(const Options& options, F&& f)
+{
+    if (options.useF16) {
+        f.template operator()<std::float16_t>();
+    } else if (options.useBf16) {
+        f.template operator()<std::bfloat16_t>();
+    } else {
+        f.template operator()<std::float32_t>();
+    }
 }
 
 int main(int argc, char* argv[])
@@ -115,32 +366,51 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    const size_t kInputNodes = 784;
-    const size_t kHiddenNodes = 200;
-    const size_t kOutputNodes = 10;
-    const float kLearningRate = 0.1f;
-
     auto options = parse_options(argc - 1, argv + 1);
-    if (options.useWebGpuMatrix) {
-        if (options.useF16) {
-            run(NeuralNetwork<WebGpuMatrix<std::float16_t>> { kInputNodes, kHiddenNodes, kOutputNodes,
-                    (std::float16_t)kLearningRate },
-                options);
+    if (options.benchmark) {
+        // Synthesized data, so no csv file is needed.
+        options.benchmarkOptions.epochs = options.epochs;
+        auto json = ToJson(RunBenchmarks(options.benchmarkOptions));
+        if (options.jsonFile.empty()) {
+            printf("%s", json.c_str());
         } else {
-            run(NeuralNetwork<WebGpuMatrix<std::float32_t>> { kInputNodes, kHiddenNodes, kOutputNodes,
-                    (std::float16_t)kLearningRate },
-                options);
+            std::ofstream { options.jsonFile } << json;
         }
-    } else {
-        if (options.useF16) {
-            run(NeuralNetwork<CpuMatrix<std::float16_t>> { kInputNodes, kHiddenNodes, kOutputNodes,
-                    (std::float16_t)kLearningRate },
-                options);
-        } else {
-            run(NeuralNetwork<CpuMatrix<std::float32_t>> { kInputNodes, kHiddenNodes, kOutputNodes,
-                    (std::float16_t)kLearningRate },
-                options);
+        if (options.memReport) {
+            // stdout may be the json.
+            backend::MemoryTracker::GetInstance().Dump(stderr);
         }
+        return 0;
+    }
+
+#if !CPP_MATRIX_WITH_WEBGPU
+    if (options.useAutoMatrix || options.useWebGpuMatrix) {
+        throw std::runtime_error { "Built without WebGPU (CPP_MATRIX_WITH_WEBGPU is OFF)." };
+    }
+#else
+    if (options.useAutoMatrix) {
+        with_element_type(options, [&]<typename T>() {
+            if (options.calibrate) {
+                AutoMatrix<T>::Calibrate();
+            }
+            run<AutoMatrix<T>>(options);
+        });
+    } else if (options.useWebGpuMatrix) {
+        if (!options.gpuCacheDir.empty()) {
+            webgpu::GpuInstance::GetInstance().SetPipelineCacheDirectory(options.gpuCacheDir);
+        }
+        s_pipelineCacheState = describe_pipeline_cache(options.gpuCacheDir);
+
+        with_element_type(options, [&]<typename T>() {
+            if (options.warmUp) {
+                printf("warmed up %zu kernels\n", WebGpuMatrix<T>::WarmUp());
+            }
+            run<WebGpuMatrix<T>>(options);
+        });
+    } else
+#endif
+    {
+        with_element_type(options, [&]<typename T>() { run<CpuMatrix<T>>(options); });
     }
     return 0;
 }
\ No newline at end of file
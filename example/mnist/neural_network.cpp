@@ -1,9 +1,19 @@
 module;
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
+#include <filesystem>
 #include <fstream>
+#include <future>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <sstream>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 import cpp_matrix;
@@ -12,6 +22,66 @@ export module neural_network;
 
 using namespace cpp_matrix;
 
+/// @brief An inference-only copy of a NeuralNetwork with int8 weights, see backend::QuantizedMatrix.
+///
+/// Each layer reads a quarter of the weight bytes of f32, its product is accumulated in int32, and the dequantization
+/// and Sigmoid() are fused into the product. Queries run on the CPU whatever backend the network was trained on.
+export template <MatrixElementType T>
+class QuantizedNeuralNetwork {
+public:
+    /// @brief calibrationInputs are samples of inputs, one per column, which set the scales the inputs of both layers
+    /// are quantized with (see backend::QuantizationCalibrator).
+    QuantizedNeuralNetwork(const CpuMatrix<T>& wih, const CpuMatrix<T>& who, const CpuMatrix<T>& calibrationInputs)
+        : m_wih { wih.View() }
+        , m_who { who.View() }
+    {
+        auto inputs = backend::QuantizationCalibrator {};
+        inputs.Observe(calibrationInputs.View());
+        m_inputScale = inputs.Scale();
+
+        // The output layer is calibrated with the hidden outputs of the unquantized network.
+        auto hidden = backend::QuantizationCalibrator {};
+        hidden.Observe((wih * calibrationInputs).Sigmoid().View());
+        m_hiddenScale = hidden.Scale();
+    }
+
+    std::vector<T> Query(std::vector<T> inputs_list) const
+    {
+        auto inputs = CpuMatrix<T> { m_wih.Column(), /*column=*/1, inputs_list };
+        return Forward(inputs).Read();
+    }
+
+    size_t Predict(std::vector<T> inputs_list) const
+    {
+        return PredictBatch(std::move(inputs_list), 1)[0];
+    }
+
+    /// @brief Predicted labels of batchSize samples, inputs_list holds one sample after another.
+    std::vector<size_t> PredictBatch(std::vector<T> inputs_list, size_t batchSize) const
+    {
+        auto inputs = CpuMatrix<T> { batchSize, m_wih.Column(), inputs_list }.Transpose();
+        return Forward(inputs).ArgMax();
+    }
+
+private:
+    using Kernels = backend::CpuKernels<T>;
+
+    // inputs has one sample per column.
+    CpuMatrix<T> Forward(const CpuMatrix<T>& inputs) const
+    {
+        auto hidden_outputs = CpuMatrix<T> { m_wih.Row(), inputs.Column() };
+        Kernels::QuantizedMatMul(m_wih, inputs.View(), m_inputScale, hidden_outputs.View(), /*sigmoid=*/true);
+        auto final_outputs = CpuMatrix<T> { m_who.Row(), inputs.Column() };
+        Kernels::QuantizedMatMul(m_who, hidden_outputs.View(), m_hiddenScale, final_outputs.View(), /*sigmoid=*/true);
+        return final_outputs;
+    }
+
+    backend::QuantizedMatrix m_wih {};
+    backend::QuantizedMatrix m_who {};
+    float m_inputScale {};
+    float m_hiddenScale {};
+};
+
 export template <typename Matrix>
 class NeuralNetwork {
 public:
@@ -27,11 +97,268 @@ public:
     {
     }
 
+    /// @brief Restore a network from a checkpoint written by Save(), weights stored as another element type are
+    /// converted. On the CPU backend with the same element type, the weights are used from the mapped file in place.
+    /// Mixed precision, once enabled, continues with the loss scale of the checkpoint.
+    explicit NeuralNetwork(const MatrixFile& checkpoint)
+        : m_wih { Matrix::Load(checkpoint, "wih") }
+        , m_who { Matrix::Load(checkpoint, "who") }
+    {
+        auto state = checkpoint.GetData<std::float32_t>("state");
+        if (state.size() != kStateSize && state.size() != kLayerStateSize) {
+            throw std::runtime_error { "Unexpected checkpoint." };
+        }
+        m_inodes = (size_t)state[0];
+        m_hnodes = (size_t)state[1];
+        m_onodes = (size_t)state[2];
+        m_lr = state[3];
+        if (state.size() == kStateSize) {
+            m_lossScaler.Restore(state[4], (size_t)state[5], (size_t)state[6]);
+        }
+        if (m_wih.Row() != m_hnodes || m_wih.Column() != m_inodes || m_who.Row() != m_onodes
+            || m_who.Column() != m_hnodes) {
+            throw std::runtime_error { "Unexpected checkpoint." };
+        }
+    }
+
+    /// @brief Train with f32 master weights and dynamic loss scaling from now on, e.g. for f16 and bf16 networks.
+    ///
+    /// Products still run in T, but updates are added to the f32 copy of the weights, so updates much smaller than a
+    /// weight aren't rounded away, and T copies of it are made for the next step. Errors are multiplied by a loss scale
+    /// before they are propagated back, so small gradients don't flush to zero, see LossScaler. Training throws if the
+    /// gradients overflow even at the minimum scale.
+    ///
+    /// Whether a step overflowed is read back asynchronously, and the step is applied (or skipped) when the weights
+    /// are used next, so the GPU isn't waited for in every step.
+    void EnableMixedPrecision()
+    {
+        ApplyPendingStep();
+        m_mixedPrecision = MixedPrecision {
+            .wih = m_wih.template Cast<std::float32_t>(),
+            .who = m_who.template Cast<std::float32_t>(),
+        };
+    }
+
+    /// @brief The loss scale and the number of skipped steps of mixed precision training, see EnableMixedPrecision().
+    std::pair<float, size_t> GetLossScaleState()
+    {
+        ApplyPendingStep();
+        return m_mixedPrecision ? std::pair { m_lossScaler.Scale(), m_lossScaler.SkippedSteps() }
+                                : std::pair { 1.f, size_t {} };
+    }
+
     void Train(std::vector<T> inputs_list, std::vector<T> targets_list)
     {
         // convert inputs list to matrix
         auto inputs = Matrix { m_inodes, /*column=*/1, inputs_list };
         auto targets = Matrix { m_onodes, /*column=*/1, targets_list };
+        Train(inputs, targets, m_lr);
+    }
+
+    /// @brief Train with batchSize samples at once, the gradients of the samples are averaged, so the learning rate
+    /// means the same for any batch size.
+    ///
+    /// inputs_list and targets_list hold one sample after another.
+    void TrainBatch(std::vector<T> inputs_list, std::vector<T> targets_list, size_t batchSize)
+    {
+        // one sample per column
+        auto inputs = Matrix { batchSize, m_inodes, inputs_list }.Transpose();
+        auto targets = Matrix { batchSize, m_onodes, targets_list }.Transpose();
+
+        // The products below sum the gradients of all samples, scaling the rate turns the sum into the mean.
+        Train(inputs, targets, m_lr / batchSize);
+    }
+
+    std::vector<T> Query(std::vector<T> inputs_list)
+    {
+        return QueryAsync(std::move(inputs_list)).get();
+    }
+
+    std::future<std::vector<T>> QueryAsync(std::vector<T> inputs_list)
+    {
+        ApplyPendingStep();
+        PackWeights();
+
+        // convert inputs list to matrix
+        auto inputs = Matrix { m_inodes, /*column=*/1, inputs_list };
+
+        // caculate signals into hidden layer
+        auto hidden_inputs = m_wih * inputs;
+
+        // calculate the signals emerging from hidden layer
+        auto hidden_outputs = hidden_inputs.Sigmoid();
+
+        // calculate signals into final output layer
+        auto final_inputs = m_who * hidden_outputs;
+
+        // caculate the signals emerging from final output layer
+        auto final_outputs = final_inputs.Sigmoid();
+
+        return final_outputs.ReadAsync();
+    }
+
+    /// @brief Get the predicted label, only the label is downloaded instead of all outputs.
+    std::future<size_t> PredictAsync(std::vector<T> inputs_list)
+    {
+        ApplyPendingStep();
+        PackWeights();
+        auto inputs = Matrix { m_inodes, /*column=*/1, inputs_list };
+        return std::async(std::launch::deferred, [labels = Forward(inputs).ArgMaxAsync()]() mutable {
+            return labels.get()[0];
+        });
+    }
+
+    /// @brief Get the predicted labels of batchSize samples, inputs_list holds one sample after another.
+    std::future<std::vector<size_t>> PredictBatchAsync(std::vector<T> inputs_list, size_t batchSize)
+    {
+        ApplyPendingStep();
+        PackWeights();
+        auto inputs = Matrix { batchSize, m_inodes, inputs_list }.Transpose();
+        return Forward(inputs).ArgMaxAsync();
+    }
+
+    /// @brief An int8 copy of the network for inference, see QuantizedNeuralNetwork. calibration_list holds sampleCount
+    /// inputs one after another, e.g. a few hundred training samples.
+    QuantizedNeuralNetwork<T> Quantize(std::vector<T> calibration_list, size_t sampleCount)
+    {
+        ApplyPendingStep();
+        auto inputs = CpuMatrix<T> { sampleCount, m_inodes, calibration_list }.Transpose();
+        if constexpr (std::is_same_v<Matrix, CpuMatrix<T>>) {
+            return { m_wih, m_who, inputs };
+        } else {
+            auto wih = m_wih.Read();
+            auto who = m_who.Read();
+            return { CpuMatrix<T> { m_hnodes, m_inodes, wih }, CpuMatrix<T> { m_onodes, m_hnodes, who }, inputs };
+        }
+    }
+
+    /// @brief Write a checkpoint of the weights, the learning rate and the loss scale, weights are stored as dataType
+    /// (Float16 halves the size of a f32 network).
+    void Save(const std::filesystem::path& path, MatrixDataType dataType = DataTypeOf<T>())
+    {
+        SaveAsync(path, dataType).get();
+    }
+
+    /// @brief Write a checkpoint of the network as it is now, training can go on while it is written.
+    ///
+    /// Networks on the CPU are copied and written by another thread. GPU weights are updated in place, so instead
+    /// every block of them is downloaded now, ahead of later updates in the GPU queue. Another thread waits for the
+    /// blocks, converts and writes them, if the device lets readbacks be waited for there. Otherwise, they are waited
+    /// for and written by whichever thread gets the returned future, which must be the thread using the GPU.
+    std::future<void> SaveAsync(std::filesystem::path path, MatrixDataType dataType = DataTypeOf<T>())
+    {
+        ApplyPendingStep();
+
+        // The plain SGD has no state besides the learning rate, which is stored with the layer sizes and the state of
+        // the loss scaler.
+        auto state = std::array<std::float32_t, kStateSize> {
+            (std::float32_t)m_inodes,
+            (std::float32_t)m_hnodes,
+            (std::float32_t)m_onodes,
+            m_lr,
+            m_lossScaler.Scale(),
+            (std::float32_t)m_lossScaler.StepsWithoutOverflow(),
+            (std::float32_t)m_lossScaler.SkippedSteps(),
+        };
+        auto write = [path = std::move(path), dataType, state](const auto& saveWeights) {
+            auto writer = MatrixFileWriter { path };
+            writer.Add("state", 1, kStateSize, std::span<const std::float32_t> { state });
+            saveWeights(writer, dataType);
+            writer.Close();
+        };
+        auto save = [&](const auto& wih, const auto& who) {
+            if constexpr (Matrix::kIsThreadSafe) {
+                return std::async(std::launch::async, [write, wih, who] {
+                    write([&](auto& writer, auto dataType) {
+                        wih.Save(writer, "wih", dataType);
+                        who.Save(writer, "who", dataType);
+                    });
+                });
+            } else {
+                using Weights = std::remove_cvref_t<decltype(wih)>;
+                struct Download {
+                    size_t row {};
+                    size_t column {};
+                    std::vector<std::future<std::vector<typename Weights::ElementType>>> blocks {};
+                };
+                auto task = [write, wihDownload = Download { wih.Row(), wih.Column(), wih.ReadBlocksAsync() },
+                                whoDownload = Download { who.Row(), who.Column(), who.ReadBlocksAsync() }]() mutable {
+                    write([&](auto& writer, auto dataType) {
+                        auto saveBlocks = [&](std::string_view name, Download& download) {
+                            Weights::SaveBlocks(
+                                writer, name, download.row, download.column, std::move(download.blocks), dataType);
+                        };
+                        saveBlocks("wih", wihDownload);
+                        saveBlocks("who", whoDownload);
+                    });
+                };
+                return std::async(
+                    Weights::IsReadbackThreadSafe() ? std::launch::async : std::launch::deferred, std::move(task));
+            }
+        };
+
+        // With mixed precision the master weights are the network, the T copies are rounded.
+        return m_mixedPrecision ? save(m_mixedPrecision->wih, m_mixedPrecision->who) : save(m_wih, m_who);
+    }
+
+private:
+    // Input, hidden and output nodes and the learning rate, then the loss scale, the steps without overflow and the
+    // skipped steps. All are exact in f32, the step counts up to 2^24. Older checkpoints end after the learning rate.
+    static constexpr size_t kStateSize = 7;
+    static constexpr size_t kLayerStateSize = 4;
+
+    using MasterMatrix = decltype(std::declval<const Matrix&>().template Cast<std::float32_t>());
+
+    // The largest power of two below the f16 maximum, a scalar of an f16 expression must not overflow. Mixed precision
+    // starts with it and backs off at the first overflows.
+    static constexpr float kMaxLossScale = 1 << 15;
+
+    static constexpr size_t kLossScaleGrowthInterval = 1000;
+
+    // The gradients of a mixed precision step, which is applied once the sum of them is read back.
+    struct PendingStep {
+        MasterMatrix wihGradients {};
+        MasterMatrix whoGradients {};
+        float unscaledLr {};
+        std::future<std::vector<std::float32_t>> sum {};
+    };
+
+    struct MixedPrecision {
+        MasterMatrix wih {};
+        MasterMatrix who {};
+        std::optional<PendingStep> pendingStep {};
+    };
+
+    // Queries multiply the same weights by every input, so they are packed once. Training updates the weights after a
+    // few products, so it unpacks them rather than packing them every step, and the first query after it packs them
+    // again.
+    void PackWeights()
+    {
+        m_wih.Pack();
+        m_who.Pack();
+    }
+
+    void UnpackWeights()
+    {
+        m_wih.Unpack();
+        m_who.Unpack();
+    }
+
+    // inputs has one sample per column, the result has the outputs of each sample in its column.
+    Matrix Forward(const Matrix& inputs) const
+    {
+        return (m_who * (m_wih * inputs).Sigmoid()).Sigmoid();
+    }
+
+    // inputs and targets have one sample per column.
+    void Train(const Matrix& inputs, const Matrix& targets, float lr)
+    {
+        ApplyPendingStep();
+        UnpackWeights();
+        if (m_mixedPrecision) {
+            TrainMixedPrecision(inputs, targets, lr);
+            return;
+        }
 
         // calculate signals into hidden layer
         auto hidden_inputs = m_wih * inputs;
@@ -51,42 +378,68 @@ public:
         // hidden layer error is the output_errors, split by weights, recombined at hidden nodes
         auto hidden_errors = m_who.Transpose() * output_errors;
 
-        // update the weights for the links between the hidden and output layers
-        m_who += m_lr
-            * (output_errors.ElementProduct(final_outputs).ElementProduct(1.0f - final_outputs)
-                * hidden_outputs.Transpose());
+        // update the weights for the links between the hidden and output layers in place, element-wise parts are fused
+        auto output_gradients = (output_errors.Fuse() * final_outputs * (1.0f - final_outputs.Fuse())).Evaluate();
+        (m_who.Fuse() + lr * (output_gradients * hidden_outputs.Transpose()).Fuse()).Evaluate(m_who);
 
         // update the weights for the links between the input and hidden layers
-        m_wih += m_lr
-            * ((hidden_errors.ElementProduct(hidden_outputs).ElementProduct(1.0f - hidden_outputs)
-                * inputs.Transpose()));
+        auto hidden_gradients = (hidden_errors.Fuse() * hidden_outputs * (1.0f - hidden_outputs.Fuse())).Evaluate();
+        (m_wih.Fuse() + lr * (hidden_gradients * inputs.Transpose()).Fuse()).Evaluate(m_wih);
     }
 
-    std::vector<T> Query(std::vector<T> inputs_list)
+    // The steps of Train() with the errors multiplied by the loss scale, the update is left pending, see
+    // ApplyPendingStep().
+    void TrainMixedPrecision(const Matrix& inputs, const Matrix& targets, float lr)
     {
-        // convert inputs list to matrix
-        auto inputs = Matrix { m_inodes, /*column=*/1, inputs_list };
+        auto scale = m_lossScaler.Scale();
+        auto hidden_outputs = (m_wih * inputs).Sigmoid();
+        auto final_outputs = (m_who * hidden_outputs).Sigmoid();
 
-        // caculate signals into hidden layer
-        auto hidden_inputs = m_wih * inputs;
+        // scaled output errors, everything propagated back from them is scaled too
+        auto output_errors = (scale * (targets.Fuse() - final_outputs)).Evaluate();
+        auto hidden_errors = m_who.Transpose() * output_errors;
+        auto output_gradients = (output_errors.Fuse() * final_outputs * (1.0f - final_outputs.Fuse())).Evaluate();
+        auto hidden_gradients = (hidden_errors.Fuse() * hidden_outputs * (1.0f - hidden_outputs.Fuse())).Evaluate();
+        auto who_gradients = (output_gradients * hidden_outputs.Transpose()).template Cast<std::float32_t>();
+        auto wih_gradients = (hidden_gradients * inputs.Transpose()).template Cast<std::float32_t>();
 
-        // calculate the signals emerging from hidden layer
-        auto hidden_outputs = hidden_inputs.Sigmoid();
+        // An overflow in T leaves inf or NaN in the gradients, which their f32 sum keeps. Only the sum is downloaded,
+        // and it isn't waited for until the next step, whose inputs are prepared meanwhile.
+        auto sum = (who_gradients.Sum() + wih_gradients.Sum()).ReadAsync();
+        m_mixedPrecision->pendingStep = PendingStep {
+            .wihGradients = std::move(wih_gradients),
+            .whoGradients = std::move(who_gradients),
+            .unscaledLr = lr / scale,
+            .sum = std::move(sum),
+        };
+    }
 
-        // calculate signals into final output layer
-        auto final_inputs = m_who * hidden_outputs;
+    // Apply the pending step of mixed precision training if its gradients are finite, before the weights are used.
+    void ApplyPendingStep()
+    {
+        if (!m_mixedPrecision || !m_mixedPrecision->pendingStep) {
+            return;
+        }
 
-        // caculate the signals emerging from final output layer
-        auto final_outputs = final_inputs.Sigmoid();
+        auto& mixed = *m_mixedPrecision;
+        auto step = std::move(*mixed.pendingStep);
+        mixed.pendingStep.reset();
+        if (!m_lossScaler.Update(std::isfinite(step.sum.get()[0]))) {
+            return;
+        }
 
-        return final_outputs.Read();
+        (mixed.who.Fuse() + step.unscaledLr * step.whoGradients.Fuse()).Evaluate(mixed.who);
+        (mixed.wih.Fuse() + step.unscaledLr * step.wihGradients.Fuse()).Evaluate(mixed.wih);
+        m_who = mixed.who.template Cast<T>();
+        m_wih = mixed.wih.template Cast<T>();
     }
 
-private:
     size_t m_inodes {};
     size_t m_hnodes {};
     size_t m_onodes {};
     Matrix m_wih {};
     Matrix m_who {};
     float m_lr {};
+    LossScaler m_lossScaler { kMaxLossScale, kLossScaleGrowthInterval };
+    std::optional<MixedPrecision> m_mixedPrecision {};
 };
@@ -0,0 +1,493 @@
+module;
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+export module cpp_matrix:auto_matrix;
+import :cost_model;
+import :cpu_matrix;
+import :expression;
+import :matrix_type;
+import :std_patch;
+import :webgpu_matrix;
+
+namespace cpp_matrix::backend {
+
+/// @brief Runs every op on CPU or GPU, whichever CostModel estimates to be faster for its shape.
+///
+/// The estimation includes moving operands which are not on that device yet. A matrix keeps a copy on every device it
+/// was moved to, so a weight matrix is uploaded once and then reused by every later op on GPU. Moving is done lazily
+/// by const ops, so a matrix must not be used by several threads at the same time.
+export template <MatrixElementType T>
+class AutoMatrix {
+    template <MatrixElementType R>
+    friend AutoMatrix<R> operator-(R v, const AutoMatrix<R>& m);
+
+    template <MatrixElementType R>
+    friend AutoMatrix<R> operator*(R v, const AutoMatrix<R>& m);
+
+    // Cast() wraps a matrix of another element type.
+    template <MatrixElementType>
+    friend class AutoMatrix;
+
+public:
+    using ElementType = T;
+
+    /// @brief Measure every op on both devices, replace the costs of this element type in CostModel by them.
+    ///
+    /// Each op is measured on a small and a big shape, the overhead and the per-unit cost are fitted from them. The
+    /// model is saved to CostModel::GetPath() if it is set, so later processes start with these costs.
+    static void Calibrate()
+    {
+        auto& model = CostModel::GetInstance();
+        for (auto device : { Device::Cpu, Device::Gpu }) {
+            auto fit = [&](OpKind kind, size_t smallSize, size_t bigSize, auto&& op) {
+                auto small = Measure(device, kind, smallSize, op);
+                auto big = Measure(device, kind, bigSize, op);
+                auto nanosecondsPerUnit = std::max((big.second - small.second) * 1000 / (big.first - small.first), 0.);
+                auto overhead = std::max(small.second - nanosecondsPerUnit * small.first / 1000, 0.);
+                model.Set(DataType(), device, kind, { overhead, nanosecondsPerUnit });
+            };
+            fit(OpKind::ElementWise, 16, 512, [](const AutoMatrix& m) { return m + m; });
+            fit(OpKind::MatMul, 16, 256, [](const AutoMatrix& m) { return m * m; });
+            fit(OpKind::Transpose, 16, 512, [](const AutoMatrix& m) { return m.Transpose(); });
+            fit(OpKind::Reduction, 16, 512, [](const AutoMatrix& m) { return m.RowSum(); });
+
+            // m only lives on the other device, move a copy of it, so every run transfers.
+            fit(OpKind::Transfer, 16, 512, [device](const AutoMatrix& m) { return AutoMatrix { m }.To(device); });
+        }
+
+        if (!model.GetPath().empty()) {
+            model.Save(model.GetPath());
+        }
+    }
+
+    AutoMatrix() = default;
+
+    AutoMatrix(size_t row, size_t column)
+        : m_row { row }
+        , m_column { column }
+        , m_cpuMatrix { row, column }
+    {
+    }
+
+    size_t Row() const
+    {
+        return m_row;
+    }
+
+    size_t Column() const
+    {
+        return m_column;
+    }
+
+    /// @brief Whether the data is on device, i.e. an op on it doesn't need a transfer.
+    bool IsOn(Device device) const
+    {
+        return device == Device::Cpu ? m_isOnCpu : m_isOnGpu;
+    }
+
+    AutoMatrix& operator=(std::vector<T> data)
+    {
+        m_row = 1;
+        m_column = data.size();
+        m_cpuMatrix = std::move(data);
+        SetDevice(Device::Cpu);
+        return *this;
+    }
+
+    /// @brief Data is written on CPU, it is moved to GPU by the first op which runs there.
+    void Write(std::span<T> data)
+    {
+        if (!m_isOnCpu) {
+            m_cpuMatrix = CpuMatrix<T> { m_row, m_column };
+        }
+        m_cpuMatrix.Write(data);
+        SetDevice(Device::Cpu);
+    }
+
+    std::future<void> WriteAsync(std::span<T> data)
+    {
+        Write(data);
+        return std::async(std::launch::deferred, [] { });
+    }
+
+    std::vector<T> Read() const
+    {
+        return m_isOnCpu ? m_cpuMatrix.Read() : m_gpuMatrix.Read();
+    }
+
+    static bool IsReadbackThreadSafe()
+    {
+        return WebGpuMatrix<T>::IsReadbackThreadSafe();
+    }
+
+    std::future<std::vector<T>> ReadAsync() const
+    {
+        return m_isOnCpu ? m_cpuMatrix.ReadAsync() : m_gpuMatrix.ReadAsync();
+    }
+
+    std::future<std::vector<T>> ReadRowsAsync(size_t rowBegin, size_t rowEnd) const
+    {
+        return m_isOnCpu ? m_cpuMatrix.ReadRowsAsync(rowBegin, rowEnd) : m_gpuMatrix.ReadRowsAsync(rowBegin, rowEnd);
+    }
+
+    AutoMatrix operator*(const AutoMatrix& other) const
+    {
+        if (ChooseDevice(OpKind::MatMul, m_row * m_column * other.m_column, { this, &other }) == Device::Gpu) {
+            return Gpu() * other.Gpu();
+        }
+        return Cpu() * other.Cpu();
+    }
+
+    AutoMatrix operator+(const AutoMatrix& other) const
+    {
+        if (ChooseDevice(OpKind::ElementWise, Size(), { this, &other }) == Device::Gpu) {
+            return Gpu() + other.Gpu();
+        }
+        return Cpu() + other.Cpu();
+    }
+
+    AutoMatrix& operator+=(const AutoMatrix& other)
+    {
+        // In place on the chosen device, the copy on the other device is stale afterwards.
+        if (ChooseDevice(OpKind::ElementWise, Size(), { this, &other }) == Device::Gpu) {
+            Gpu();
+            m_gpuMatrix += other.Gpu();
+            SetDevice(Device::Gpu);
+        } else {
+            Cpu();
+            m_cpuMatrix += other.Cpu();
+            SetDevice(Device::Cpu);
+        }
+        return *this;
+    }
+
+    AutoMatrix operator+(T v) const
+    {
+        if (ChooseDevice(OpKind::ElementWise, Size(), { this }) == Device::Gpu) {
+            return Gpu() + v;
+        }
+        return Cpu() + v;
+    }
+
+    AutoMatrix operator-(const AutoMatrix& other) const
+    {
+        if (ChooseDevice(OpKind::ElementWise, Size(), { this, &other }) == Device::Gpu) {
+            return Gpu() - other.Gpu();
+        }
+        return Cpu() - other.Cpu();
+    }
+
+    AutoMatrix Sigmoid() const
+    {
+        if (ChooseDevice(OpKind::ElementWise, Size(), { this }) == Device::Gpu) {
+            return Gpu().Sigmoid();
+        }
+        return Cpu().Sigmoid();
+    }
+
+    AutoMatrix Transpose() const
+    {
+        if (ChooseDevice(OpKind::Transpose, Size(), { this }) == Device::Gpu) {
+            return Gpu().Transpose();
+        }
+        return Cpu().Transpose();
+    }
+
+    /// @brief A copy converted to element type U where the data is, so it never moves. The GPU wins if both have it.
+    template <MatrixElementType U>
+    AutoMatrix<U> Cast() const
+    {
+        if (m_isOnGpu) {
+            return AutoMatrix<U> { m_gpuMatrix.template Cast<U>() };
+        }
+        return AutoMatrix<U> { m_cpuMatrix.template Cast<U>() };
+    }
+
+    AutoMatrix ElementProduct(const AutoMatrix& other) const
+    {
+        if (ChooseDevice(OpKind::ElementWise, Size(), { this, &other }) == Device::Gpu) {
+            return Gpu().ElementProduct(other.Gpu());
+        }
+        return Cpu().ElementProduct(other.Cpu());
+    }
+
+    AutoMatrix Relu() const
+    {
+        if (ChooseDevice(OpKind::ElementWise, Size(), { this }) == Device::Gpu) {
+            return Gpu().Relu();
+        }
+        return Cpu().Relu();
+    }
+
+    T operator[](size_t row, size_t column) const
+    {
+        return m_isOnCpu ? m_cpuMatrix[row, column] : m_gpuMatrix[row, column];
+    }
+
+    /// @brief Sum of each row, the result is a row x 1 matrix.
+    AutoMatrix RowSum() const
+    {
+        if (ChooseDevice(OpKind::Reduction, Size(), { this }) == Device::Gpu) {
+            return Gpu().RowSum();
+        }
+        return Cpu().RowSum();
+    }
+
+    /// @brief Sum of each column, the result is a 1 x column matrix.
+    AutoMatrix ColumnSum() const
+    {
+        if (ChooseDevice(OpKind::Reduction, Size(), { this }) == Device::Gpu) {
+            return Gpu().ColumnSum();
+        }
+        return Cpu().ColumnSum();
+    }
+
+    /// @brief Sum of all elements, the result is a 1 x 1 matrix.
+    AutoMatrix Sum() const
+    {
+        if (ChooseDevice(OpKind::Reduction, Size(), { this }) == Device::Gpu) {
+            return Gpu().Sum();
+        }
+        return Cpu().Sum();
+    }
+
+    /// @brief Maximum of all elements, the result is a 1 x 1 matrix.
+    AutoMatrix Max() const
+    {
+        if (ChooseDevice(OpKind::Reduction, Size(), { this }) == Device::Gpu) {
+            return Gpu().Max();
+        }
+        return Cpu().Max();
+    }
+
+    /// @brief Row index of the maximum of each column, the first one wins if there are several.
+    std::vector<size_t> ArgMax() const
+    {
+        return ArgMaxAsync().get();
+    }
+
+    std::future<std::vector<size_t>> ArgMaxAsync() const
+    {
+        if (ChooseDevice(OpKind::Reduction, Size(), { this }) == Device::Gpu) {
+            return Gpu().ArgMaxAsync();
+        }
+        return Cpu().ArgMaxAsync();
+    }
+
+    /// @brief Evaluate an element-wise expression with the backend of the chosen device.
+    ///
+    /// The work is estimated as one element-wise op per node of the expression.
+    static AutoMatrix Evaluate(const ExpressionNode<AutoMatrix>& root)
+    {
+        auto inputs = ExpressionInputs(root);
+        auto operands = std::vector<const AutoMatrix*> { inputs.begin(), inputs.end() };
+        auto units = inputs[0]->Size() * CountNodes(root);
+        if (ChooseDevice(OpKind::ElementWise, units, operands) == Device::Gpu) {
+            return WebGpuMatrix<T>::Evaluate(*ConvertExpression(root, &AutoMatrix::Gpu));
+        }
+        return CpuMatrix<T>::Evaluate(*ConvertExpression(root, &AutoMatrix::Cpu));
+    }
+
+    /// @brief Evaluate an element-wise expression into out, which may be one of its inputs, on the chosen device.
+    static void Evaluate(const ExpressionNode<AutoMatrix>& root, AutoMatrix& out)
+    {
+        auto inputs = ExpressionInputs(root);
+        auto operands = std::vector<const AutoMatrix*> { inputs.begin(), inputs.end() };
+        if (std::ranges::find(inputs, &out) == inputs.end()) {
+            operands.push_back(&out);
+        }
+        auto units = inputs[0]->Size() * CountNodes(root);
+        if (ChooseDevice(OpKind::ElementWise, units, operands) == Device::Gpu) {
+            out.Gpu();
+            WebGpuMatrix<T>::Evaluate(*ConvertExpression(root, &AutoMatrix::Gpu), out.m_gpuMatrix);
+            out.SetDevice(Device::Gpu);
+            return;
+        }
+        out.Cpu();
+        CpuMatrix<T>::Evaluate(*ConvertExpression(root, &AutoMatrix::Cpu), out.m_cpuMatrix);
+        out.SetDevice(Device::Cpu);
+    }
+
+private:
+    AutoMatrix(CpuMatrix<T> m)
+        : m_row { m.Row() }
+        , m_column { m.Column() }
+        , m_cpuMatrix { std::move(m) }
+    {
+    }
+
+    AutoMatrix(WebGpuMatrix<T> m)
+        : m_row { m.Row() }
+        , m_column { m.Column() }
+        , m_gpuMatrix { std::move(m) }
+        , m_isOnCpu { false }
+        , m_isOnGpu { true }
+    {
+    }
+
+    // Set by Calibrate(), every op runs on it.
+    static inline std::optional<Device> s_forcedDevice {};
+
+    static constexpr std::string_view DataType()
+    {
+        return ElementTypeName<T>();
+    }
+
+    size_t Size() const
+    {
+        return m_row * m_column;
+    }
+
+    // Estimate the op on both devices, including moving operands which are not there yet.
+    static Device ChooseDevice(OpKind kind, size_t units, std::span<const AutoMatrix* const> operands)
+    {
+        if (s_forcedDevice) {
+            return *s_forcedDevice;
+        }
+
+        const auto& model = CostModel::GetInstance();
+        auto estimate = [&](Device device) {
+            auto microseconds = model.Estimate(DataType(), device, kind, units);
+            for (const auto* pOperand : operands) {
+                if (!pOperand->IsOn(device)) {
+                    microseconds += model.Estimate(DataType(), device, OpKind::Transfer, sizeof(T) * pOperand->Size());
+                }
+            }
+            return microseconds;
+        };
+        return estimate(Device::Gpu) < estimate(Device::Cpu) ? Device::Gpu : Device::Cpu;
+    }
+
+    static Device ChooseDevice(OpKind kind, size_t units, std::initializer_list<const AutoMatrix*> operands)
+    {
+        return ChooseDevice(kind, units, std::span { operands.begin(), operands.end() });
+    }
+
+    const CpuMatrix<T>& Cpu() const
+    {
+        if (!m_isOnCpu) {
+            auto data = m_gpuMatrix.Read();
+            m_cpuMatrix = CpuMatrix<T> { m_row, m_column };
+            m_cpuMatrix.Write(std::span<T> { data });
+            m_isOnCpu = true;
+        }
+        return m_cpuMatrix;
+    }
+
+    const WebGpuMatrix<T>& Gpu() const
+    {
+        if (!m_isOnGpu) {
+            auto data = m_cpuMatrix.Read();
+            m_gpuMatrix = WebGpuMatrix<T> { m_row, m_column };
+            m_gpuMatrix.Write(std::span<T> { data });
+            m_isOnGpu = true;
+        }
+        return m_gpuMatrix;
+    }
+
+    // A copy which only lives on device.
+    AutoMatrix To(Device device) const
+    {
+        if (device == Device::Gpu) {
+            return Gpu();
+        }
+        return Cpu();
+    }
+
+    // Only keep the copy on device, the other one is stale after a write.
+    void SetDevice(Device device)
+    {
+        m_isOnCpu = device == Device::Cpu;
+        m_isOnGpu = device == Device::Gpu;
+        if (!m_isOnGpu) {
+            m_gpuMatrix = {};
+        }
+        if (!m_isOnCpu) {
+            m_cpuMatrix = {};
+        }
+    }
+
+    static size_t CountNodes(const ExpressionNode<AutoMatrix>& node)
+    {
+        return 1 + (node.pLhs ? CountNodes(*node.pLhs) : 0) + (node.pRhs ? CountNodes(*node.pRhs) : 0);
+    }
+
+    // The same expression on the backend matrices of one device, which are moved there if needed.
+    template <typename M>
+    static std::shared_ptr<const ExpressionNode<M>> ConvertExpression(
+        const ExpressionNode<AutoMatrix>& node, const M& (AutoMatrix::*backend)() const)
+    {
+        return std::make_shared<const ExpressionNode<M>>(ExpressionNode<M> {
+            .op = static_cast<ExpressionNode<M>::Op>(node.op),
+            .pInput = node.pInput ? &(node.pInput->*backend)() : nullptr,
+            .scalar = node.scalar,
+            .pLhs = node.pLhs ? ConvertExpression(*node.pLhs, backend) : nullptr,
+            .pRhs = node.pRhs ? ConvertExpression(*node.pRhs, backend) : nullptr,
+        });
+    }
+
+    // Run op on device with a size x size matrix, returns the number of units and the average microseconds.
+    template <typename F>
+    static std::pair<double, double> Measure(Device device, OpKind kind, size_t size, F&& op)
+    {
+        constexpr auto kIterations = 10;
+        auto other = device == Device::Cpu ? Device::Gpu : Device::Cpu;
+        std::vector<T> data(size * size, T(0.5));
+        auto m = AutoMatrix { size, size };
+        m.Write(std::span<T> { data });
+        m = m.To(kind == OpKind::Transfer ? other : device);
+
+        s_forcedDevice = device;
+        // The first run compiles kernels on GPU.
+        op(m).Read();
+        auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < kIterations; ++i) {
+            op(m);
+        }
+        auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+        s_forcedDevice.reset();
+
+        auto units = kind == OpKind::MatMul ? (double)size * size * size
+            : kind == OpKind::Transfer      ? (double)sizeof(T) * size * size
+                                            : (double)size * size;
+        return { units, elapsed.count() / kIterations };
+    }
+
+    size_t m_row {};
+    size_t m_column {};
+    mutable CpuMatrix<T> m_cpuMatrix {};
+    mutable WebGpuMatrix<T> m_gpuMatrix {};
+    mutable bool m_isOnCpu { true };
+    mutable bool m_isOnGpu {};
+};
+
+export template <MatrixElementType T>
+AutoMatrix<T> operator-(T v, const AutoMatrix<T>& m)
+{
+    if (AutoMatrix<T>::ChooseDevice(OpKind::ElementWise, m.Size(), { &m }) == Device::Gpu) {
+        return v - m.Gpu();
+    }
+    return v - m.Cpu();
+}
+
+export template <MatrixElementType T>
+AutoMatrix<T> operator*(T v, const AutoMatrix<T>& m)
+{
+    if (AutoMatrix<T>::ChooseDevice(OpKind::ElementWise, m.Size(), { &m }) == Device::Gpu) {
+        return v * m.Gpu();
+    }
+    return v * m.Cpu();
+}
+
+}
@@ -0,0 +1,183 @@
+module;
+
+#include <array>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <unistd.h>
+
+export module cpp_matrix:cost_model;
+
+namespace cpp_matrix::backend {
+
+export enum class Device {
+    Cpu,
+    Gpu,
+};
+
+export enum class OpKind {
+    // Units are elements.
+    ElementWise,
+    // Units are multiply-adds (row x inner x column).
+    MatMul,
+    // Units are elements.
+    Transpose,
+    // Units are elements of the input.
+    Reduction,
+    // Moving a matrix to the device, units are bytes.
+    Transfer,
+};
+
+/// @brief Estimated latency of an op: a fixed overhead plus a cost per unit of work.
+export struct OpCost {
+    double overheadMicroseconds {};
+    double nanosecondsPerUnit {};
+
+    double Estimate(size_t units) const
+    {
+        return overheadMicroseconds + nanosecondsPerUnit * units / 1000;
+    }
+};
+
+/// @brief Latencies of every op on every device, AutoMatrix runs each op where it is estimated to be faster.
+///
+/// It starts with rough defaults, AutoMatrix::Calibrate() replaces them with measurements of this machine. If
+/// CPP_MATRIX_COST_MODEL is set to a file path, the model is loaded from it at startup and calibration saves to it,
+/// one "dtype device op overhead_us ns_per_unit" line per entry, e.g. "f32 gpu matmul 35.2 0.004".
+export class CostModel {
+public:
+    static CostModel& GetInstance()
+    {
+        static CostModel s_costModel {};
+        return s_costModel;
+    }
+
+    CostModel()
+    {
+        if (auto* path = std::getenv("CPP_MATRIX_COST_MODEL")) {
+            m_path = path;
+            Load(m_path);
+        }
+    }
+
+    /// @brief The file loaded at startup, empty if CPP_MATRIX_COST_MODEL is not set.
+    const std::filesystem::path& GetPath() const
+    {
+        return m_path;
+    }
+
+    OpCost Get(std::string_view dtype, Device device, OpKind kind) const
+    {
+        if (auto it = m_costs.find({ std::string { dtype }, device, kind }); it != m_costs.end()) {
+            return it->second;
+        }
+        return kDefaultCosts[(size_t)device][(size_t)kind];
+    }
+
+    void Set(std::string_view dtype, Device device, OpKind kind, OpCost cost)
+    {
+        m_costs[{ std::string { dtype }, device, kind }] = cost;
+    }
+
+    double Estimate(std::string_view dtype, Device device, OpKind kind, size_t units) const
+    {
+        return Get(dtype, device, kind).Estimate(units);
+    }
+
+    /// @brief Forget measured costs, the defaults are used again.
+    void Reset()
+    {
+        m_costs.clear();
+    }
+
+    /// @brief Load costs from path, returns false if it can't be opened. Unknown lines are ignored.
+    bool Load(const std::filesystem::path& path)
+    {
+        auto in = std::ifstream { path };
+        if (!in) {
+            return false;
+        }
+
+        auto line = std::string {};
+        while (std::getline(in, line)) {
+            auto ss = std::istringstream { line };
+            std::string dtype, device, kind;
+            auto cost = OpCost {};
+            if (!(ss >> dtype >> device >> kind >> cost.overheadMicroseconds >> cost.nanosecondsPerUnit)) {
+                continue;
+            }
+
+            auto deviceIndex = IndexOf(kDeviceNames, device);
+            auto kindIndex = IndexOf(kOpKindNames, kind);
+            if (deviceIndex < kDeviceNames.size() && kindIndex < kOpKindNames.size()) {
+                Set(dtype, (Device)deviceIndex, (OpKind)kindIndex, cost);
+            }
+        }
+        return true;
+    }
+
+    /// @brief Save the measured costs to path, it is replaced atomically so other processes never see a partial file.
+    void Save(const std::filesystem::path& path) const
+    {
+        auto tmpPath = path;
+        tmpPath += std::format(".{}.tmp", getpid());
+        auto succeeded = false;
+        {
+            auto out = std::ofstream { tmpPath, std::ios::trunc };
+            for (const auto& [key, cost] : m_costs) {
+                const auto& [dtype, device, kind] = key;
+                out << std::format("{} {} {} {} {}\n", dtype, kDeviceNames[(size_t)device], kOpKindNames[(size_t)kind],
+                    cost.overheadMicroseconds, cost.nanosecondsPerUnit);
+            }
+            succeeded = bool(out.flush());
+        }
+        std::error_code ec {};
+        if (succeeded) {
+            std::filesystem::rename(tmpPath, path, ec);
+        }
+        if (!succeeded || ec) {
+            std::filesystem::remove(tmpPath, ec);
+            throw std::runtime_error { std::format("Can't save cost model to {}.", path.string()) };
+        }
+    }
+
+private:
+    static constexpr std::array<std::string_view, 2> kDeviceNames { "cpu", "gpu" };
+    static constexpr std::array<std::string_view, 5> kOpKindNames {
+        "elementwise",
+        "matmul",
+        "transpose",
+        "reduction",
+        "transfer",
+    };
+
+    // Rough numbers of a desktop machine: every GPU op pays a submit and wait, which small shapes can't amortize.
+    // Transfer to CPU is a download, transfer to GPU is an upload.
+    static constexpr OpCost kDefaultCosts[2][5] {
+        { { 0.1, 1.0 }, { 0.5, 1.0 }, { 0.1, 2.0 }, { 0.1, 0.5 }, { 40.0, 0.3 } },
+        { { 30.0, 0.02 }, { 40.0, 0.005 }, { 30.0, 0.05 }, { 40.0, 0.02 }, { 20.0, 0.2 } },
+    };
+
+    template <size_t N>
+    static size_t IndexOf(const std::array<std::string_view, N>& names, std::string_view name)
+    {
+        auto index = size_t {};
+        while (index < N && names[index] != name) {
+            ++index;
+        }
+        return index;
+    }
+
+    std::filesystem::path m_path {};
+    std::map<std::tuple<std::string, Device, OpKind>, OpCost> m_costs {};
+};
+
+}
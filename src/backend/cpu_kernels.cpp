@@ -0,0 +1,762 @@
+module;
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+export module cpp_matrix:cpu_kernels;
+import :cpu_profiler;
+import :matrix_type;
+
+namespace cpp_matrix::backend {
+
+/// @brief A non-owning row x column window of row-major elements, each row starts stride elements after the previous.
+///
+/// T is const for a read-only view. Rows(), Columns() and Block() are views of the same memory, so taking part of a
+/// matrix (e.g. some samples of a batch which has one sample per column, or one layer of packed weights) never copies.
+/// The memory must outlive the view.
+export template <typename T>
+class MatrixView {
+public:
+    using ElementType = std::remove_const_t<T>;
+
+    MatrixView() = default;
+
+    MatrixView(T* pData, size_t row, size_t column, size_t stride)
+        : m_pData { pData }
+        , m_row { row }
+        , m_column { column }
+        , m_stride { stride }
+    {
+        if (row > 1 && stride < column) {
+            throw std::runtime_error { "Stride is less than column." };
+        }
+    }
+
+    MatrixView(T* pData, size_t row, size_t column)
+        : MatrixView { pData, row, column, column }
+    {
+    }
+
+    operator MatrixView<const T>() const
+        requires(!std::is_const_v<T>)
+    {
+        return { m_pData, m_row, m_column, m_stride };
+    }
+
+    size_t Row() const
+    {
+        return m_row;
+    }
+
+    size_t Column() const
+    {
+        return m_column;
+    }
+
+    size_t Stride() const
+    {
+        return m_stride;
+    }
+
+    T* Data() const
+    {
+        return m_pData;
+    }
+
+    T* RowData(size_t row) const
+    {
+        return m_pData + row * m_stride;
+    }
+
+    T& operator[](size_t row, size_t column) const
+    {
+        return m_pData[row * m_stride + column];
+    }
+
+    /// @brief True if rows are back to back, so the elements are one range.
+    bool IsContiguous() const
+    {
+        return m_stride == m_column || m_row <= 1;
+    }
+
+    /// @brief Rows [begin, end).
+    MatrixView Rows(size_t begin, size_t end) const
+    {
+        return Block(begin, 0, end - begin, m_column);
+    }
+
+    /// @brief Columns [begin, end).
+    MatrixView Columns(size_t begin, size_t end) const
+    {
+        return Block(0, begin, m_row, end - begin);
+    }
+
+    /// @brief rowCount x columnCount elements from (row, column).
+    MatrixView Block(size_t row, size_t column, size_t rowCount, size_t columnCount) const
+    {
+        if (row + rowCount > m_row || column + columnCount > m_column) {
+            throw std::runtime_error { "Out of range" };
+        }
+        return { m_pData + row * m_stride + column, rowCount, columnCount, m_stride };
+    }
+
+private:
+    T* m_pData {};
+    size_t m_row {};
+    size_t m_column {};
+    size_t m_stride {};
+};
+
+/// @brief The left operand of MatMul packed once for repeated products, e.g. weights multiplied by every new input.
+///
+/// Rows are grouped into panels of kPanelRows. A panel stores its columns one after another, converted to float (the
+/// accumulation type), so the GEMM kernel loads kPanelRows contiguous values per step of the dot products. The last
+/// panel is padded with zero rows.
+export template <MatrixElementType T>
+class PackedMatrix {
+public:
+    static constexpr size_t kPanelRows = 8;
+
+    PackedMatrix() = default;
+
+    explicit PackedMatrix(MatrixView<const T> a)
+        : m_row { a.Row() }
+        , m_column { a.Column() }
+        , m_panels(PanelCount() * kPanelRows * a.Column())
+    {
+        for (auto panel = 0u; panel < PanelCount(); ++panel) {
+            auto* pPanel = m_panels.data() + panel * kPanelRows * m_column;
+            for (auto r = 0u; r < kPanelRows && panel * kPanelRows + r < m_row; ++r) {
+                const auto* pRow = a.RowData(panel * kPanelRows + r);
+                for (auto k = 0u; k < m_column; ++k) {
+                    pPanel[k * kPanelRows + r] = static_cast<float>(pRow[k]);
+                }
+            }
+        }
+    }
+
+    size_t Row() const
+    {
+        return m_row;
+    }
+
+    size_t Column() const
+    {
+        return m_column;
+    }
+
+    size_t PanelCount() const
+    {
+        return (m_row + kPanelRows - 1) / kPanelRows;
+    }
+
+    /// @brief Column k of the panel is at [k * kPanelRows, (k + 1) * kPanelRows).
+    const float* Panel(size_t panel) const
+    {
+        return m_panels.data() + panel * kPanelRows * m_column;
+    }
+
+private:
+    size_t m_row {};
+    size_t m_column {};
+    std::vector<float> m_panels {};
+};
+
+/// @brief The left operand of CpuKernels::QuantizedMatMul() quantized to int8, e.g. weights of a trained network which
+/// only runs inference.
+///
+/// Each row has its own scale, max |a[r, k]| / kMaxLevel, so a row of small weights keeps its precision next to a row
+/// of large ones. Element k of row r is stored as round(a[r, k] / Scale(r)), a quarter of the bytes of f32.
+export class QuantizedMatrix {
+public:
+    // Symmetric levels, so 0 is exact and -128 is never used.
+    static constexpr int kMaxLevel = 127;
+
+    /// @brief The scale which maps [-maxAbs, maxAbs] to the levels.
+    static float ScaleOf(float maxAbs)
+    {
+        return maxAbs > 0 ? maxAbs / kMaxLevel : 1.f;
+    }
+
+    /// @brief The level of value, values beyond the range of scale saturate.
+    static int8_t Quantize(float value, float scale)
+    {
+        return static_cast<int8_t>(std::clamp(std::nearbyint(value / scale), (float)-kMaxLevel, (float)kMaxLevel));
+    }
+
+    QuantizedMatrix() = default;
+
+    // T may be const, so views of a matrix which is not const are taken as they are.
+    template <typename T>
+    explicit QuantizedMatrix(MatrixView<T> a)
+        : m_row { a.Row() }
+        , m_column { a.Column() }
+        , m_data(a.Row() * a.Column())
+        , m_scales(a.Row())
+    {
+        for (auto r = 0u; r < m_row; ++r) {
+            const auto* pRow = a.RowData(r);
+            auto maxAbs = 0.f;
+            for (auto k = 0u; k < m_column; ++k) {
+                maxAbs = std::max(maxAbs, std::abs(static_cast<float>(pRow[k])));
+            }
+            m_scales[r] = ScaleOf(maxAbs);
+            for (auto k = 0u; k < m_column; ++k) {
+                m_data[r * m_column + k] = Quantize(static_cast<float>(pRow[k]), m_scales[r]);
+            }
+        }
+    }
+
+    size_t Row() const
+    {
+        return m_row;
+    }
+
+    size_t Column() const
+    {
+        return m_column;
+    }
+
+    const int8_t* RowData(size_t r) const
+    {
+        return m_data.data() + r * m_column;
+    }
+
+    float Scale(size_t r) const
+    {
+        return m_scales[r];
+    }
+
+private:
+    size_t m_row {};
+    size_t m_column {};
+    std::vector<int8_t> m_data {};
+    std::vector<float> m_scales {};
+};
+
+/// @brief Finds the scale to quantize the right operand of CpuKernels::QuantizedMatMul() with, from samples of it, e.g.
+/// the inputs of a layer for a few hundred training samples.
+///
+/// The scale covers the largest magnitude observed. It is calibrated once rather than measured from every input, so
+/// inference does not scan its inputs first, and inputs beyond the calibrated range saturate.
+export class QuantizationCalibrator {
+public:
+    template <typename T>
+    void Observe(MatrixView<T> a)
+    {
+        for (auto r = 0u; r < a.Row(); ++r) {
+            const auto* pRow = a.RowData(r);
+            for (auto c = 0u; c < a.Column(); ++c) {
+                m_maxAbs = std::max(m_maxAbs, std::abs(static_cast<float>(pRow[c])));
+            }
+        }
+    }
+
+    float Scale() const
+    {
+        return QuantizedMatrix::ScaleOf(m_maxAbs);
+    }
+
+private:
+    float m_maxAbs {};
+};
+
+template <typename T>
+void WidenRows(MatrixView<const T> in, MatrixView<float> out)
+{
+    for (auto r = 0u; r < in.Row(); ++r) {
+        std::copy_n(in.RowData(r), in.Column(), out.RowData(r));
+    }
+}
+
+#if defined(__x86_64__)
+// Compiled for F16C whatever the build targets, so it converts 8 halves per instruction. Only call it if the CPU has
+// F16C.
+__attribute__((target("f16c"))) void WidenRowsF16C(MatrixView<const std::float16_t> in, MatrixView<float> out)
+{
+    for (auto r = 0u; r < in.Row(); ++r) {
+        const auto* pIn = in.RowData(r);
+        auto* pOut = out.RowData(r);
+        for (auto c = 0u; c < in.Column(); ++c) {
+            pOut[c] = static_cast<float>(pIn[c]);
+        }
+    }
+}
+#endif
+
+// Convert in to float into out, which has its shape. f16 uses F16C where the CPU has it, the build doesn't require it.
+template <MatrixElementType T>
+void Widen(MatrixView<const T> in, MatrixView<float> out)
+{
+#if defined(__x86_64__)
+    if constexpr (std::is_same_v<T, std::float16_t>) {
+        static const bool s_hasF16C = __builtin_cpu_supports("f16c");
+        if (s_hasF16C) {
+            WidenRowsF16C(in, out);
+            return;
+        }
+    }
+#endif
+    WidenRows(in, out);
+}
+
+/// @brief Kernels of CpuMatrix, they read and write views so they work on any part of a matrix in place.
+///
+/// out must have the shape of the result and must not overlap the inputs, except that element-wise kernels may write
+/// over an input with exactly the same view (e.g. to add in place).
+export template <MatrixElementType T>
+class CpuKernels {
+public:
+    using View = MatrixView<T>;
+    using ConstView = MatrixView<const T>;
+
+    static void Add(ConstView a, ConstView b, View out)
+    {
+        Zip("Add", a, b, out, [](T x, T y) { return x + y; });
+    }
+
+    static void Sub(ConstView a, ConstView b, View out)
+    {
+        Zip("Sub", a, b, out, [](T x, T y) { return x - y; });
+    }
+
+    static void ElementProduct(ConstView a, ConstView b, View out)
+    {
+        Zip("ElementProduct", a, b, out, [](T x, T y) { return x * y; });
+    }
+
+    static void AddScalar(ConstView a, T v, View out)
+    {
+        Map("AddScalar", 1, a, out, [v](T x) { return x + v; });
+    }
+
+    static void ScalarSub(T v, ConstView a, View out)
+    {
+        Map("ScalarSub", 1, a, out, [v](T x) { return v - x; });
+    }
+
+    static void ScalarMul(T v, ConstView a, View out)
+    {
+        Map("ScalarMul", 1, a, out, [v](T x) { return v * x; });
+    }
+
+    static void Sigmoid(ConstView a, View out)
+    {
+        Map("Sigmoid", 4, a, out, [](T x) { return (T)(1.f / (1.f + std::exp(static_cast<float>(-x)))); });
+    }
+
+    static void Relu(ConstView a, View out)
+    {
+        Map("Relu", 1, a, out, [](T x) { return std::max((T)0, x); });
+    }
+
+    /// @brief Convert to element type U, out has the shape of a. f16 and bf16 convert to each other through f32, which
+    /// holds both exactly.
+    template <MatrixElementType U>
+    static void Cast(ConstView a, MatrixView<U> out)
+    {
+        if (out.Row() != a.Row() || out.Column() != a.Column()) {
+            throw std::runtime_error { "Shape is not the same." };
+        }
+        auto scope = CpuProfileScope { ElementWiseLabel("Cast", 0, 1, a) };
+        for (auto r = 0u; r < a.Row(); ++r) {
+            std::transform(a.RowData(r), a.RowData(r) + a.Column(), out.RowData(r),
+                [](T x) { return static_cast<U>(static_cast<float>(x)); });
+        }
+    }
+
+    /// @brief out is a.Column() x a.Row().
+    static void Transpose(ConstView a, View out)
+    {
+        CheckShape(out, a.Column(), a.Row());
+        auto scope = CpuProfileScope { ElementWiseLabel("Transpose", 0, 1, a) };
+        for (auto c = 0u; c < a.Column(); ++c) {
+            auto* pOut = out.RowData(c);
+            for (auto r = 0u; r < a.Row(); ++r) {
+                pOut[r] = a[r, c];
+            }
+        }
+    }
+
+    /// @brief out is a.Row() x b.Column().
+    ///
+    /// a is packed first (see PackedMatrix) unless b has too few columns to pay for it, e.g. a matrix-vector product.
+    static void MatMul(ConstView a, ConstView b, View out)
+    {
+        if (a.Column() != b.Row()) {
+            throw std::runtime_error { "Can't dot two matrixs" };
+        }
+        CheckShape(out, a.Row(), b.Column());
+
+        if (b.Column() >= kPackMinColumns) {
+            MatMul(PackedMatrix<T> { a }, b, out);
+            return;
+        }
+
+        auto scope = CpuProfileScope { { "MatMul", { a.Row(), a.Column(), b.Column() }, DataType(),
+            2. * a.Row() * a.Column() * b.Column(), (double)ByteSize(a) + ByteSize(b) + ByteSize(out) } };
+        WithFloatOperand(b, [&](auto b) {
+            ParallelFor(a.Row(), a.Column() * b.Column(), [&](size_t begin, size_t end) {
+                for (auto y = begin; y < end; ++y) {
+                    for (auto x = 0u; x < b.Column(); ++x) {
+                        out[y, x] = static_cast<T>(Dot(a.RowData(y), b.Data() + x, b.Stride(), a.Column()));
+                    }
+                }
+            });
+        });
+    }
+
+    /// @brief MatMul() with a packed once, so repeated products skip packing. out is a.Row() x b.Column().
+    static void MatMul(const PackedMatrix<T>& a, ConstView b, View out)
+    {
+        if (a.Column() != b.Row()) {
+            throw std::runtime_error { "Can't dot two matrixs" };
+        }
+        CheckShape(out, a.Row(), b.Column());
+
+        auto scope = CpuProfileScope { { "MatMul", { a.Row(), a.Column(), b.Column() }, DataType(),
+            2. * a.Row() * a.Column() * b.Column(),
+            (double)sizeof(float) * a.Row() * a.Column() + ByteSize(b) + ByteSize(out) } };
+        ParallelFor(a.PanelCount(), a.Column() * b.Column() * kPanelRows, [&](size_t begin, size_t end) {
+            // Each block of b is widened once per range of panels, and stays in cache while they all read it.
+            float stackStrip[kStackStripRows * kBlockColumns];
+            auto heapStrip = std::vector<float>(b.Row() > kStackStripRows ? b.Row() * kBlockColumns : 0);
+            auto* pStrip = heapStrip.empty() ? stackStrip : heapStrip.data();
+            for (auto column = size_t {}; column < b.Column(); column += kBlockColumns) {
+                auto count = std::min(kBlockColumns, b.Column() - column);
+                auto block = FloatBlock(b, column, count, pStrip);
+                for (auto panel = begin; panel < end; ++panel) {
+                    MicroKernel(a, panel, block, column, out);
+                }
+            }
+        });
+    }
+
+    /// @brief a * b with a quantized, out is a.Row() x b.Column().
+    ///
+    /// b is quantized with bScale (see QuantizationCalibrator), the products of the levels are accumulated exactly in
+    /// int32, and each sum is dequantized by a.Scale(row) * bScale. With sigmoid, Sigmoid() of the result is written
+    /// instead, in the same pass.
+    static void QuantizedMatMul(const QuantizedMatrix& a, ConstView b, float bScale, View out, bool sigmoid = false)
+    {
+        if (a.Column() != b.Row()) {
+            throw std::runtime_error { "Can't dot two matrixs" };
+        }
+        CheckShape(out, a.Row(), b.Column());
+
+        auto scope = CpuProfileScope { { "QuantizedMatMul", { a.Row(), a.Column(), b.Column() }, "int8",
+            2. * a.Row() * a.Column() * b.Column(), (double)a.Row() * a.Column() + ByteSize(b) + ByteSize(out) } };
+
+        // Columns of b are quantized once into contiguous rows, so every dot product reads two int8 rows.
+        std::vector<int8_t> columns(b.Column() * b.Row());
+        for (auto k = 0u; k < b.Row(); ++k) {
+            const auto* pB = b.RowData(k);
+            for (auto c = 0u; c < b.Column(); ++c) {
+                columns[c * b.Row() + k] = QuantizedMatrix::Quantize(static_cast<float>(pB[c]), bScale);
+            }
+        }
+
+        ParallelFor(a.Row(), a.Column() * b.Column(), [&](size_t begin, size_t end) {
+            for (auto y = begin; y < end; ++y) {
+                auto scale = a.Scale(y) * bScale;
+                for (auto x = 0u; x < b.Column(); ++x) {
+                    auto value = scale * (float)QuantizedDot(a.RowData(y), columns.data() + x * b.Row(), a.Column());
+                    out[y, x] = static_cast<T>(sigmoid ? 1.f / (1.f + std::exp(-value)) : value);
+                }
+            }
+        });
+    }
+
+    /// @brief Sum of each row, out is a.Row() x 1.
+    static void RowSum(ConstView a, View out)
+    {
+        CheckShape(out, a.Row(), 1);
+        auto scope = CpuProfileScope { ReductionLabel("RowSum", a.Row(), a) };
+        ParallelFor(a.Row(), a.Column(), [&](size_t begin, size_t end) {
+            for (auto r = begin; r < end; ++r) {
+                out[r, 0] = static_cast<T>(SumOfRange(a.RowData(r), a.Column()));
+            }
+        });
+    }
+
+    /// @brief Sum of each column, out is 1 x a.Column().
+    static void ColumnSum(ConstView a, View out)
+    {
+        CheckShape(out, 1, a.Column());
+        auto scope = CpuProfileScope { ReductionLabel("ColumnSum", a.Column(), a) };
+        ParallelFor(a.Column(), a.Row(), [&](size_t begin, size_t end) {
+            // Walk rows in order and accumulate a block of columns, the inner loop is contiguous and vectorized.
+            std::vector<float> sums(end - begin);
+            for (auto r = 0u; r < a.Row(); ++r) {
+                const auto* p = a.RowData(r) + begin;
+                for (auto c = 0u; c < sums.size(); ++c) {
+                    sums[c] += static_cast<float>(p[c]);
+                }
+            }
+            std::copy(sums.begin(), sums.end(), out.RowData(0) + begin);
+        });
+    }
+
+    /// @brief Sum of all elements.
+    static T Sum(ConstView a)
+    {
+        auto scope = CpuProfileScope { ReductionLabel("Sum", 1, a) };
+        std::vector<float> rowSum(a.Row());
+        ParallelFor(a.Row(), a.Column(), [&](size_t begin, size_t end) {
+            for (auto r = begin; r < end; ++r) {
+                rowSum[r] = SumOfRange(a.RowData(r), a.Column());
+            }
+        });
+        return static_cast<T>(SumOfRange(rowSum.data(), rowSum.size()));
+    }
+
+    /// @brief Maximum of all elements.
+    static T Max(ConstView a)
+    {
+        if (!a.Row() || !a.Column()) {
+            throw std::runtime_error { "Matrix is empty." };
+        }
+
+        auto scope = CpuProfileScope { ReductionLabel("Max", 1, a) };
+        std::vector<T> rowMax(a.Row());
+        ParallelFor(a.Row(), a.Column(), [&](size_t begin, size_t end) {
+            for (auto r = begin; r < end; ++r) {
+                const auto* p = a.RowData(r);
+                rowMax[r] = *std::max_element(p, p + a.Column());
+            }
+        });
+        return *std::max_element(rowMax.begin(), rowMax.end());
+    }
+
+    /// @brief Row index of the maximum of each column, the first one wins if there are several.
+    static std::vector<size_t> ArgMax(ConstView a)
+    {
+        if (!a.Row()) {
+            throw std::runtime_error { "Matrix is empty." };
+        }
+
+        auto scope = CpuProfileScope { ReductionLabel("ArgMax", a.Column(), a) };
+        std::vector<size_t> res(a.Column());
+        ParallelFor(a.Column(), a.Row(), [&](size_t begin, size_t end) {
+            std::vector<T> maxValues { a.RowData(0) + begin, a.RowData(0) + end };
+            for (auto r = 1u; r < a.Row(); ++r) {
+                const auto* p = a.RowData(r) + begin;
+                for (auto c = 0u; c < maxValues.size(); ++c) {
+                    if (p[c] > maxValues[c]) {
+                        maxValues[c] = p[c];
+                        res[begin + c] = r;
+                    }
+                }
+            }
+        });
+        return res;
+    }
+
+    static constexpr const char* DataType()
+    {
+        return ElementTypeName<T>();
+    }
+
+    static size_t ByteSize(ConstView a)
+    {
+        return sizeof(T) * a.Row() * a.Column();
+    }
+
+private:
+    static constexpr size_t kPanelRows = PackedMatrix<T>::kPanelRows;
+
+    // Columns of b per micro-kernel call, with kPanelRows its accumulators fill the vector registers of AVX2.
+    static constexpr size_t kBlockColumns = 8;
+
+    // Below this many columns of b, packing a costs about as much as the product itself.
+    static constexpr size_t kPackMinColumns = 4;
+
+    // Rows of a widened block of b which fit on the stack (32 KiB), deeper products widen into the heap.
+    static constexpr size_t kStackStripRows = 1024;
+
+    // Columns [column, column + count) of b in float. f32 is viewed in place, f16 and bf16 are converted into pStrip
+    // (kBlockColumns floats per row of b) in contiguous loops which compile to vector conversions (vcvtph2ps if the CPU
+    // has F16C, see Widen(), a shift for bf16), so the micro-kernel never converts.
+    static MatrixView<const float> FloatBlock(ConstView b, size_t column, size_t count, float* pStrip)
+    {
+        if constexpr (std::is_same_v<T, std::float32_t>) {
+            return b.Columns(column, column + count);
+        } else {
+            auto strip = MatrixView<float> { pStrip, b.Row(), count, kBlockColumns };
+            Widen(b.Columns(column, column + count), strip);
+            return strip;
+        }
+    }
+
+    // Call f with a view of b in float (or T if it is f32), converted once rather than by every row of a which reads
+    // it. Only the unpacked product uses it, where b has fewer than kPackMinColumns columns.
+    template <typename F>
+    static void WithFloatOperand(ConstView b, F&& f)
+    {
+        if constexpr (!std::is_same_v<T, std::float32_t>) {
+            std::vector<float> widened(b.Row() * b.Column());
+            Widen(b, MatrixView<float> { widened.data(), b.Row(), b.Column() });
+            f(MatrixView<const float> { widened.data(), b.Row(), b.Column() });
+        } else {
+            f(b);
+        }
+    }
+
+    // out[panel rows, [column, column + block.Column())] = a[panel rows] * block, where block is at most kBlockColumns
+    // columns of b (see FloatBlock()). The inner loop runs over the rows of the panel, which are contiguous in it, and
+    // each element of the block is broadcast.
+    static void MicroKernel(
+        const PackedMatrix<T>& a, size_t panel, MatrixView<const float> block, size_t column, View out)
+    {
+        float sums[kBlockColumns][kPanelRows] {};
+        auto count = block.Column();
+        const auto* pPanel = a.Panel(panel);
+        for (auto k = 0u; k < a.Column(); ++k) {
+            const auto* pA = pPanel + k * kPanelRows;
+            const auto* pB = block.RowData(k);
+            for (auto c = 0u; c < count; ++c) {
+                auto value = pB[c];
+                for (auto r = 0u; r < kPanelRows; ++r) {
+                    sums[c][r] += pA[r] * value;
+                }
+            }
+        }
+
+        auto rowBegin = panel * kPanelRows;
+        for (auto r = 0u; r < kPanelRows && rowBegin + r < a.Row(); ++r) {
+            auto* pOut = out.RowData(rowBegin + r) + column;
+            for (auto c = 0u; c < count; ++c) {
+                pOut[c] = static_cast<T>(sums[c][r]);
+            }
+        }
+    }
+
+    // Dot product of count elements accumulated in float, b is strided. Independent accumulators, like SumOfRange().
+    template <typename U>
+    static float Dot(const T* a, const U* b, size_t bStride, size_t count)
+    {
+        constexpr size_t kLanes = 8;
+        float sums[kLanes] {};
+        auto i = size_t {};
+        for (; i + kLanes <= count; i += kLanes) {
+            for (auto lane = 0u; lane < kLanes; ++lane) {
+                sums[lane] += static_cast<float>(a[i + lane]) * static_cast<float>(b[(i + lane) * bStride]);
+            }
+        }
+        for (; i < count; ++i) {
+            sums[0] += static_cast<float>(a[i]) * static_cast<float>(b[i * bStride]);
+        }
+
+        auto sum = 0.f;
+        for (auto v : sums) {
+            sum += v;
+        }
+        return sum;
+    }
+
+    // Integer sums are exact in any order, so unlike Dot() the plain loop is vectorized, into 16-bit multiply-adds
+    // (pmaddwd) on x86, or the int8 dot product instructions where the target has them (e.g. sdot with Arm dotprod).
+    static int32_t QuantizedDot(const int8_t* a, const int8_t* b, size_t count)
+    {
+        auto sum = int32_t {};
+        for (auto i = size_t {}; i < count; ++i) {
+            sum += static_cast<int32_t>(a[i]) * static_cast<int32_t>(b[i]);
+        }
+        return sum;
+    }
+
+    static void CheckShape(ConstView a, size_t row, size_t column)
+    {
+        if (a.Row() != row || a.Column() != column) {
+            throw std::runtime_error { "Shape is not the same." };
+        }
+    }
+
+    // An op which reads operandCount matrices of this shape and writes one, see CpuProfiler.
+    static CpuOpLabel ElementWiseLabel(const char* op, double flopsPerElement, size_t operandCount, ConstView a)
+    {
+        return { op, { a.Row(), a.Column() }, DataType(), flopsPerElement * a.Row() * a.Column(),
+            (operandCount + 1.) * ByteSize(a) };
+    }
+
+    // A reduction which visits every element once and writes resultSize values.
+    static CpuOpLabel ReductionLabel(const char* op, size_t resultSize, ConstView a)
+    {
+        return { op, { a.Row(), a.Column() }, DataType(), (double)a.Row() * a.Column(),
+            (double)ByteSize(a) + resultSize * sizeof(T) };
+    }
+
+    // Rows are contiguous, so the inner loops are vectorized whatever the strides are.
+    template <typename F>
+    static void Map(const char* op, double flopsPerElement, ConstView a, View out, F&& f)
+    {
+        CheckShape(out, a.Row(), a.Column());
+        auto scope = CpuProfileScope { ElementWiseLabel(op, flopsPerElement, 1, a) };
+        for (auto r = 0u; r < a.Row(); ++r) {
+            std::transform(a.RowData(r), a.RowData(r) + a.Column(), out.RowData(r), f);
+        }
+    }
+
+    template <typename F>
+    static void Zip(const char* op, ConstView a, ConstView b, View out, F&& f)
+    {
+        CheckShape(b, a.Row(), a.Column());
+        CheckShape(out, a.Row(), a.Column());
+        auto scope = CpuProfileScope { ElementWiseLabel(op, 1, 2, a) };
+        for (auto r = 0u; r < a.Row(); ++r) {
+            std::transform(a.RowData(r), a.RowData(r) + a.Column(), b.RowData(r), out.RowData(r), f);
+        }
+    }
+
+    // Below this many element visits a reduction is not worth a thread.
+    static constexpr size_t kParallelWorkThreshold = 1 << 16;
+
+    // Call f(begin, end) on sub ranges of [0, count) in parallel, each item costs about workPerItem.
+    template <typename F>
+    static void ParallelFor(size_t count, size_t workPerItem, F&& f)
+    {
+        auto threadCount = std::min<size_t>({ std::thread::hardware_concurrency(),
+            count * workPerItem / kParallelWorkThreshold, count });
+        if (threadCount <= 1) {
+            f(size_t {}, count);
+            return;
+        }
+
+        std::vector<std::jthread> threads {};
+        auto chunkSize = (count + threadCount - 1) / threadCount;
+        for (auto begin = size_t {}; begin < count; begin += chunkSize) {
+            threads.emplace_back([&f, begin, end = std::min(begin + chunkSize, count)] { f(begin, end); });
+        }
+    }
+
+    // Independent accumulators break the dependency chain, so the loop is vectorized without -ffast-math. f16 and bf16
+    // are accumulated in float too, a 16-bit sum stops growing long before it reaches a few thousand.
+    template <typename U>
+    static float SumOfRange(const U* p, size_t count)
+    {
+        constexpr size_t kLanes = 8;
+        float sums[kLanes] {};
+        auto i = size_t {};
+        for (; i + kLanes <= count; i += kLanes) {
+            for (auto lane = 0u; lane < kLanes; ++lane) {
+                sums[lane] += static_cast<float>(p[i + lane]);
+            }
+        }
+        for (; i < count; ++i) {
+            sums[0] += static_cast<float>(p[i]);
+        }
+
+        auto sum = 0.f;
+        for (auto v : sums) {
+            sum += v;
+        }
+        return sum;
+    }
+};
+
+}
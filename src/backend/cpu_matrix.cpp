@@ -1,15 +1,178 @@
 module;
 
+#include <algorithm>
 #include <cmath>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <span>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 export module cpp_matrix:cpu_matrix;
+import :cpu_kernels;
+import :cpu_profiler;
+import :expression;
 import :matrix_type;
+import :memory_tracker;
+import trace;
 
 namespace cpp_matrix::backend {
 
+constexpr size_t kCacheLineSize = 64;
+
+// Allocates on cache line boundaries, so every padded row of a CpuMatrix starts on one.
+template <typename T>
+struct CacheLineAllocator {
+    using value_type = T;
+
+    CacheLineAllocator() = default;
+
+    template <typename U>
+    CacheLineAllocator(const CacheLineAllocator<U>&)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t { kCacheLineSize }));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        ::operator delete(p, std::align_val_t { kCacheLineSize });
+    }
+
+    bool operator==(const CacheLineAllocator&) const = default;
+};
+
+// Elements of a CpuMatrix, either owned or borrowed from memory which pKeeper keeps alive (e.g. a mapped MatrixFile).
+// Borrowed memory must be writable and private to the matrix, copies always own their elements.
+template <typename T>
+class CpuStorage {
+public:
+    CpuStorage() = default;
+
+    explicit CpuStorage(size_t size)
+        : CpuStorage { Owned(size) }
+    {
+    }
+
+    CpuStorage(std::span<const T> data)
+        : CpuStorage { Owned(data.begin(), data.end()) }
+    {
+    }
+
+    CpuStorage(std::span<T> data, std::shared_ptr<const void> pKeeper)
+        : m_pData { data.data() }
+        , m_size { data.size() }
+        , m_pKeeper { std::move(pKeeper) }
+    {
+    }
+
+    CpuStorage(const CpuStorage& other)
+        : CpuStorage { Owned(other.begin(), other.end()) }
+    {
+    }
+
+    CpuStorage(CpuStorage&& other) noexcept
+        : m_owned { std::move(other.m_owned) }
+        , m_pData { std::exchange(other.m_pData, nullptr) }
+        , m_size { std::exchange(other.m_size, 0) }
+        , m_pKeeper { std::move(other.m_pKeeper) }
+    {
+    }
+
+    CpuStorage& operator=(const CpuStorage& other)
+    {
+        if (this != &other) {
+            *this = CpuStorage { other };
+        }
+        return *this;
+    }
+
+    CpuStorage& operator=(CpuStorage&& other) noexcept
+    {
+        m_owned = std::move(other.m_owned);
+        m_pData = std::exchange(other.m_pData, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_pKeeper = std::move(other.m_pKeeper);
+        return *this;
+    }
+
+    bool IsBorrowed() const
+    {
+        return m_pKeeper != nullptr;
+    }
+
+    T* data()
+    {
+        return m_pData;
+    }
+
+    const T* data() const
+    {
+        return m_pData;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return !m_size;
+    }
+
+    T& operator[](size_t i)
+    {
+        return m_pData[i];
+    }
+
+    const T& operator[](size_t i) const
+    {
+        return m_pData[i];
+    }
+
+    T* begin()
+    {
+        return m_pData;
+    }
+
+    T* end()
+    {
+        return m_pData + m_size;
+    }
+
+    const T* begin() const
+    {
+        return m_pData;
+    }
+
+    const T* end() const
+    {
+        return m_pData + m_size;
+    }
+
+private:
+    using Owned = std::vector<T, CacheLineAllocator<T>>;
+
+    CpuStorage(Owned data)
+        : m_owned { std::move(data) }
+        , m_pData { m_owned.data() }
+        , m_size { m_owned.size() }
+    {
+    }
+
+    Owned m_owned {};
+    T* m_pData {};
+    size_t m_size {};
+    std::shared_ptr<const void> m_pKeeper {};
+};
+
 export template <MatrixElementType T>
 class CpuMatrix {
     template <MatrixElementType R>
@@ -21,13 +184,83 @@ class CpuMatrix {
 public:
     using ElementType = T;
 
+    /// @brief A matrix which uses data in place instead of copying it, pKeeper keeps data alive.
+    ///
+    /// data must be writable and private to this matrix (e.g. MatrixFile::MapPrivate()), ops which update the matrix in
+    /// place write it. Borrowed memory is not accounted by MemoryTracker, copies of the matrix are.
+    static CpuMatrix Borrow(size_t row, size_t column, std::span<T> data, std::shared_ptr<const void> pKeeper)
+    {
+        if (row * column != data.size()) {
+            throw std::runtime_error { "Elements size is not the same." };
+        }
+
+        auto matrix = CpuMatrix {};
+        matrix.m_row = row;
+        matrix.m_column = column;
+        matrix.m_stride = column;
+        matrix.m_data = CpuStorage<T> { data, std::move(pKeeper) };
+        return matrix;
+    }
+
     CpuMatrix() = default;
 
     CpuMatrix(size_t row, size_t column)
         : m_row { row }
         , m_column { column }
-        , m_data(row * column)
+        , m_stride { PaddedStride(row, column) }
+        , m_lease { MemoryKind::Host, sizeof(T) * row * m_stride, { row, column } }
+        , m_data(row * m_stride)
+    {
+        if (!m_data.empty()) {
+            trace::TraceInstant("cpu", "Allocate",
+                { .shape = { row, column },
+                    .dtype = Kernels::DataType(),
+                    .backend = "Cpu",
+                    .bytes = m_data.size() * sizeof(T) });
+        }
+    }
+
+    /// @brief A matrix which copies the elements of view.
+    explicit CpuMatrix(MatrixView<const T> view)
+        : CpuMatrix { view.Row(), view.Column() }
     {
+        for (auto r = 0u; r < m_row; ++r) {
+            std::copy_n(view.RowData(r), m_column, View().RowData(r));
+        }
+    }
+
+    // A copy owns its elements even if other borrows them, so it is always accounted.
+    CpuMatrix(const CpuMatrix& other)
+        : m_row { other.m_row }
+        , m_column { other.m_column }
+        , m_stride { other.m_stride }
+        , m_lease { MemoryKind::Host, sizeof(T) * other.m_data.size(), { other.m_row, other.m_column } }
+        , m_data { other.m_data }
+    {
+        // The copy has the same elements, so it shares the packed panels until either of them changes.
+        if (other.m_pPack) {
+            m_pPack = std::make_unique<PackState>();
+            auto lock = std::lock_guard { other.m_pPack->mutex };
+            m_pPack->pPacked = other.m_pPack->pPacked;
+        }
+    }
+
+    CpuMatrix(CpuMatrix&&) = default;
+
+    CpuMatrix& operator=(const CpuMatrix& other)
+    {
+        if (this != &other) {
+            *this = CpuMatrix { other };
+        }
+        return *this;
+    }
+
+    CpuMatrix& operator=(CpuMatrix&&) = default;
+
+    /// @brief True if the elements are borrowed, see Borrow().
+    bool IsBorrowed() const
+    {
+        return m_data.IsBorrowed();
     }
 
     size_t Row() const
@@ -40,11 +273,41 @@ public:
         return m_column;
     }
 
+    /// @brief Elements from the start of a row to the start of the next one, see PaddedStride().
+    size_t Stride() const
+    {
+        return m_stride;
+    }
+
+    /// @brief Hint that the matrix is the left operand of many products, e.g. weights. It is packed once (see
+    /// PackedMatrix) by the first product, later products skip packing until the matrix changes, then the next product
+    /// packs it again.
+    void Pack()
+    {
+        if (!m_pPack) {
+            m_pPack = std::make_unique<PackState>();
+        }
+    }
+
+    /// @brief Drop the hint set by Pack(), e.g. when the matrix is about to change after every product.
+    void Unpack()
+    {
+        m_pPack.reset();
+    }
+
+    bool IsPacked() const
+    {
+        return m_pPack != nullptr;
+    }
+
     CpuMatrix& operator=(std::vector<T> data)
     {
+        DropPanels();
         m_row = 1;
         m_column = data.size();
-        m_data = std::move(data);
+        m_stride = data.size();
+        m_lease = MemoryLease { MemoryKind::Host, sizeof(T) * data.size(), { m_row, m_column } };
+        m_data = CpuStorage<T> { std::span<const T> { data } };
         return *this;
     }
 
@@ -54,80 +317,101 @@ public:
             throw std::runtime_error { "Elements size is not the same." };
         }
 
-        m_data = std::vector<T> { std::begin(data), std::end(data) };
+        auto view = View();
+        for (auto r = 0u; r < m_row; ++r) {
+            std::copy_n(data.data() + r * m_column, m_column, view.RowData(r));
+        }
+    }
+
+    std::future<void> WriteAsync(std::span<T> data)
+    {
+        Write(data);
+        auto promise = std::promise<void> {};
+        promise.set_value();
+        return promise.get_future();
     }
 
     std::vector<T> Read() const
     {
-        return m_data;
+        return ReadRowsAsync(0, m_row).get();
     }
 
-    CpuMatrix operator+(const CpuMatrix& other) const
+    // Reads are done before their future is returned.
+    static bool IsReadbackThreadSafe()
     {
-        if (m_row != other.m_row || m_column != other.m_column) {
-            throw std::runtime_error { "Shape is not the same." };
+        return true;
+    }
+
+    std::future<std::vector<T>> ReadAsync() const
+    {
+        auto promise = std::promise<std::vector<T>> {};
+        promise.set_value(Read());
+        return promise.get_future();
+    }
+
+    /// @brief Rows [rowBegin, rowEnd) in row-major layout.
+    std::future<std::vector<T>> ReadRowsAsync(size_t rowBegin, size_t rowEnd) const
+    {
+        if (rowBegin > rowEnd || rowEnd > m_row) {
+            throw std::runtime_error { "Out of range" };
         }
 
-        CpuMatrix res { m_row, m_column };
-        auto* pR = res.m_data.data();
-        auto* p1 = m_data.data();
-        auto* p2 = other.m_data.data();
-        for (auto i = 0u; i < m_row * m_column; ++i) {
-            *pR++ = *p1++ + *p2++;
+        auto rows = std::vector<T>((rowEnd - rowBegin) * m_column);
+        for (auto r = rowBegin; r < rowEnd; ++r) {
+            std::copy_n(View().RowData(r), m_column, rows.data() + (r - rowBegin) * m_column);
         }
+        auto promise = std::promise<std::vector<T>> {};
+        promise.set_value(std::move(rows));
+        return promise.get_future();
+    }
+
+    /// @brief The elements in place, e.g. to pass part of the matrix to CpuKernels. The packed panels are dropped, as
+    /// the elements may be written through the view.
+    MatrixView<T> View()
+    {
+        DropPanels();
+        return { m_data.data(), m_row, m_column, m_stride };
+    }
+
+    MatrixView<const T> View() const
+    {
+        return { m_data.data(), m_row, m_column, m_stride };
+    }
+
+    CpuMatrix operator+(const CpuMatrix& other) const
+    {
+        CpuMatrix res { m_row, m_column };
+        Kernels::Add(View(), other.View(), res.View());
         return res;
     }
 
     CpuMatrix& operator+=(const CpuMatrix& other)
     {
-        if (m_row != other.m_row || m_column != other.m_column) {
-            throw std::runtime_error { "Shape is not the same." };
-        }
-
-        auto* p1 = m_data.data();
-        auto* p2 = other.m_data.data();
-        for (auto i = 0u; i < m_row * m_column; ++i) {
-            *p1++ += *p2++;
-        }
+        Kernels::Add(View(), other.View(), View());
         return *this;
     }
 
     CpuMatrix operator+(T v) const
     {
         CpuMatrix res { m_row, m_column };
-        for (auto i = 0u; i < m_row * m_column; ++i) {
-            res.m_data[i] = m_data[i] + v;
-        }
+        Kernels::AddScalar(View(), v, res.View());
         return res;
     }
 
     CpuMatrix operator-(const CpuMatrix& other) const
     {
-        if (m_row != other.m_row || m_column != other.m_column) {
-            throw std::runtime_error { "Shape is not the same." };
-        }
-
         CpuMatrix res { m_row, m_column };
-        auto* pR = res.m_data.data();
-        auto* p1 = m_data.data();
-        auto* p2 = other.m_data.data();
-        for (auto i = 0u; i < m_row * m_column; ++i) {
-            *pR++ = *p1++ - *p2++;
-        }
+        Kernels::Sub(View(), other.View(), res.View());
         return res;
     }
 
     CpuMatrix operator*(const CpuMatrix& other) const
     {
         CpuMatrix res { m_row, other.m_column };
-        for (auto y = 0; y < m_row; ++y) {
-            for (auto x = 0; x < other.m_column; ++x) {
-                T sum = {};
-                for (auto i = 0; i < m_column; ++i) {
-                    sum += m_data[y * m_column + i] * other.m_data[i * other.m_column + x];
-                }
-                res.m_data[y * other.m_column + x] = sum;
-            }
+        if (m_pPack) {
+            Kernels::MatMul(*Packed(), other.View(), res.View());
+        } else {
+            Kernels::MatMul(View(), other.View(), res.View());
         }
         return res;
     }
@@ -135,57 +419,116 @@ public:
     CpuMatrix Sigmoid() const
     {
         CpuMatrix res { m_row, m_column };
-        for (auto i = 0u; i < m_row * m_column; ++i) {
-            res.m_data[i] = 1.f / (1.f + std::exp(static_cast<float>(-m_data[i])));
-        }
+        Kernels::Sigmoid(View(), res.View());
         return res;
     }
 
     CpuMatrix Transpose() const
     {
         CpuMatrix res { m_column, m_row };
-        for (int c = 0u; c < m_column; ++c) {
-            for (int r = 0u; r < m_row; ++r) {
-                res.m_data[c * m_row + r] = m_data[r * m_column + c];
-            }
-        }
+        Kernels::Transpose(View(), res.View());
         return res;
     }
 
-    CpuMatrix ElementProduct(const CpuMatrix& other) const
+    /// @brief A copy converted to element type U.
+    template <MatrixElementType U>
+    CpuMatrix<U> Cast() const
     {
-        if (m_row != other.m_row || m_column != other.m_column) {
-            throw std::runtime_error { "Shape is not the same." };
-        }
+        CpuMatrix<U> res { m_row, m_column };
+        Kernels::Cast(View(), res.View());
+        return res;
+    }
 
+    CpuMatrix ElementProduct(const CpuMatrix& other) const
+    {
         CpuMatrix res { m_row, m_column };
-        auto* pR = res.m_data.data();
-        auto* p1 = m_data.data();
-        auto* p2 = other.m_data.data();
-        for (auto i = 0u; i < m_row * m_column; ++i) {
-            *pR++ = *p1++ * *p2++;
-        }
+        Kernels::ElementProduct(View(), other.View(), res.View());
         return res;
     }
 
     CpuMatrix Relu() const
     {
         CpuMatrix res { m_row, m_column };
-        const auto* p = m_data.data();
-        auto* pR = res.m_data.data();
-        for (auto i = 0; i < m_row * m_column; ++i) {
-            *pR++ = std::max((T)0, *p++);
-        }
+        Kernels::Relu(View(), res.View());
+        return res;
+    }
+
+    /// @brief Sum of each row, the result is a row x 1 matrix.
+    CpuMatrix RowSum() const
+    {
+        CpuMatrix res { m_row, 1 };
+        Kernels::RowSum(View(), res.View());
+        return res;
+    }
+
+    /// @brief Sum of each column, the result is a 1 x column matrix.
+    CpuMatrix ColumnSum() const
+    {
+        CpuMatrix res { 1, m_column };
+        Kernels::ColumnSum(View(), res.View());
+        return res;
+    }
+
+    /// @brief Sum of all elements, the result is a 1 x 1 matrix.
+    CpuMatrix Sum() const
+    {
+        CpuMatrix res { 1, 1 };
+        res.m_data[0] = Kernels::Sum(View());
+        return res;
+    }
+
+    /// @brief Maximum of all elements, the result is a 1 x 1 matrix.
+    CpuMatrix Max() const
+    {
+        auto max = Kernels::Max(View());
+        CpuMatrix res { 1, 1 };
+        res.m_data[0] = max;
         return res;
     }
 
+    /// @brief Row index of the maximum of each column, the first one wins if there are several.
+    std::vector<size_t> ArgMax() const
+    {
+        return Kernels::ArgMax(View());
+    }
+
+    std::future<std::vector<size_t>> ArgMaxAsync() const
+    {
+        auto promise = std::promise<std::vector<size_t>> {};
+        promise.set_value(ArgMax());
+        return promise.get_future();
+    }
+
+    /// @brief Evaluate an element-wise expression chunk by chunk, so there is no intermediate matrix.
+    static CpuMatrix Evaluate(const ExpressionNode<CpuMatrix>& root)
+    {
+        auto inputs = ExpressionInputs(root);
+        CpuMatrix res { inputs[0]->m_row, inputs[0]->m_column };
+        Evaluate(root, res.View());
+        return res;
+    }
+
+    /// @brief Evaluate an element-wise expression into out, which has the shape of the inputs and must not overlap
+    /// them.
+    static void Evaluate(const ExpressionNode<CpuMatrix>& root, MatrixView<T> out)
+    {
+        Evaluate(root, out, false);
+    }
+
+    /// @brief Evaluate an element-wise expression into out, which may be one of its inputs.
+    static void Evaluate(const ExpressionNode<CpuMatrix>& root, CpuMatrix& out)
+    {
+        auto inputs = ExpressionInputs(root);
+        Evaluate(root, out.View(), std::ranges::find(inputs, &out) != inputs.end());
+    }
+
     T operator[](size_t row, size_t column) const
     {
         if (row >= m_row || column >= m_column) {
             throw std::runtime_error { "Out of range" };
         }
 
-        return m_data[row * m_column + column];
+        return m_data[row * m_stride + column];
     }
 
     size_t BufferSize() const
@@ -194,20 +537,143 @@ public:
     }
 
 private:
+    using Kernels = CpuKernels<T>;
+
+    // Set by Pack(), pPacked is built by the first product which needs it. Products may run on several threads.
+    struct PackState {
+        std::mutex mutex {};
+        std::shared_ptr<const PackedMatrix<T>> pPacked {};
+    };
+
+    std::shared_ptr<const PackedMatrix<T>> Packed() const
+    {
+        auto lock = std::lock_guard { m_pPack->mutex };
+        if (!m_pPack->pPacked) {
+            m_pPack->pPacked = std::make_shared<const PackedMatrix<T>>(View());
+        }
+        return m_pPack->pPacked;
+    }
+
+    // The elements change, keep the hint but drop the panels.
+    void DropPanels()
+    {
+        if (m_pPack) {
+            auto lock = std::lock_guard { m_pPack->mutex };
+            m_pPack->pPacked.reset();
+        }
+    }
+
+    // Rows are padded to a multiple of a cache line, so every row starts aligned for SIMD loads. A stride which is a
+    // multiple of kConflictStride bytes would map the same column of consecutive rows to a few cache sets, which
+    // column walks of MatMul and Transpose keep evicting, so such a stride is skewed by one more line. Rows shorter
+    // than a cache line (e.g. vectors) and single rows are not padded, padding would cost more than it saves.
+    static size_t PaddedStride(size_t row, size_t column)
+    {
+        constexpr size_t kLineElements = kCacheLineSize / sizeof(T);
+        constexpr size_t kConflictStride = 512;
+        if (row <= 1 || column < kLineElements) {
+            return column;
+        }
+
+        auto stride = (column + kLineElements - 1) / kLineElements * kLineElements;
+        if (stride * sizeof(T) % kConflictStride == 0) {
+            stride += kLineElements;
+        }
+        return stride;
+    }
+
+    static size_t OpCount(const ExpressionNode<CpuMatrix>& node)
+    {
+        using Op = ExpressionNode<CpuMatrix>::Op;
+        if (node.op == Op::Input || node.op == Op::Scalar) {
+            return 0;
+        }
+        return 1 + (node.pLhs ? OpCount(*node.pLhs) : 0) + (node.pRhs ? OpCount(*node.pRhs) : 0);
+    }
+
+    // Small enough that the temporaries of a chunk stay in L1 cache.
+    static constexpr size_t kExpressionChunkSize = 256;
+
+    // An operand is evaluated into the output of its node, so if out is an input, a chunk is evaluated aside and
+    // copied once its inputs are read.
+    static void Evaluate(const ExpressionNode<CpuMatrix>& root, MatrixView<T> out, bool isInPlace)
+    {
+        auto inputs = ExpressionInputs(root);
+        if (out.Row() != inputs[0]->m_row || out.Column() != inputs[0]->m_column) {
+            throw std::runtime_error { "Shape is not the same." };
+        }
+
+        auto scope = CpuProfileScope { { "Fused", { out.Row(), out.Column() }, Kernels::DataType(),
+            (double)OpCount(root) * out.Row() * out.Column(), (inputs.size() + 1.) * Kernels::ByteSize(out) } };
+        T chunk[kExpressionChunkSize];
+        for (auto row = size_t {}; row < out.Row(); ++row) {
+            for (auto begin = size_t {}; begin < out.Column(); begin += kExpressionChunkSize) {
+                auto count = std::min(kExpressionChunkSize, out.Column() - begin);
+                auto* pOut = out.RowData(row) + begin;
+                EvaluateChunk(root, row, begin, count, isInPlace ? chunk : pOut);
+                if (isInPlace) {
+                    std::copy_n(chunk, count, pOut);
+                }
+            }
+        }
+    }
+
+    // Evaluate count elements of row from column begin.
+    static void EvaluateChunk(const ExpressionNode<CpuMatrix>& node, size_t row, size_t begin, size_t count, T* pOut)
+    {
+        using Op = ExpressionNode<CpuMatrix>::Op;
+        switch (node.op) {
+        case Op::Input:
+            std::copy_n(node.pInput->View().RowData(row) + begin, count, pOut);
+            break;
+        case Op::Scalar:
+            std::fill_n(pOut, count, (T)node.scalar);
+            break;
+        case Op::Add:
+        case Op::Sub:
+        case Op::Mul: {
+            T rhs[kExpressionChunkSize];
+            EvaluateChunk(*node.pLhs, row, begin, count, pOut);
+            EvaluateChunk(*node.pRhs, row, begin, count, rhs);
+            if (node.op == Op::Add) {
+                std::transform(pOut, pOut + count, rhs, pOut, [](T a, T b) { return a + b; });
+            } else if (node.op == Op::Sub) {
+                std::transform(pOut, pOut + count, rhs, pOut, [](T a, T b) { return a - b; });
+            } else {
+                std::transform(pOut, pOut + count, rhs, pOut, [](T a, T b) { return a * b; });
+            }
+            break;
+        }
+        case Op::Sigmoid:
+            EvaluateChunk(*node.pLhs, row, begin, count, pOut);
+            for (auto i = 0u; i < count; ++i) {
+                pOut[i] = 1.f / (1.f + std::exp(static_cast<float>(-pOut[i])));
+            }
+            break;
+        case Op::Relu:
+            EvaluateChunk(*node.pLhs, row, begin, count, pOut);
+            for (auto i = 0u; i < count; ++i) {
+                pOut[i] = std::max((T)0, pOut[i]);
+            }
+            break;
+        }
+    }
+
     size_t m_row {};
     size_t m_column {};
-    std::vector<T> m_data;
+    size_t m_stride {};
+
+    // Before m_data, so an allocation over the budget throws before it is made.
+    MemoryLease m_lease {};
+    CpuStorage<T> m_data;
+    std::unique_ptr<PackState> m_pPack {};
 };
 
 export template <MatrixElementType T>
 CpuMatrix<T> operator-(T v, const CpuMatrix<T>& m)
 {
     CpuMatrix<T> res { m.m_row, m.m_column };
-    auto* pR = res.m_data.data();
-    auto* p1 = m.m_data.data();
-    for (auto i = 0u; i < m.m_row * m.m_column; ++i) {
-        *pR++ = v - *p1++;
-    }
+    CpuKernels<T>::ScalarSub(v, m.View(), res.View());
     return res;
 }
 
@@ -215,12 +681,8 @@ export template <MatrixElementType T>
 CpuMatrix<T> operator*(T v, const CpuMatrix<T>& m)
 {
     CpuMatrix<T> res { m.m_row, m.m_column };
-    auto* pR = res.m_data.data();
-    auto* p1 = m.m_data.data();
-    for (auto i = 0u; i < m.m_row * m.m_column; ++i) {
-        *pR++ = v * *p1++;
-    }
+    CpuKernels<T>::ScalarMul(v, m.View(), res.View());
     return res;
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,367 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <linux/perf_event.h>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/syscall.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+export module cpp_matrix:cpu_profiler;
+
+namespace cpp_matrix::backend {
+
+/// @brief Describes a CpuMatrix op, op and dtype must be string literals. flops and bytes are the work of one call,
+/// bytes counts every operand read and the result written once.
+export struct CpuOpLabel {
+    const char* op {};
+    std::array<size_t, 3> shape {};
+    const char* dtype {};
+    double flops {};
+    double bytes {};
+};
+
+/// @brief Hardware counters the profiler reads, see CpuProfiler.
+export enum class CpuCounter {
+    Cycles,
+    Instructions,
+    L1dMisses,
+    LlcMisses,
+    DtlbMisses,
+};
+
+/// @brief Accumulated cost of all calls which have the same op, shape bucket and dtype.
+export struct CpuOpStats {
+    std::string op {};
+    std::string shape {};
+    std::string dtype {};
+    size_t callCount {};
+    double wallMicroseconds {};
+    double flops {};
+    double bytes {};
+
+    // Totals of every CpuCounter, empty if the counter can't be opened (e.g. in a VM or with perf_event_paranoid > 2).
+    std::array<std::optional<double>, 5> counters {};
+};
+
+/// @brief Single thread peaks of this machine, built with the same flags as the kernels.
+export struct MachinePeaks {
+    double gflops {};
+    double gbps {};
+};
+
+/// @brief Attributes hardware counters (through perf_event_open) and wall time to each CpuMatrix op and shape bucket,
+/// and compares achieved FLOP/s and bytes/s with the machine peaks (a roofline), so it tells which kernels are compute
+/// or memory bound.
+///
+/// It is disabled by default, set CPP_MATRIX_CPU_PROFILE=1 to enable it and dump the report to stderr at exit. Each
+/// dimension of a shape is rounded up to a power of two, so similar shapes share a row. Counters follow threads
+/// started by the op (e.g. by parallel reductions), wall time doesn't, so parallel ops can exceed the peaks.
+export class CpuProfiler {
+public:
+    static CpuProfiler& GetInstance()
+    {
+        static CpuProfiler s_profiler {};
+        return s_profiler;
+    }
+
+    CpuProfiler()
+    {
+        if (auto* env = std::getenv("CPP_MATRIX_CPU_PROFILE"); env && std::string_view { env } == "1") {
+            m_isEnabled = true;
+            m_dumpAtExit = true;
+        }
+    }
+
+    ~CpuProfiler()
+    {
+        if (m_dumpAtExit) {
+            Dump(stderr);
+        }
+    }
+
+    void Enable(bool enable = true)
+    {
+        m_isEnabled = enable;
+    }
+
+    bool IsEnabled() const
+    {
+        return m_isEnabled;
+    }
+
+    void SetDumpAtExit(bool dumpAtExit)
+    {
+        m_dumpAtExit = dumpAtExit;
+    }
+
+    /// @brief Counters of the calling thread (and the threads it started) and the wall clock, see Record().
+    struct Sample {
+        std::array<std::optional<double>, 5> counters {};
+        std::chrono::steady_clock::time_point time {};
+    };
+
+    static Sample ReadCounters()
+    {
+        thread_local auto t_counters = PerfCounters {};
+        auto sample = Sample {};
+        for (auto i = 0u; i < sample.counters.size(); ++i) {
+            sample.counters[i] = t_counters.Read(i);
+        }
+        sample.time = std::chrono::steady_clock::now();
+        return sample;
+    }
+
+    /// @brief Record one call, begin and end are ReadCounters() before and after it.
+    void Record(const CpuOpLabel& label, const Sample& begin, const Sample& end)
+    {
+        auto bucket = std::array<size_t, 3> {};
+        for (auto i = 0u; i < bucket.size(); ++i) {
+            bucket[i] = label.shape[i] ? std::bit_ceil(label.shape[i]) : 0;
+        }
+
+        auto lock = std::lock_guard { m_mutex };
+        auto& stats = m_stats[{ label.op, bucket, label.dtype }];
+        ++stats.callCount;
+        stats.wallMicroseconds += std::chrono::duration<double, std::micro> { end.time - begin.time }.count();
+        stats.flops += label.flops;
+        stats.bytes += label.bytes;
+        for (auto i = 0u; i < stats.counters.size(); ++i) {
+            if (begin.counters[i] && end.counters[i]) {
+                auto delta = std::max(*end.counters[i] - *begin.counters[i], 0.);
+                stats.counters[i] = stats.counters[i].value_or(0) + delta;
+            }
+        }
+    }
+
+    void Reset()
+    {
+        auto lock = std::lock_guard { m_mutex };
+        m_stats.clear();
+    }
+
+    /// @brief Override the measured peaks, e.g. with the numbers of the vendor.
+    void SetPeaks(MachinePeaks peaks)
+    {
+        m_peaks = peaks;
+    }
+
+    /// @brief The peaks, they are measured the first time (which takes about a second) unless SetPeaks() was called.
+    MachinePeaks GetPeaks()
+    {
+        if (!m_peaks) {
+            m_peaks = MeasurePeaks();
+        }
+        return *m_peaks;
+    }
+
+    /// @brief Get the report, sorted by total wall time descending.
+    std::vector<CpuOpStats> GetReport() const
+    {
+        auto lock = std::lock_guard { m_mutex };
+        std::vector<CpuOpStats> report {};
+        for (const auto& [key, stats] : m_stats) {
+            const auto& [op, shape, dtype] = key;
+            auto& row = report.emplace_back(stats);
+            row.op = op;
+            row.dtype = dtype;
+            for (auto dim : shape) {
+                if (dim) {
+                    row.shape += row.shape.empty() ? std::to_string(dim) : std::format("x{}", dim);
+                }
+            }
+        }
+        std::ranges::sort(report, [](const auto& a, const auto& b) { return a.wallMicroseconds > b.wallMicroseconds; });
+        return report;
+    }
+
+    void Dump(FILE* out)
+    {
+        auto report = GetReport();
+        if (report.empty()) {
+            return;
+        }
+
+        // Misses are per thousand instructions, "roof" is the achieved share of min(peak FLOP/s, intensity x peak
+        // bandwidth), "bound" is the side of the ridge point the op is on.
+        auto peaks = GetPeaks();
+        auto ridge = peaks.gflops / peaks.gbps;
+        fprintf(out, "peak %.2f GFLOP/s, %.2f GB/s, ridge %.2f flop/byte\n", peaks.gflops, peaks.gbps, ridge);
+        fprintf(out, "%-16s %-16s %-5s %8s %12s %12s %6s %9s %9s %9s %9s %9s %6s %6s %-7s\n", "op", "shape", "dtype",
+            "calls", "us/op", "cycles/op", "ipc", "l1d mpki", "llc mpki", "dtlb mpki", "GFLOP/s", "GB/s", "flop/B",
+            "roof", "bound");
+        for (const auto& row : report) {
+            auto perCall = [&](CpuCounter counter) {
+                const auto& total = row.counters[(size_t)counter];
+                return total ? std::format("{:.0f}", *total / row.callCount) : std::string { "n/a" };
+            };
+            auto ratio = [&](CpuCounter counter, CpuCounter base, double scale) {
+                const auto& total = row.counters[(size_t)counter];
+                const auto& baseTotal = row.counters[(size_t)base];
+                return total && baseTotal && *baseTotal ? std::format("{:.2f}", *total / *baseTotal * scale)
+                                                        : std::string { "n/a" };
+            };
+
+            auto seconds = row.wallMicroseconds / 1e6;
+            auto gflops = seconds ? row.flops / seconds / 1e9 : 0;
+            auto gbps = seconds ? row.bytes / seconds / 1e9 : 0;
+            auto intensity = row.bytes ? row.flops / row.bytes : 0;
+            auto roof = row.flops ? std::min(peaks.gflops, intensity * peaks.gbps) : peaks.gbps;
+            auto achieved = row.flops ? gflops : gbps;
+            fprintf(out, "%-16s %-16s %-5s %8zu %12.1f %12s %6s %9s %9s %9s %9.2f %9.2f %6.2f %5.0f%% %-7s\n",
+                row.op.c_str(), row.shape.c_str(), row.dtype.c_str(), row.callCount,
+                row.wallMicroseconds / row.callCount, perCall(CpuCounter::Cycles).c_str(),
+                ratio(CpuCounter::Instructions, CpuCounter::Cycles, 1).c_str(),
+                ratio(CpuCounter::L1dMisses, CpuCounter::Instructions, 1000).c_str(),
+                ratio(CpuCounter::LlcMisses, CpuCounter::Instructions, 1000).c_str(),
+                ratio(CpuCounter::DtlbMisses, CpuCounter::Instructions, 1000).c_str(), gflops, gbps, intensity,
+                roof ? achieved / roof * 100 : 0, intensity < ridge ? "memory" : "compute");
+        }
+    }
+
+private:
+    // One counter per CpuCounter for the thread which opens it, inherited by threads it starts later.
+    class PerfCounters {
+    public:
+        PerfCounters()
+        {
+            constexpr auto cacheMiss = [](uint64_t cache) {
+                return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            };
+            m_fds = {
+                Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES),
+                Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS),
+                Open(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1D)),
+                Open(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_LL)),
+                Open(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_DTLB)),
+            };
+        }
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        ~PerfCounters()
+        {
+            for (auto fd : m_fds) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        }
+
+        // Scaled by enabled / running time, since the kernel multiplexes counters when there are more than the
+        // hardware has.
+        std::optional<double> Read(size_t index) const
+        {
+            struct {
+                uint64_t value;
+                uint64_t enabled;
+                uint64_t running;
+            } result {};
+            if (m_fds[index] < 0 || read(m_fds[index], &result, sizeof(result)) != sizeof(result) || !result.running) {
+                return std::nullopt;
+            }
+            return (double)result.value * result.enabled / result.running;
+        }
+
+    private:
+        static int Open(uint32_t type, uint64_t config)
+        {
+            auto attr = perf_event_attr {};
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+
+        std::array<int, 5> m_fds {};
+    };
+
+    // A dependency free multiply-add loop the compiler vectorizes, and a sum over a buffer much larger than the LLC.
+    static MachinePeaks MeasurePeaks()
+    {
+        using Clock = std::chrono::steady_clock;
+        auto peaks = MachinePeaks {};
+
+        constexpr size_t kLanes = 64;
+        constexpr size_t kIterations = 1 << 22;
+        float accumulators[kLanes] {};
+        auto start = Clock::now();
+        for (auto i = 0u; i < kIterations; ++i) {
+            for (auto lane = 0u; lane < kLanes; ++lane) {
+                accumulators[lane] = accumulators[lane] * 0.999f + 0.001f;
+            }
+        }
+        auto seconds = std::chrono::duration<double> { Clock::now() - start }.count();
+        peaks.gflops = 2. * kLanes * kIterations / seconds / 1e9;
+
+        constexpr size_t kRepeats = 4;
+        auto buffer = std::vector<float>(64 * 1024 * 1024 / sizeof(float), 1.f);
+        float sums[kLanes] {};
+        start = Clock::now();
+        for (auto repeat = 0u; repeat < kRepeats; ++repeat) {
+            for (auto i = 0u; i + kLanes <= buffer.size(); i += kLanes) {
+                for (auto lane = 0u; lane < kLanes; ++lane) {
+                    sums[lane] += buffer[i + lane];
+                }
+            }
+        }
+        seconds = std::chrono::duration<double> { Clock::now() - start }.count();
+        peaks.gbps = (double)kRepeats * buffer.size() * sizeof(float) / seconds / 1e9;
+
+        // Use the results, so neither loop is optimized away.
+        volatile auto sink = accumulators[0] + sums[0];
+        (void)sink;
+        return peaks;
+    }
+
+    bool m_isEnabled {};
+    bool m_dumpAtExit {};
+    std::optional<MachinePeaks> m_peaks {};
+    mutable std::mutex m_mutex {};
+    std::map<std::tuple<std::string, std::array<size_t, 3>, std::string>, CpuOpStats> m_stats {};
+};
+
+/// @brief Records the op from its construction to its destruction if CpuProfiler is enabled.
+export class CpuProfileScope {
+public:
+    CpuProfileScope(const CpuOpLabel& label)
+    {
+        if (CpuProfiler::GetInstance().IsEnabled()) {
+            m_label = label;
+            m_begin = CpuProfiler::ReadCounters();
+        }
+    }
+
+    CpuProfileScope(const CpuProfileScope&) = delete;
+    CpuProfileScope& operator=(const CpuProfileScope&) = delete;
+
+    ~CpuProfileScope()
+    {
+        if (m_label.op) {
+            CpuProfiler::GetInstance().Record(m_label, *m_begin, CpuProfiler::ReadCounters());
+        }
+    }
+
+private:
+    CpuOpLabel m_label {};
+    std::optional<CpuProfiler::Sample> m_begin {};
+};
+
+}
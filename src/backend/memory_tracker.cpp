@@ -0,0 +1,327 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+export module cpp_matrix:memory_tracker;
+
+namespace cpp_matrix::backend {
+
+export enum class MemoryKind {
+    // Element storage of CpuMatrix.
+    Host,
+    // Buffers of WebGpuMatrix, including the intermediate buffers of its ops, and the staging, uniform and timestamp
+    // buffers of the webgpu module.
+    Gpu,
+};
+
+/// @brief A live allocation, tag is the innermost MemoryTag of the thread which allocated it (or empty).
+export struct AllocationInfo {
+    MemoryKind kind {};
+    size_t bytes {};
+    std::array<size_t, 2> shape {};
+    std::string tag {};
+};
+
+export struct MemoryStats {
+    size_t liveBytes {};
+    size_t peakBytes {};
+    size_t liveAllocationCount {};
+    size_t allocationCount {};
+};
+
+export class MemoryTag;
+
+/// @brief Accounts every matrix allocation of both backends, and enforces an optional budget per kind.
+///
+/// An allocation which would take live bytes over the budget throws before anything is allocated, so running out of
+/// memory fails fast at the allocation which caused it. The budgets are read from CPP_MATRIX_HOST_MEMORY_BUDGET and
+/// CPP_MATRIX_GPU_MEMORY_BUDGET at startup, in bytes with an optional K, M or G suffix, e.g. "512M".
+export class MemoryTracker {
+public:
+    static MemoryTracker& GetInstance()
+    {
+        static MemoryTracker s_memoryTracker {};
+        return s_memoryTracker;
+    }
+
+    MemoryTracker()
+    {
+        m_budgets[(size_t)MemoryKind::Host] = ParseBytes(std::getenv("CPP_MATRIX_HOST_MEMORY_BUDGET"));
+        m_budgets[(size_t)MemoryKind::Gpu] = ParseBytes(std::getenv("CPP_MATRIX_GPU_MEMORY_BUDGET"));
+    }
+
+    /// @brief Limit live bytes of kind, 0 means unlimited.
+    void SetBudget(MemoryKind kind, size_t bytes)
+    {
+        auto lock = std::lock_guard { m_mutex };
+        m_budgets[(size_t)kind] = bytes;
+    }
+
+    size_t GetBudget(MemoryKind kind) const
+    {
+        auto lock = std::lock_guard { m_mutex };
+        return m_budgets[(size_t)kind];
+    }
+
+    MemoryStats GetStats(MemoryKind kind) const
+    {
+        auto lock = std::lock_guard { m_mutex };
+        return m_stats[(size_t)kind];
+    }
+
+    /// @brief Allocations of both kinds per second since startup or the last ResetPeaks().
+    double GetAllocationsPerSecond() const
+    {
+        auto lock = std::lock_guard { m_mutex };
+        auto seconds = std::chrono::duration<double> { std::chrono::steady_clock::now() - m_start }.count();
+        auto count = m_stats[0].allocationCount + m_stats[1].allocationCount;
+        return seconds ? count / seconds : 0;
+    }
+
+    /// @brief The count largest live allocations, largest first.
+    std::vector<AllocationInfo> GetLargestAllocations(size_t count) const
+    {
+        auto lock = std::lock_guard { m_mutex };
+        auto allocations = std::vector<AllocationInfo> {};
+        for (const auto& [id, allocation] : m_allocations) {
+            allocations.push_back(allocation);
+        }
+        count = std::min(count, allocations.size());
+        std::ranges::partial_sort(allocations, allocations.begin() + count,
+            [](const auto& a, const auto& b) { return a.bytes > b.bytes; });
+        allocations.resize(count);
+        return allocations;
+    }
+
+    /// @brief Peaks become the live bytes, and allocation counting restarts.
+    void ResetPeaks()
+    {
+        auto lock = std::lock_guard { m_mutex };
+        for (auto& stats : m_stats) {
+            stats.peakBytes = stats.liveBytes;
+            stats.allocationCount = 0;
+        }
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    void Dump(FILE* out, size_t largestCount = 10) const
+    {
+        for (auto kind : { MemoryKind::Host, MemoryKind::Gpu }) {
+            auto stats = GetStats(kind);
+            auto budget = GetBudget(kind);
+            fprintf(out, "%-4s live %s in %zu allocations, peak %s, budget %s\n", KindName(kind),
+                FormatBytes(stats.liveBytes).c_str(), stats.liveAllocationCount, FormatBytes(stats.peakBytes).c_str(),
+                budget ? FormatBytes(budget).c_str() : "none");
+        }
+        fprintf(out, "%.1f allocations/s\n", GetAllocationsPerSecond());
+
+        auto largest = GetLargestAllocations(largestCount);
+        if (largest.empty()) {
+            return;
+        }
+        fprintf(out, "largest live allocations:\n");
+        for (const auto& allocation : largest) {
+            fprintf(out, "  %-4s %12s %16s %s\n", KindName(allocation.kind), FormatBytes(allocation.bytes).c_str(),
+                std::format("{}x{}", allocation.shape[0], allocation.shape[1]).c_str(), allocation.tag.c_str());
+        }
+    }
+
+    /// @brief Account an allocation of a row x column matrix, throws if it would exceed the budget. Use MemoryLease
+    /// rather than calling it directly.
+    uint64_t Allocate(MemoryKind kind, size_t bytes, std::array<size_t, 2> shape)
+    {
+        auto lock = std::lock_guard { m_mutex };
+        auto& stats = m_stats[(size_t)kind];
+        auto budget = m_budgets[(size_t)kind];
+        if (budget && stats.liveBytes + bytes > budget) {
+            auto tag = t_tag ? std::format(" ({})", t_tag) : std::string {};
+            throw std::runtime_error { std::format(
+                "{} memory budget exceeded: allocating {} for a {}x{} matrix{} with {} live, budget is {}.",
+                KindName(kind), FormatBytes(bytes), shape[0], shape[1], tag, FormatBytes(stats.liveBytes),
+                FormatBytes(budget)) };
+        }
+
+        stats.liveBytes += bytes;
+        stats.peakBytes = std::max(stats.peakBytes, stats.liveBytes);
+        ++stats.liveAllocationCount;
+        ++stats.allocationCount;
+        auto id = ++m_lastId;
+        m_allocations[id] = { kind, bytes, shape, t_tag ? t_tag : "" };
+        return id;
+    }
+
+    void Release(uint64_t id)
+    {
+        auto lock = std::lock_guard { m_mutex };
+        if (auto it = m_allocations.find(id); it != m_allocations.end()) {
+            auto& stats = m_stats[(size_t)it->second.kind];
+            stats.liveBytes -= it->second.bytes;
+            --stats.liveAllocationCount;
+            m_allocations.erase(it);
+        }
+    }
+
+private:
+    friend class MemoryTag;
+
+    static const char* KindName(MemoryKind kind)
+    {
+        return kind == MemoryKind::Host ? "Host" : "Gpu";
+    }
+
+    static std::string FormatBytes(size_t bytes)
+    {
+        if (bytes >= 1 << 30) {
+            return std::format("{:.1f} GiB", bytes / double(1 << 30));
+        }
+        if (bytes >= 1 << 20) {
+            return std::format("{:.1f} MiB", bytes / double(1 << 20));
+        }
+        if (bytes >= 1 << 10) {
+            return std::format("{:.1f} KiB", bytes / double(1 << 10));
+        }
+        return std::format("{} B", bytes);
+    }
+
+    static size_t ParseBytes(const char* text)
+    {
+        if (!text || !*text) {
+            return 0;
+        }
+
+        char* end {};
+        auto value = std::strtod(text, &end);
+        switch (*end) {
+        case 'G':
+        case 'g':
+            value *= 1024;
+            [[fallthrough]];
+        case 'M':
+        case 'm':
+            value *= 1024;
+            [[fallthrough]];
+        case 'K':
+        case 'k':
+            value *= 1024;
+            break;
+        }
+        return (size_t)value;
+    }
+
+    static inline thread_local const char* t_tag {};
+
+    mutable std::mutex m_mutex {};
+    std::array<size_t, 2> m_budgets {};
+    std::array<MemoryStats, 2> m_stats {};
+    std::unordered_map<uint64_t, AllocationInfo> m_allocations {};
+    uint64_t m_lastId {};
+    std::chrono::steady_clock::time_point m_start { std::chrono::steady_clock::now() };
+};
+
+/// @brief Tags allocations of the calling thread until it goes out of scope, tag must be a string literal, e.g.
+///
+///     auto tag = MemoryTag { "forward" };
+export class MemoryTag {
+public:
+    MemoryTag(const char* tag)
+        : m_previousTag { MemoryTracker::t_tag }
+    {
+        MemoryTracker::t_tag = tag;
+    }
+
+    MemoryTag(const MemoryTag&) = delete;
+    MemoryTag& operator=(const MemoryTag&) = delete;
+
+    ~MemoryTag()
+    {
+        MemoryTracker::t_tag = m_previousTag;
+    }
+
+private:
+    const char* m_previousTag {};
+};
+
+/// @brief Holds the accounting of one allocation, the owner of the memory keeps it as long as the memory lives.
+///
+/// Copying a lease accounts a new allocation of the same size, since copying the owner copies the memory.
+export class MemoryLease {
+public:
+    MemoryLease() = default;
+
+    MemoryLease(MemoryKind kind, size_t bytes, std::array<size_t, 2> shape)
+        : m_kind { kind }
+        , m_bytes { bytes }
+        , m_shape { shape }
+    {
+        if (m_bytes) {
+            m_id = MemoryTracker::GetInstance().Allocate(m_kind, m_bytes, m_shape);
+        }
+    }
+
+    MemoryLease(const MemoryLease& other)
+        : MemoryLease { other.m_kind, other.m_bytes, other.m_shape }
+    {
+    }
+
+    MemoryLease(MemoryLease&& other) noexcept
+        : m_kind { other.m_kind }
+        , m_bytes { std::exchange(other.m_bytes, 0) }
+        , m_shape { other.m_shape }
+        , m_id { std::exchange(other.m_id, 0) }
+    {
+    }
+
+    MemoryLease& operator=(const MemoryLease& other)
+    {
+        if (this != &other) {
+            *this = MemoryLease { other };
+        }
+        return *this;
+    }
+
+    MemoryLease& operator=(MemoryLease&& other) noexcept
+    {
+        if (this != &other) {
+            Release();
+            m_kind = other.m_kind;
+            m_bytes = std::exchange(other.m_bytes, 0);
+            m_shape = other.m_shape;
+            m_id = std::exchange(other.m_id, 0);
+        }
+        return *this;
+    }
+
+    ~MemoryLease()
+    {
+        Release();
+    }
+
+private:
+    void Release()
+    {
+        if (m_id) {
+            MemoryTracker::GetInstance().Release(m_id);
+            m_id = 0;
+        }
+    }
+
+    MemoryKind m_kind {};
+    size_t m_bytes {};
+    std::array<size_t, 2> m_shape {};
+    uint64_t m_id {};
+};
+
+}
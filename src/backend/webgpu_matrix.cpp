@@ -1,12 +1,20 @@
 module;
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <format>
-#include <functional>
 #include <future>
+#include <memory>
 #include <span>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <webgpu/webgpu.h>
 
@@ -15,19 +23,67 @@ import webgpu;
 using namespace webgpu;
 
 export module cpp_matrix:webgpu_matrix;
+import :expression;
 import :matrix_type;
+import :memory_tracker;
 import :std_patch;
 
 namespace cpp_matrix::backend {
 
+// Staging, uniform and timestamp buffers of the webgpu module count against the Gpu budget like matrix buffers. The
+// tracker is created here, before GpuInstance, so it is destroyed after the adapter released its buffers.
+const auto s_isBufferLeaseHookSet = [] {
+    MemoryTracker::GetInstance();
+    SetBufferLeaseHook([](size_t byteSize, const char* label) -> std::shared_ptr<const void> {
+        auto tag = MemoryTag { label };
+        return std::make_shared<const MemoryLease>(MemoryKind::Gpu, byteSize, std::array<size_t, 2> {});
+    });
+    return true;
+}();
+
+// A range of whole tile rows (4 rows) stored in one buffer. It doesn't depend on the element type, so kernels between
+// matrices of different types (e.g. Cast()) use the chunk helpers of either.
+struct WebGpuChunk {
+    gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> pBuffer {};
+    size_t tileRowBegin {};
+    size_t tileRowCount {};
+
+    // Copies of a matrix share its buffers, so they share the accounting too.
+    std::shared_ptr<const MemoryLease> pLease {};
+};
+
 export template <MatrixElementType T>
 class WebGpuMatrix {
     template <MatrixElementType R>
     friend WebGpuMatrix<R> ScalarOp(R v, const WebGpuMatrix<R>& m, char op);
 
+    // Cast() writes the chunks of a matrix of another element type.
+    template <MatrixElementType>
+    friend class WebGpuMatrix;
+
 public:
     using ElementType = T;
 
+    /// @brief Compile all kernels of this element type recorded in the pipeline cache directory, in parallel.
+    ///
+    /// Returns the number of compiled kernels, it is 0 if there is no pipeline cache directory.
+    static size_t WarmUp()
+    {
+        return GpuInstance::GetInstance().GetAdapter()->WarmUp([](std::string_view shaderScript) {
+            // Every kernel starts with the prelude of its element type.
+            return shaderScript.starts_with(WgslPrelude());
+        });
+    }
+
+    /// @brief Limit the byte size of each chunk of matrices created afterwards, 0 means the device limit.
+    ///
+    /// Matrices bigger than one storage buffer binding are split into chunks of whole tile rows, this lets tests
+    /// cover chunked matrices with small shapes.
+    static void SetMaxChunkByteSize(size_t byteSize)
+    {
+        s_maxChunkByteSize = byteSize;
+    }
+
     WebGpuMatrix() = default;
 
     WebGpuMatrix(size_t row, size_t column)
@@ -36,12 +92,7 @@ public:
     {
         m_paddingRow = (m_row + 3) & ~3;
         m_paddingColumn = (m_column + 3) & ~3;
-        auto adapter = GpuInstance::GetInstance().GetAdapter();
-        m_pBuffer = adapter->CreateBuffer<T>(m_paddingRow, m_paddingColumn);
-
-        // Zero out.
-        std::vector<T> tmp(m_paddingRow * m_paddingColumn);
-        wgpuQueueWriteBuffer(adapter->GetQueue(), m_pBuffer.get(), 0, tmp.data(), sizeof(T) * tmp.size());
+        AllocateChunks();
     }
 
     size_t Row() const
@@ -54,9 +105,14 @@ public:
         return m_column;
     }
 
-    WGPUBuffer GetBuffer() const
+    size_t ChunkCount() const
     {
-        return m_pBuffer.get();
+        return m_chunks.size();
+    }
+
+    WGPUBuffer GetBuffer(size_t chunkIndex = 0) const
+    {
+        return m_chunks[chunkIndex].pBuffer.get();
     }
 
     size_t BufferSize() const
@@ -70,28 +126,98 @@ public:
         m_column = data.size();
         m_paddingRow = 4;
         m_paddingColumn = (m_column + 3) & ~3;
-        auto adapter = GpuInstance::GetInstance().GetAdapter();
-        m_pBuffer = adapter->CreateBuffer<T>(m_paddingRow, m_paddingColumn);
+        AllocateChunks();
         Write(std::span<T> { data });
         return *this;
     }
 
     void Write(std::span<T> data)
     {
-        std::vector<T> tmp(m_paddingRow * m_paddingColumn);
-        for (auto row = 0; row < m_row; ++row) {
-            for (auto column = 0; column < m_column; ++column) {
-                auto i = IndexInMat4x4ArrayMemory(row, column);
-                tmp.data()[i] = data.data()[row * m_column + column];
+        WriteAsync(data);
+    }
+
+    /// @brief Upload data through a staging buffer, the returned future is ready once the GPU got the data.
+    ///
+    /// data can be released as soon as this function returns.
+    std::future<void> WriteAsync(std::span<T> data)
+    {
+        if (m_row * m_column != data.size()) {
+            throw std::runtime_error { "Elements size is not the same." };
+        }
+
+        if (!BufferSize()) {
+            return std::async(std::launch::deferred, [] { });
+        }
+
+        if (data.size() >= kGpuLayoutConversionThreshold) {
+            return WriteWithGpuLayoutConversion(data);
+        }
+
+        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        auto stagings = std::vector<std::shared_ptr<GpuStagingBuffer>> {};
+        for (const auto& chunk : m_chunks) {
+            auto byteSize = ChunkByteSize(chunk);
+            auto pStaging = adapter->AcquireUploadBuffer(byteSize);
+            auto* pMapped = (T*)pStaging->GetMappedRange(byteSize);
+            if (m_row != m_paddingRow || m_column != m_paddingColumn) {
+                // Staging buffer is reused, clean the padding left by previous upload.
+                std::fill(pMapped, pMapped + byteSize / sizeof(T), T {});
+            }
+            auto [rowBegin, rowEnd] = ChunkRows(chunk);
+            for (auto row = rowBegin; row < rowEnd; ++row) {
+                for (auto column = 0; column < m_column; ++column) {
+                    pMapped[IndexInMat4x4ArrayMemory(row - rowBegin, column)] = data.data()[row * m_column + column];
+                }
+            }
+            adapter->Upload(*pStaging, chunk.pBuffer.get(), 0, byteSize);
+            stagings.push_back(std::move(pStaging));
+        }
+        return std::async(std::launch::deferred, [stagings = std::move(stagings)] {
+            for (const auto& pStaging : stagings) {
+                pStaging->Wait();
             }
+        });
+    }
+
+    /// @brief Upload data which is already in the internal layout, no conversion at all.
+    ///
+    /// The internal layout is an array of row-major mat4x4 tiles, tiles are also row-major. Rows and columns are
+    /// padded to multiple of 4, so data must contain TiledSize() elements and the padding must be zero.
+    std::future<void> WriteTiledAsync(std::span<T> data)
+    {
+        if (TiledSize() != data.size()) {
+            throw std::runtime_error { "Elements size is not the same." };
         }
+
+        if (!BufferSize()) {
+            return std::async(std::launch::deferred, [] { });
+        }
+
+        // Chunks hold consecutive tile rows, so each of them is a contiguous part of data.
         auto adapter = GpuInstance::GetInstance().GetAdapter();
-        wgpuQueueWriteBuffer(adapter->GetQueue(), m_pBuffer.get(), 0, tmp.data(), sizeof(T) * tmp.size());
+        auto stagings = std::vector<std::shared_ptr<GpuStagingBuffer>> {};
+        for (const auto& chunk : m_chunks) {
+            auto byteSize = ChunkByteSize(chunk);
+            auto pStaging = adapter->AcquireUploadBuffer(byteSize);
+            std::memcpy(pStaging->GetMappedRange(byteSize), data.data() + ChunkElementOffset(chunk), byteSize);
+            adapter->Upload(*pStaging, chunk.pBuffer.get(), 0, byteSize);
+            stagings.push_back(std::move(pStaging));
+        }
+        return std::async(std::launch::deferred, [stagings = std::move(stagings)] {
+            for (const auto& pStaging : stagings) {
+                pStaging->Wait();
+            }
+        });
+    }
+
+    size_t TiledSize() const
+    {
+        return m_paddingRow * m_paddingColumn;
     }
 
     operator bool() const
     {
-        return m_pBuffer;
+        return !m_chunks.empty();
     }
 
     WebGpuMatrix operator*(const WebGpuMatrix& other) const
@@ -100,57 +226,65 @@ public:
             throw std::runtime_error { "Can't dot two matrixs" };
         }
 
-        auto adapter = GpuInstance::GetInstance().GetAdapter();
         auto output = WebGpuMatrix { m_row, other.m_column };
+        auto kTiles = m_paddingColumn >> 2;
+        auto nTiles = other.m_paddingColumn >> 2;
+        if (!(m_paddingRow >> 2) || !nTiles) {
+            return output;
+        }
 
-        // Caculate mat4x4
-        size_t N = (m_paddingColumn >> 2) * (other.m_paddingColumn >> 2) * (m_paddingRow >> 2);
-        auto intermediaBuffer = adapter->CreateBuffer<T>(N * 4 * 4);
-        if (N) {
-            auto code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input1: array<mat4x4<{1}>>;
-@group(0) @binding(1) var<storage, read_write> input2: array<mat4x4<{1}>>;
-@group(0) @binding(2) var<storage, read_write> output: array<mat4x4<{1}>>;
-@compute @workgroup_size(256)
+        // Each invocation computes one output tile, summing tile products over k in order. The operands may be split
+        // into chunks, so there is one dispatch for every output chunk, the left chunks overlapping it and every right
+        // chunk. Right chunks are visited in order, so the sum is accumulated in the same order as a single dispatch.
+        for (const auto& outputChunk : output.m_chunks) {
+            for (const auto& leftChunk : m_chunks) {
+                auto tileRowBegin = std::max(outputChunk.tileRowBegin, leftChunk.tileRowBegin);
+                auto tileRowEnd = std::min(ChunkTileRowEnd(outputChunk), ChunkTileRowEnd(leftChunk));
+                if (tileRowBegin >= tileRowEnd) {
+                    continue;
+                }
+
+                for (const auto& rightChunk : other.m_chunks) {
+                    if (!rightChunk.tileRowCount) {
+                        continue;
+                    }
+
+                    size_t N = (tileRowEnd - tileRowBegin) * nTiles;
+                    auto isFirst = &rightChunk == &other.m_chunks.front();
+                    auto code = std::format(R"({0}
+@group(0) @binding(0) var<storage, read_write> input1: array<stored_tile>;
+@group(0) @binding(1) var<storage, read_write> input2: array<stored_tile>;
+@group(0) @binding(2) var<storage, read_write> output: array<stored_tile>;
+@compute @workgroup_size(64)
 fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
     let i: u32 = global_id.x;
     if (i < {2}) {{
-        var a_row_index = i / ({3} * {4});
-        var a_col_index = i % {3};
-        var a_index = a_row_index * {3} + a_col_index;
-
-        var b_row_index = i % {3};
-        var b_col_index = i / {3} % {4};
-        var b_index = b_row_index * {4} + b_col_index;
-
-        output[i] = transpose(transpose(input1[a_index]) * transpose(input2[b_index]));
-    }}
-}}
-)",
-                WgslFeatures(), WgslElementType(), N, (m_paddingColumn >> 2), (other.m_paddingColumn >> 2));
-            auto parameters = std::vector<Parameter> {
-                { GetBuffer(), BufferSize() },
-                { other.GetBuffer(), other.BufferSize() },
-                { intermediaBuffer.get(), sizeof(T) * N * 4 * 4 },
-            };
-            webgpu::Run(code, { parameters.begin(), parameters.end() }, N, 256);
-
-            code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input: array<mat4x4<{1}>>;
-@group(0) @binding(1) var<storage, read_write> output: array<mat4x4<{1}>>;
-@compute @workgroup_size(1)
-fn main() {{
-    for (var i = 0; i < {2}; i = i + 1) {{
-        output[i / {3}] = output[i / {3}] + input[i];
+        let row = i / {4};
+        let column = i % {4};
+        let output_index = (row + {6}) * {4} + column;
+        var sum = {8};
+        for (var k = 0u; k < {5}; k = k + 1u) {{
+            let a = unpack_tile(input1[(row + {7}) * {3} + k + {9}]);
+            let b = unpack_tile(input2[k * {4} + column]);
+            sum = sum + transpose(transpose(a) * transpose(b));
+        }}
+        output[output_index] = pack_tile(sum);
     }}
 }}
 )",
-                WgslFeatures(), WgslElementType(), N, m_paddingColumn >> 2);
-            parameters = std::vector<Parameter> {
-                { intermediaBuffer.get(), sizeof(T) * N * 4 * 4 },
-                { output.GetBuffer(), output.BufferSize() },
-            };
-            webgpu::Run(code, { parameters.begin(), parameters.end() }, 1, 1);
+                        WgslPrelude(), WgslElementType(), N, kTiles, nTiles, rightChunk.tileRowCount,
+                        tileRowBegin - outputChunk.tileRowBegin, tileRowBegin - leftChunk.tileRowBegin,
+                        isFirst ? std::format("mat4x4<{}>()", WgslElementType()) : "unpack_tile(output[output_index])",
+                        rightChunk.tileRowBegin);
+                    auto parameters = std::vector<Parameter> {
+                        ChunkParameter(leftChunk),
+                        other.ChunkParameter(rightChunk),
+                        output.ChunkParameter(outputChunk),
+                    };
+                    webgpu::Run({ "MatMul", { m_row, m_column, other.m_column }, ElementTypeName<T>() }, code,
+                        { parameters.begin(), parameters.end() }, N, 64);
+                }
+            }
         }
 
         return output;
@@ -158,155 +292,247 @@ fn main() {{
 
     WebGpuMatrix operator+(const WebGpuMatrix& other) const
     {
-        return ElementWiseAddOrSub(other, '+');
+        return EvaluateExpression(BinaryNode(Node::Op::Add, InputNode(*this), InputNode(other)), "Add");
     }
 
     WebGpuMatrix& operator+=(const WebGpuMatrix& other)
     {
-        *this = *this + other;
+        EvaluateExpression(BinaryNode(Node::Op::Add, InputNode(*this), InputNode(other)), "AddInPlace", *this);
         return *this;
     }
 
     WebGpuMatrix operator+(T v) const
     {
-        auto adapter = GpuInstance::GetInstance().GetAdapter();
-        auto vbuffer = adapter->CreateBuffer<T>(1);
-
-        // Buffer need 4 bytes aligned, so always write 4 bytes even it is std::float16_t
-        std::float32_t tmp { v };
-        wgpuQueueWriteBuffer(adapter->GetQueue(), vbuffer.get(), 0, &v, sizeof(tmp));
-
-        auto output = WebGpuMatrix { m_row, m_column };
-
-        // Caculate mat4x4
-        size_t N = (m_paddingRow >> 2) * m_paddingColumn;
-        auto code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input1: array<vec4<{1}>>;
-@group(0) @binding(1) var<storage, read_write> input2: {1};
-@group(0) @binding(2) var<storage, read_write> output: array<vec4<{1}>>;
-@compute @workgroup_size(256)
-fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
-    let i: u32 = global_id.x;
-    if (i < {2}) {{
-        output[i] = input1[i] + input2;
-    }}
-}}
-)",
-            WgslFeatures(), WgslElementType(), N);
-        auto parameters = std::vector<Parameter> {
-            { GetBuffer(), BufferSize() },
-            { vbuffer.get(), sizeof(std::float32_t) },
-            { output.GetBuffer(), output.BufferSize() },
-        };
-        webgpu::Run(code, { parameters.begin(), parameters.end() }, N, 256);
-        return output;
+        return EvaluateExpression(BinaryNode(Node::Op::Add, InputNode(*this), ScalarNode(v)), "AddScalar");
     }
 
     WebGpuMatrix operator-(const WebGpuMatrix& other) const
     {
-        return ElementWiseAddOrSub(other, '-');
+        return EvaluateExpression(BinaryNode(Node::Op::Sub, InputNode(*this), InputNode(other)), "Sub");
     }
 
     WebGpuMatrix Sigmoid() const
     {
-        auto output = WebGpuMatrix { m_row, m_column };
+        return EvaluateExpression(Node { .op = Node::Op::Sigmoid, .pLhs = InputNode(*this) }, "Sigmoid");
+    }
 
-        // Caculate mat4x4
-        size_t N = (m_paddingRow >> 2) * m_paddingColumn;
-        auto code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input: array<vec4<{1}>>;
-@group(0) @binding(1) var<storage, read_write> output: array<vec4<{1}>>;
+    WebGpuMatrix Transpose() const
+    {
+        auto output = WebGpuMatrix { m_column, m_row };
+        auto tileColumns = m_paddingColumn >> 2;
+        auto outputTileColumns = m_paddingRow >> 2;
+
+        // Tile (r, c) goes to tile (c, r) of the output, so every pair of input and output chunks has a dispatch
+        // which moves the tiles of input tile rows in the first chunk and input tile columns in the second one.
+        for (const auto& chunk : m_chunks) {
+            for (const auto& outputChunk : output.m_chunks) {
+                size_t N = chunk.tileRowCount * outputChunk.tileRowCount;
+                if (!N) {
+                    continue;
+                }
+
+                auto code = std::format(R"({0}
+@group(0) @binding(0) var<storage, read_write> input: array<stored_tile>;
+@group(0) @binding(1) var<storage, read_write> output: array<stored_tile>;
 @compute @workgroup_size(256)
 fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
     let i: u32 = global_id.x;
     if (i < {2}) {{
-        output[i] = 1 / (1 + exp(-input[i]));
+        let row = i / {3};
+        let column = i % {3} + {4};
+        output[(column - {4}) * {6} + row + {7}] = pack_tile(transpose(unpack_tile(input[row * {5} + column])));
     }}
 }}
 )",
-            WgslFeatures(), WgslElementType(), N);
-        auto parameters = std::vector<Parameter> {
-            { GetBuffer(), BufferSize() },
-            { output.GetBuffer(), output.BufferSize() },
-        };
-        webgpu::Run(code, { parameters.begin(), parameters.end() }, N, 256);
+                    WgslPrelude(), WgslElementType(), N, outputChunk.tileRowCount, outputChunk.tileRowBegin,
+                    tileColumns, outputTileColumns, chunk.tileRowBegin);
+                auto parameters = std::vector<Parameter> {
+                    ChunkParameter(chunk),
+                    output.ChunkParameter(outputChunk),
+                };
+                webgpu::Run({ "Transpose", { m_row, m_column }, ElementTypeName<T>() }, code,
+                    { parameters.begin(), parameters.end() }, N, 256);
+            }
+        }
         return output;
     }
 
-    WebGpuMatrix Transpose() const
+    /// @brief A copy converted to element type U on GPU, e.g. f16 working copies of f32 weights.
+    template <MatrixElementType U>
+    WebGpuMatrix<U> Cast() const
     {
-        auto output = WebGpuMatrix { m_column, m_row };
+        auto output = WebGpuMatrix<U> { m_row, m_column };
+        auto tileColumns = m_paddingColumn >> 2;
+
+        // Both have the same tiles, but chunks of a wider type hold fewer tile rows. Every pair of chunks which share
+        // tile rows has a dispatch which converts those tiles.
+        for (const auto& chunk : m_chunks) {
+            for (const auto& outputChunk : output.m_chunks) {
+                auto tileRowBegin = std::max(chunk.tileRowBegin, outputChunk.tileRowBegin);
+                auto tileRowEnd = std::min(ChunkTileRowEnd(chunk), ChunkTileRowEnd(outputChunk));
+                if (tileRowBegin >= tileRowEnd || !tileColumns) {
+                    continue;
+                }
 
-        // Caculate mat4x4
-        size_t N = (m_paddingRow >> 2) * (m_paddingColumn >> 2);
-        auto code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input: array<mat4x4<{1}>>;
-@group(0) @binding(1) var<storage, read_write> output: array<mat4x4<{1}>>;
+                size_t N = (tileRowEnd - tileRowBegin) * tileColumns;
+                auto code = std::format(R"({0}{1}
+{2}
+@group(0) @binding(1) var<storage, read_write> output: array<stored_tile>;
 @compute @workgroup_size(256)
 fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
     let i: u32 = global_id.x;
-    if (i < {2}) {{
-        output[(i % {4}) * {3} + (i / {4})] = transpose(input[i]);
+    if (i < {3}) {{
+        output[i + {5}] = pack_tile(mat4x4<element>(load_source(i + {4})));
     }}
 }}
 )",
-            WgslFeatures(), WgslElementType(), N, m_paddingRow >> 2, m_paddingColumn >> 2);
-        auto parameters = std::vector<Parameter> {
-            { GetBuffer(), BufferSize() },
-            { output.GetBuffer(), output.BufferSize() },
-        };
-        webgpu::Run(code, { parameters.begin(), parameters.end() }, N, 256);
+                    // The kernel has the prelude of U, which enables f16 only if U is f16.
+                    std::is_same_v<T, std::float16_t> && !std::is_same_v<U, std::float16_t> ? "enable f16;\n" : "",
+                    WebGpuMatrix<U>::WgslPrelude(), WgslCastSource(), N,
+                    (tileRowBegin - chunk.tileRowBegin) * tileColumns,
+                    (tileRowBegin - outputChunk.tileRowBegin) * tileColumns);
+                auto parameters = std::vector<Parameter> {
+                    ChunkParameter(chunk),
+                    output.ChunkParameter(outputChunk),
+                };
+                webgpu::Run({ "Cast", { m_row, m_column }, ElementTypeName<T>() }, code,
+                    { parameters.begin(), parameters.end() }, N, 256);
+            }
+        }
         return output;
     }
 
     WebGpuMatrix ElementProduct(const WebGpuMatrix& other) const
     {
-        if (m_row != other.m_row || m_column != other.m_column) {
-            throw std::runtime_error { "Shape is not the same." };
+        return EvaluateExpression(BinaryNode(Node::Op::Mul, InputNode(*this), InputNode(other)), "ElementProduct");
+    }
+
+    std::vector<T> Read() const
+    {
+        return ReadAsync().get();
+    }
+
+    /// @brief Whether the futures of ReadAsync() and ReadRowsAsync() may be got on another thread than the one which
+    /// uses the GPU, see GpuAdapter::IsThreadSafe().
+    static bool IsReadbackThreadSafe()
+    {
+        return GpuInstance::GetInstance().GetAdapter()->IsThreadSafe();
+    }
+
+    /// @brief Start to download the matrix, the data is converted to row-major layout when the future is got.
+    ///
+    /// The copy is queued right away, so later changes of this matrix don't affect the result.
+    std::future<std::vector<T>> ReadAsync() const
+    {
+        if (!BufferSize()) {
+            return std::async(std::launch::deferred, [] { return std::vector<T> {}; });
+        }
+
+        // bf16 is converted on CPU, the GPU conversion writes single elements which would share u32 of packed output.
+        if (!kIsPacked && m_row * m_column >= kGpuLayoutConversionThreshold) {
+            return ReadWithGpuLayoutConversion();
         }
 
         auto adapter = GpuInstance::GetInstance().GetAdapter();
-        auto output = WebGpuMatrix { m_row, m_column };
+        auto stagings = std::vector<std::shared_ptr<GpuStagingBuffer>> {};
+        for (const auto& chunk : m_chunks) {
+            stagings.push_back(adapter->Readback(chunk.pBuffer.get(), 0, ChunkByteSize(chunk)));
+        }
+        return std::async(std::launch::deferred, [stagings = std::move(stagings), row = m_row, column = m_column,
+                                                     paddingColumn = m_paddingColumn, chunks = ChunkRowRanges()] {
+            std::vector<T> out(row * column);
+            for (auto n = 0u; n < stagings.size(); ++n) {
+                const auto* data = (const T*)stagings[n]->GetConstMappedRange();
+                auto [rowBegin, rowEnd] = chunks[n];
+                for (auto y = rowBegin; y < rowEnd; ++y) {
+                    for (auto x = 0u; x < column; ++x) {
+                        auto i = IndexInMat4x4ArrayMemory(y - rowBegin, x, paddingColumn);
+                        out.data()[y * column + x] = data[i];
+                    }
+                }
+                stagings[n]->Unmap();
+            }
+            return out;
+        });
+    }
 
-        // Caculate vec4x4
-        size_t N = (m_paddingRow >> 2) * m_paddingColumn;
-        if (N) {
-            auto code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input1: array<vec4<{1}>>;
-@group(0) @binding(1) var<storage, read_write> input2: array<vec4<{1}>>;
-@group(0) @binding(2) var<storage, read_write> output: array<vec4<{1}>>;
-@compute @workgroup_size(256)
-fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
-    let i: u32 = global_id.x;
-    if (i < {2}) {{
-        output[i] = input1[i] * input2[i];
-    }}
-}}
-)",
-                WgslFeatures(), WgslElementType(), N);
-            auto parameters = std::vector<Parameter> {
-                { GetBuffer(), BufferSize() },
-                { other.GetBuffer(), other.BufferSize() },
-                { output.GetBuffer(), output.BufferSize() },
-            };
-            webgpu::Run(code, { parameters.begin(), parameters.end() }, N, 256);
+    /// @brief Start to download rows [rowBegin, rowEnd) in row-major layout. Only the tile rows which hold them are
+    /// copied, so a large matrix can be streamed in blocks of rows without a host copy of all of it.
+    std::future<std::vector<T>> ReadRowsAsync(size_t rowBegin, size_t rowEnd) const
+    {
+        if (rowBegin > rowEnd || rowEnd > m_row) {
+            throw std::runtime_error { "Out of range" };
         }
 
-        return output;
+        if (rowBegin == rowEnd || !BufferSize()) {
+            return std::async(std::launch::deferred, [] { return std::vector<T> {}; });
+        }
+
+        // Tile rows are contiguous in a chunk, so the rows of each chunk are one copy.
+        struct Download {
+            std::shared_ptr<GpuStagingBuffer> pStaging {};
+            size_t firstRow {};
+            size_t rowBegin {};
+            size_t rowEnd {};
+        };
+        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        auto tileRowByteSize = sizeof(T) * 4 * m_paddingColumn;
+        auto downloads = std::vector<Download> {};
+        for (const auto& chunk : m_chunks) {
+            auto [chunkRowBegin, chunkRowEnd] = ChunkRows(chunk);
+            auto begin = std::max(rowBegin, chunkRowBegin);
+            auto end = std::min(rowEnd, chunkRowEnd);
+            if (begin >= end) {
+                continue;
+            }
+
+            auto tileRowBegin = (begin - chunkRowBegin) >> 2;
+            auto tileRowEnd = (end - chunkRowBegin + 3) >> 2;
+            auto pStaging = adapter->Readback(chunk.pBuffer.get(), tileRowBegin * tileRowByteSize,
+                (tileRowEnd - tileRowBegin) * tileRowByteSize);
+            downloads.push_back({ std::move(pStaging), chunkRowBegin + tileRowBegin * 4, begin, end });
+        }
+        return std::async(std::launch::deferred,
+            [downloads = std::move(downloads), rowBegin, rowEnd, column = m_column, paddingColumn = m_paddingColumn] {
+                std::vector<T> out((rowEnd - rowBegin) * column);
+                for (const auto& download : downloads) {
+                    const auto* data = (const T*)download.pStaging->GetConstMappedRange();
+                    for (auto y = download.rowBegin; y < download.rowEnd; ++y) {
+                        for (auto x = 0u; x < column; ++x) {
+                            auto i = IndexInMat4x4ArrayMemory(y - download.firstRow, x, paddingColumn);
+                            out.data()[(y - rowBegin) * column + x] = data[i];
+                        }
+                    }
+                    download.pStaging->Unmap();
+                }
+                return out;
+            });
     }
 
-    std::vector<T> Read() const
+    /// @brief Download the matrix in the internal layout (see WriteTiledAsync()), no conversion at all.
+    std::future<std::vector<T>> ReadTiledAsync() const
     {
-        std::vector<T> out(m_row * m_column);
-        MapBuffer([this, &out](const T* data) {
-            for (auto y = 0u; y < m_row; ++y) {
-                for (auto x = 0u; x < m_column; ++x) {
-                    auto i = IndexInMat4x4ArrayMemory(y, x);
-                    out.data()[y * m_column + x] = data[i];
-                }
+        if (!BufferSize()) {
+            return std::async(std::launch::deferred, [] { return std::vector<T> {}; });
+        }
+
+        // Chunks hold consecutive tile rows, so they are just concatenated.
+        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        auto stagings = std::vector<std::pair<std::shared_ptr<GpuStagingBuffer>, size_t>> {};
+        for (const auto& chunk : m_chunks) {
+            auto byteSize = ChunkByteSize(chunk);
+            stagings.emplace_back(adapter->Readback(chunk.pBuffer.get(), 0, byteSize), byteSize);
+        }
+        return std::async(std::launch::deferred, [stagings = std::move(stagings), size = TiledSize()] {
+            std::vector<T> out(size);
+            auto* pOut = (std::byte*)out.data();
+            for (const auto& [pStaging, byteSize] : stagings) {
+                std::memcpy(pOut, pStaging->GetConstMappedRange(), byteSize);
+                pStaging->Unmap();
+                pOut += byteSize;
             }
+            return out;
         });
-        return out;
     }
 
     T operator[](size_t row, size_t column) const
@@ -315,192 +541,790 @@ fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
             throw std::runtime_error { "Out of range" };
         }
 
+        // Only copy the 4 bytes (copy size must be 4 bytes aligned) which contain the element.
+        const auto& chunk = m_chunks[(row >> 2) / m_chunks.front().tileRowCount];
+        auto byteOffset = sizeof(T) * IndexInMat4x4ArrayMemory(row - ChunkRows(chunk).first, column);
+        auto alignedByteOffset = byteOffset & ~3;
+        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        auto pStaging = adapter->Readback(chunk.pBuffer.get(), alignedByteOffset, 4);
+        const auto* data = (const std::byte*)pStaging->GetConstMappedRange();
+
         T ret {};
-        MapBuffer([this, row, column, &ret](const T* data) {
-            auto i = IndexInMat4x4ArrayMemory(row, column);
-            ret = data[i];
-        });
+        std::memcpy(&ret, data + (byteOffset - alignedByteOffset), sizeof(T));
+        pStaging->Unmap();
         return ret;
     }
 
     WebGpuMatrix Relu() const
     {
-        auto adapter = GpuInstance::GetInstance().GetAdapter();
-        auto output = WebGpuMatrix { m_row, m_column };
+        return EvaluateExpression(Node { .op = Node::Op::Relu, .pLhs = InputNode(*this) }, "Relu");
+    }
 
-        // Caculate vec4x4
-        size_t N = (m_paddingRow >> 2) * m_paddingColumn;
-        if (N) {
-            auto code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input1: array<vec4<{1}>>;
-@group(0) @binding(1) var<storage, read_write> output: array<vec4<{1}>>;
-@compute @workgroup_size(256)
-fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
-    let i: u32 = global_id.x;
-    if (i < {2}) {{
-        output[i] = max(input1[i], vec4<{1}>(0.0));
-    }}
-}}
-)",
-                WgslFeatures(), WgslElementType(), N);
-            auto parameters = std::vector<Parameter> {
-                { GetBuffer(), BufferSize() },
-                { output.GetBuffer(), output.BufferSize() },
-            };
-            webgpu::Run(code, { parameters.begin(), parameters.end() }, N, 256);
+    /// @brief Sum of each row, the result is a row x 1 matrix.
+    WebGpuMatrix RowSum() const
+    {
+        return ReduceRows(Reduction::Sum);
+    }
+
+    /// @brief Sum of each column, the result is a 1 x column matrix.
+    WebGpuMatrix ColumnSum() const
+    {
+        auto output = WebGpuMatrix { 1, m_column };
+        ReduceColumns(Reduction::Sum, output, {});
+        return output;
+    }
+
+    /// @brief Sum of all elements, the result is a 1 x 1 matrix. It is accumulated in f32, and only the total is
+    /// rounded to T.
+    WebGpuMatrix Sum() const
+    {
+        if constexpr (std::is_same_v<T, std::float32_t>) {
+            return ReduceRows(Reduction::Sum).ColumnSum();
+        } else {
+            // Row sums rounded to T would round the total twice.
+            auto rowSums = WebGpuMatrix<std::float32_t> { m_row, 1 };
+            ReduceRows(Reduction::Sum, rowSums);
+            return rowSums.ColumnSum().template Cast<T>();
         }
+    }
 
+    /// @brief Maximum of all elements, the result is a 1 x 1 matrix.
+    WebGpuMatrix Max() const
+    {
+        if (!m_row || !m_column) {
+            throw std::runtime_error { "Matrix is empty." };
+        }
+
+        auto rowMax = ReduceRows(Reduction::Max);
+        auto output = WebGpuMatrix { 1, 1 };
+        rowMax.ReduceColumns(Reduction::Max, output, {});
         return output;
     }
 
+    /// @brief Row index of the maximum of each column, the first one wins if there are several.
+    std::vector<size_t> ArgMax() const
+    {
+        return ArgMaxAsync().get();
+    }
+
+    /// @brief Compute ArgMax() on GPU, only the indices are downloaded.
+    std::future<std::vector<size_t>> ArgMaxAsync() const
+    {
+        if (!m_row) {
+            throw std::runtime_error { "Matrix is empty." };
+        }
+
+        if (!m_column) {
+            return std::async(std::launch::deferred, [] { return std::vector<size_t> {}; });
+        }
+
+        // One u32 per column, float has the same size. The maximums are kept in a matrix, so later chunks can be
+        // compared with earlier ones.
+        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        auto indexLease = MemoryLease { MemoryKind::Gpu, sizeof(uint32_t) * m_column, { 1, m_column } };
+        auto indexBuffer = adapter->CreateBuffer<float>(m_column);
+        auto maxValues = WebGpuMatrix { 1, m_column };
+        ReduceColumns(Reduction::ArgMax, maxValues, { indexBuffer.get(), sizeof(uint32_t) * m_column });
+
+        auto pStaging = adapter->Readback(indexBuffer.get(), 0, sizeof(uint32_t) * m_column);
+        return std::async(std::launch::deferred, [pStaging = std::move(pStaging), size = m_column] {
+            std::vector<uint32_t> indices(size);
+            std::memcpy(indices.data(), pStaging->GetConstMappedRange(), sizeof(uint32_t) * size);
+            pStaging->Unmap();
+            return std::vector<size_t> { indices.begin(), indices.end() };
+        });
+    }
+
+    /// @brief Evaluate an element-wise expression with one generated vec4 kernel.
+    ///
+    /// The kernel only depends on the expression's structure and shape, scalars are passed as uniforms, so its
+    /// pipeline is reused by every later evaluation of the same expression even if scalars change.
+    static WebGpuMatrix Evaluate(const ExpressionNode<WebGpuMatrix>& root)
+    {
+        return EvaluateExpression(root, "Fused");
+    }
+
+    /// @brief Evaluate an element-wise expression into the buffers of out, which may be one of its inputs.
+    ///
+    /// Like Write(), copies of out which share its buffers see the result.
+    static void Evaluate(const ExpressionNode<WebGpuMatrix>& root, WebGpuMatrix& out)
+    {
+        EvaluateExpression(root, "FusedInPlace", out);
+    }
+
 private:
+    using Node = ExpressionNode<WebGpuMatrix>;
+
+    using Chunk = WebGpuChunk;
+
+    enum class Reduction {
+        Sum,
+        Max,
+        ArgMax,
+    };
+
+    // Below this size the layout conversion on CPU is cheaper than an extra dispatch.
+    static constexpr size_t kGpuLayoutConversionThreshold = 16 * 1024;
+
+    static inline size_t s_maxChunkByteSize {};
+
+    // WGSL has no bf16, a bf16 matrix is stored as u32 which each hold two elements, the lower half first. The layout
+    // is the same tiles as other types, and kernels unpack to f32, compute and pack the result.
+    static constexpr bool kIsPacked = std::is_same_v<T, std::bfloat16_t>;
+
+    // The type kernels compute in.
     static constexpr const char* WgslElementType()
     {
         return std::is_same_v<T, std::float16_t> ? "f16" : "f32";
     }
 
-    static constexpr const char* WgslFeatures()
+    // Starts every kernel: the features and storage types of T, and functions which convert a stored tile row (vec4)
+    // or tile (mat4x4) to the compute type and back. They are identities unless T is packed.
+    static const std::string& WgslPrelude()
+    {
+        static const auto s_prelude = MakeWgslPrelude();
+        return s_prelude;
+    }
+
+    static std::string MakeWgslPrelude()
+    {
+        if constexpr (kIsPacked) {
+            return R"(alias element = f32;
+alias stored_element = u32;
+alias stored_vec4 = vec2<u32>;
+alias stored_tile = array<vec2<u32>, 4>;
+fn unpack2(v: u32) -> vec2<f32> {
+    return vec2<f32>(bitcast<f32>(v << 16u), bitcast<f32>(v & 0xffff0000u));
+}
+fn pack2(v: vec2<f32>) -> u32 {
+    // Round to nearest even, the same as the conversion on CPU.
+    let bits = bitcast<vec2<u32>>(v);
+    let rounded = (bits + 0x7fffu + ((bits >> vec2<u32>(16u)) & vec2<u32>(1u))) >> vec2<u32>(16u);
+    return rounded.x | (rounded.y << 16u);
+}
+fn unpack4(v: stored_vec4) -> vec4<element> {
+    return vec4<f32>(unpack2(v.x), unpack2(v.y));
+}
+fn pack4(v: vec4<element>) -> stored_vec4 {
+    return vec2<u32>(pack2(v.xy), pack2(v.zw));
+}
+fn unpack_tile(t: stored_tile) -> mat4x4<element> {
+    return mat4x4<f32>(unpack4(t[0]), unpack4(t[1]), unpack4(t[2]), unpack4(t[3]));
+}
+fn pack_tile(m: mat4x4<element>) -> stored_tile {
+    return stored_tile(pack4(m[0]), pack4(m[1]), pack4(m[2]), pack4(m[3]));
+})";
+        } else {
+            return std::format(R"({0}alias element = {1};
+alias stored_element = {1};
+alias stored_vec4 = vec4<{1}>;
+alias stored_tile = mat4x4<{1}>;
+fn unpack4(v: stored_vec4) -> vec4<element> {{
+    return v;
+}}
+fn pack4(v: vec4<element>) -> stored_vec4 {{
+    return v;
+}}
+fn unpack_tile(t: stored_tile) -> mat4x4<element> {{
+    return t;
+}}
+fn pack_tile(m: mat4x4<element>) -> stored_tile {{
+    return m;
+}})",
+                std::is_same_v<T, std::float16_t> ? "enable f16;\n" : "", WgslElementType());
+        }
+    }
+
+    // Binding input of a Cast() from T, load_source(i) reads tile i in f32. The kernel has the prelude of the output
+    // type, so this declares everything it needs of T.
+    static std::string WgslCastSource()
+    {
+        if constexpr (kIsPacked) {
+            return R"(@group(0) @binding(0) var<storage, read_write> input: array<array<vec2<u32>, 4>>;
+fn unpack_source(v: vec2<u32>) -> vec4<f32> {
+    let halves = vec4<u32>(v.x << 16u, v.x & 0xffff0000u, v.y << 16u, v.y & 0xffff0000u);
+    return bitcast<vec4<f32>>(halves);
+}
+fn load_source(i: u32) -> mat4x4<f32> {
+    let t = input[i];
+    return mat4x4<f32>(unpack_source(t[0]), unpack_source(t[1]), unpack_source(t[2]), unpack_source(t[3]));
+})";
+        } else {
+            return std::format(R"(@group(0) @binding(0) var<storage, read_write> input: array<mat4x4<{0}>>;
+fn load_source(i: u32) -> mat4x4<f32> {{
+    return mat4x4<f32>(input[i]);
+}})",
+                WgslElementType());
+        }
+    }
+
+    // load_input(i) of a binding input: array<stored_element>, it reads element i.
+    static std::string WgslLoadInput()
+    {
+        return kIsPacked ? "fn load_input(i: u32) -> element {\n    return unpack2(input[i >> 1u])[i & 1u];\n}"
+                         : "fn load_input(i: u32) -> element {\n    return input[i];\n}";
+    }
+
+    // Binding output of a reduction with load_output(i) and store_output(i, v). Both halves of a packed u32 may be
+    // different lines, which different workgroups write, so they are stored with atomics.
+    static std::string WgslReductionOutput()
+    {
+        if constexpr (kIsPacked) {
+            return R"(@group(0) @binding(1) var<storage, read_write> output: array<atomic<u32>>;
+fn load_output(i: u32) -> element {
+    return unpack2(atomicLoad(&output[i >> 1u]))[i & 1u];
+}
+fn store_output(i: u32, v: element) {
+    let shift = (i & 1u) << 4u;
+    atomicAnd(&output[i >> 1u], ~(0xffffu << shift));
+    atomicOr(&output[i >> 1u], (pack2(vec2<f32>(v, 0.0)) & 0xffffu) << shift);
+})";
+        } else {
+            // Declared with T rather than the aliases of the prelude, a reduction may write another type than it reads.
+            return std::format(R"(@group(0) @binding(1) var<storage, read_write> output: array<{0}>;
+fn load_output(i: u32) -> {0} {{
+    return output[i];
+}}
+fn store_output(i: u32, v: {0}) {{
+    output[i] = v;
+}})",
+                WgslElementType());
+        }
+    }
+
+    void AllocateChunks()
+    {
+        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        auto maxChunkByteSize = s_maxChunkByteSize ? s_maxChunkByteSize : adapter->GetMaxStorageBufferSize();
+        auto tileRowByteSize = sizeof(T) * 4 * m_paddingColumn;
+        if (tileRowByteSize > maxChunkByteSize) {
+            throw std::runtime_error { std::format(
+                "Matrix row is too big (required size is {}, limits is {}).", tileRowByteSize, maxChunkByteSize) };
+        }
+
+        // WebGPU buffers are zero initialized, so the padding is zero.
+        auto tileRows = m_paddingRow >> 2;
+        auto tileRowsPerChunk = tileRowByteSize ? std::max<size_t>(maxChunkByteSize / tileRowByteSize, 1) : tileRows;
+        m_chunks.clear();
+        auto tileRowBegin = size_t {};
+        do {
+            auto tileRowCount = std::min(tileRowsPerChunk, tileRows - tileRowBegin);
+            auto pLease = std::make_shared<const MemoryLease>(
+                MemoryKind::Gpu, sizeof(T) * tileRowCount * 4 * m_paddingColumn, std::array { m_row, m_column });
+            auto pBuffer = adapter->CreateBuffer<T>(tileRowCount * 4, m_paddingColumn);
+            m_chunks.push_back({ std::move(pBuffer), tileRowBegin, tileRowCount, std::move(pLease) });
+            tileRowBegin += tileRowCount;
+        } while (tileRowBegin < tileRows);
+    }
+
+    size_t ChunkByteSize(const Chunk& chunk) const
+    {
+        return sizeof(T) * chunk.tileRowCount * 4 * m_paddingColumn;
+    }
+
+    size_t ChunkElementOffset(const Chunk& chunk) const
+    {
+        return chunk.tileRowBegin * 4 * m_paddingColumn;
+    }
+
+    static size_t ChunkTileRowEnd(const Chunk& chunk)
     {
-        return std::is_same_v<T, std::float16_t> ? "enable f16;" : "";
+        return chunk.tileRowBegin + chunk.tileRowCount;
     }
 
-    WebGpuMatrix ElementWiseAddOrSub(const WebGpuMatrix& other, char op) const
+    // Rows of the matrix (not padding) stored in the chunk.
+    std::pair<size_t, size_t> ChunkRows(const Chunk& chunk) const
     {
-        if (m_row != other.m_row || m_column != other.m_column) {
+        return { std::min(chunk.tileRowBegin * 4, m_row), std::min(ChunkTileRowEnd(chunk) * 4, m_row) };
+    }
+
+    std::vector<std::pair<size_t, size_t>> ChunkRowRanges() const
+    {
+        auto ranges = std::vector<std::pair<size_t, size_t>> {};
+        for (const auto& chunk : m_chunks) {
+            ranges.push_back(ChunkRows(chunk));
+        }
+        return ranges;
+    }
+
+    Parameter ChunkParameter(const Chunk& chunk) const
+    {
+        return { chunk.pBuffer.get(), ChunkByteSize(chunk) };
+    }
+
+    static std::shared_ptr<const Node> InputNode(const WebGpuMatrix& m)
+    {
+        return std::make_shared<const Node>(Node { .op = Node::Op::Input, .pInput = &m });
+    }
+
+    static std::shared_ptr<const Node> ScalarNode(T v)
+    {
+        return std::make_shared<const Node>(Node { .op = Node::Op::Scalar, .scalar = static_cast<float>(v) });
+    }
+
+    static Node BinaryNode(Node::Op op, std::shared_ptr<const Node> pLhs, std::shared_ptr<const Node> pRhs)
+    {
+        return Node { .op = op, .pLhs = std::move(pLhs), .pRhs = std::move(pRhs) };
+    }
+
+    static WebGpuMatrix EvaluateExpression(const Node& root, const char* label)
+    {
+        auto inputs = ExpressionInputs(root);
+        auto output = WebGpuMatrix { inputs[0]->m_row, inputs[0]->m_column };
+        EvaluateExpression(root, label, output);
+        return output;
+    }
+
+    // A buffer can't be bound twice in a dispatch if it is writable, so if output is one of the inputs, the kernel
+    // writes through the binding of that input. Each invocation reads and writes only its own vec4, so it is safe.
+    static void EvaluateExpression(const Node& root, const char* label, WebGpuMatrix& output)
+    {
+        auto inputs = ExpressionInputs(root);
+        if (output.m_row != inputs[0]->m_row || output.m_column != inputs[0]->m_column) {
             throw std::runtime_error { "Shape is not the same." };
         }
+        for (const auto* pInput : inputs) {
+            if (pInput->m_chunks.size() != output.m_chunks.size()
+                || pInput->m_chunks[0].tileRowCount != output.m_chunks[0].tileRowCount) {
+                throw std::runtime_error { "Chunks are not the same." };
+            }
+        }
+
+        // Copies share buffers, so the output is found by its buffer rather than its address.
+        auto outputInput = std::ranges::find_if(inputs, [&](const auto* pInput) {
+            return pInput->m_chunks[0].pBuffer.get() == output.m_chunks[0].pBuffer.get();
+        });
+        auto isInPlace = outputInput != inputs.end();
+        auto outputName = isInPlace ? std::format("input{}", outputInput - inputs.begin()) : std::string { "output" };
 
-        auto output = WebGpuMatrix { m_row, m_column };
+        auto bindings = std::string {};
+        for (auto n = 0u; n < inputs.size(); ++n) {
+            bindings += std::format(
+                "@group(0) @binding({0}) var<storage, read_write> input{0}: array<stored_vec4>;\n", n);
+        }
+        auto scalarBinding = inputs.size() + 1;
+        if (isInPlace) {
+            --scalarBinding;
+        } else {
+            bindings += std::format(
+                "@group(0) @binding({}) var<storage, read_write> output: array<stored_vec4>;\n", inputs.size());
+        }
+
+        // The sizes of a chunk follow the scalars of the expression, so one kernel serves every shape, and the
+        // pipeline cache holds one entry per expression rather than per expression and shape.
+        auto scalars = std::vector<float> {};
+        auto value = std::format("vec4<{}>({})", WgslElementType(), WgslExpression(root, inputs, scalars));
+        auto sizeIndex = scalars.size();
+        bindings += WgslScalars(scalarBinding, sizeIndex + 4) + "\n";
+
+        // Inputs have the same shape, so they are split into chunks the same way as the output.
+        for (auto n = 0u; n < output.m_chunks.size(); ++n) {
+            const auto& chunk = output.m_chunks[n];
+            size_t N = chunk.tileRowCount * output.m_paddingColumn;
+            if (!N) {
+                continue;
+            }
+
+            // Keep the padding zero, matmul relies on it but sigmoid(0) or 1 - 0 is not zero.
+            auto [rowBegin, rowEnd] = output.ChunkRows(chunk);
+            auto chunkValue = value;
+            if (rowEnd - rowBegin != chunk.tileRowCount * 4 || output.m_column != output.m_paddingColumn) {
+                chunkValue = std::format(R"(select(vec4<{0}>(0), {1},
+            vec4<bool>(row < rows) & (vec4<u32>(0, 1, 2, 3) + column < vec4<u32>(columns))))",
+                    WgslElementType(), value);
+            }
 
-        // Caculate mat4x4
-        size_t N = (m_paddingRow >> 2) * (m_paddingColumn >> 2);
-        if (N) {
             auto code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input1: array<mat4x4<{1}>>;
-@group(0) @binding(1) var<storage, read_write> input2: array<mat4x4<{1}>>;
-@group(0) @binding(2) var<storage, read_write> output: array<mat4x4<{1}>>;
-@compute @workgroup_size(256)
+{1}@compute @workgroup_size(256)
 fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
     let i: u32 = global_id.x;
-    if (i < {2}) {{
-        output[i] = input1[i] {3} input2[i];
+    if (i < {4}) {{
+        let tileColumns = {5};
+        let rows = {6};
+        let columns = {7};
+        let tile = i >> 2;
+        let row = ((tile / tileColumns) << 2) + (i & 3);
+        let column = (tile % tileColumns) << 2;
+        {2}[i] = pack4({3});
     }}
 }}
 )",
-                WgslFeatures(), WgslElementType(), N, op);
-            auto parameters = std::vector<Parameter> {
-                { GetBuffer(), BufferSize() },
-                { other.GetBuffer(), other.BufferSize() },
-                { output.GetBuffer(), output.BufferSize() },
-            };
-            webgpu::Run(code, { parameters.begin(), parameters.end() }, N, 256);
+                WgslPrelude(), bindings, outputName, chunkValue, WgslSize(sizeIndex), WgslSize(sizeIndex + 1),
+                WgslSize(sizeIndex + 2), WgslSize(sizeIndex + 3));
+            auto chunkScalars = scalars;
+            for (size_t size : { N, output.m_paddingColumn >> 2, rowEnd - rowBegin, output.m_column }) {
+                chunkScalars.push_back(std::bit_cast<float>(static_cast<uint32_t>(size)));
+            }
+            auto parameters = std::vector<Parameter> {};
+            for (const auto* pInput : inputs) {
+                parameters.push_back(pInput->ChunkParameter(pInput->m_chunks[n]));
+            }
+            if (!isInPlace) {
+                parameters.push_back(output.ChunkParameter(chunk));
+            }
+            webgpu::Run({ label, { output.m_row, output.m_column }, ElementTypeName<T>() }, code,
+                { parameters.begin(), parameters.end() }, N, 256, chunkScalars);
         }
+    }
 
+    // Reduce every row, the result is a row x 1 matrix.
+    WebGpuMatrix ReduceRows(Reduction reduction) const
+    {
+        auto output = WebGpuMatrix { m_row, 1 };
+        ReduceRows(reduction, output);
         return output;
     }
 
-    int IndexInMat4x4ArrayMemory(int row, int column) const
+    // Reduce every row into output, a row x 1 matrix which may have another element type.
+    template <MatrixElementType U>
+    void ReduceRows(Reduction reduction, const WebGpuMatrix<U>& output) const
+    {
+        if (!m_row || !m_column) {
+            return;
+        }
+
+        // The output has much shorter tile rows, so it might be split differently.
+        for (const auto& chunk : m_chunks) {
+            for (const auto& outputChunk : output.m_chunks) {
+                auto tileRowBegin = std::max(chunk.tileRowBegin, outputChunk.tileRowBegin);
+                auto rowEnd = std::min({ ChunkTileRowEnd(chunk) * 4, ChunkTileRowEnd(outputChunk) * 4, m_row });
+                if (tileRowBegin * 4 >= rowEnd) {
+                    continue;
+                }
+
+                auto element = std::format(
+                    "load_input(index(n + {}, k, {}))", (tileRowBegin - chunk.tileRowBegin) * 4, m_paddingColumn >> 2);
+                auto store = std::format("store_output(index(n + {}, 0, 1), {}(partialValues[0]));",
+                    (tileRowBegin - outputChunk.tileRowBegin) * 4, WebGpuMatrix<U>::WgslElementType());
+                RunReduction(reduction == Reduction::Sum ? "RowSum" : "RowMax", reduction, rowEnd - tileRowBegin * 4,
+                    m_column, element, store, WebGpuMatrix<U>::WgslReductionOutput(),
+                    { ChunkParameter(chunk), output.ChunkParameter(outputChunk) });
+            }
+        }
+    }
+
+    // Reduce every column into values (a 1 x column matrix), indices gets the row index of ArgMax.
+    void ReduceColumns(Reduction reduction, const WebGpuMatrix& values, Parameter indices) const
     {
-        return (((row >> 2) * (m_paddingColumn >> 2) + (column >> 2)) << 4) + (((row & 0x3) << 2) + (column & 0x3));
+        if (!m_row || !m_column) {
+            return;
+        }
+
+        // Chunks are reduced one after another, later ones are combined with the result of earlier ones.
+        for (const auto& chunk : m_chunks) {
+            auto [rowBegin, rowEnd] = ChunkRows(chunk);
+            if (rowBegin >= rowEnd) {
+                continue;
+            }
+
+            auto isFirst = &chunk == &m_chunks.front();
+            auto store = std::string {};
+            auto parameters = std::vector<Parameter> {
+                ChunkParameter(chunk),
+                values.ChunkParameter(values.m_chunks[0]),
+            };
+            if (reduction == Reduction::Sum) {
+                // Partial sums are f32, see RunReduction().
+                store = isFirst
+                    ? std::format("store_output(o, {}(partialValues[0]));", WgslElementType())
+                    : std::format("store_output(o, {}(f32(load_output(o)) + partialValues[0]));", WgslElementType());
+            } else if (reduction == Reduction::Max) {
+                store = isFirst ? "store_output(o, partialValues[0]);"
+                                : "store_output(o, max(load_output(o), partialValues[0]));";
+            } else {
+                // Earlier chunks have smaller row indices, so they win a tie.
+                store = std::format(R"(if ({}) {{
+                store_output(o, partialValues[0]);
+                outputIndices[n] = partialIndices[0] + {};
+            }})",
+                    isFirst ? "true" : "partialValues[0] > load_output(o)", rowBegin);
+                parameters.push_back(indices);
+            }
+
+            auto element = std::format("load_input(index(k, n, {}))", m_paddingColumn >> 2);
+            store = std::format("let o = index(0, n, {});\n            {}", values.m_paddingColumn >> 2, store);
+            auto label = reduction == Reduction::Sum ? "ColumnSum"
+                : reduction == Reduction::Max        ? "ColumnMax"
+                                                     : "ArgMax";
+            RunReduction(label, reduction, m_column, rowEnd - rowBegin, element, store, WgslReductionOutput(),
+                std::move(parameters));
+        }
     }
 
-    void MapBuffer(std::function<void(const T*)> callback) const
+    // One workgroup reduces one line (a row or column) at a time: each invocation accumulates a strided part of it,
+    // then the partial results are combined by a tree reduction in workgroup memory. element reads element k of
+    // line n with load_input(), store writes partialValues[0] (and partialIndices[0] for ArgMax) of line n with
+    // store_output() of output, which may combine it with load_output(). Sums are accumulated in f32, so partial values
+    // are f32 for Sum and T otherwise.
+    void RunReduction(const char* label, Reduction reduction, size_t count, size_t length, std::string_view element,
+        std::string_view store, std::string_view output, std::vector<Parameter> parameters) const
     {
-        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        constexpr size_t kWorkgroupSize = 256;
+        constexpr size_t kMaxWorkgroupCount = 65535;
+        auto code = std::format(R"({0}
+@group(0) @binding(0) var<storage, read_write> input: array<stored_element>;
+{9}
+{2}
+var<workgroup> partialValues: array<{1}, {3}>;
+var<workgroup> partialIndices: array<u32, {3}>;
 
-        auto bufferSize = BufferSize();
+{10}
 
-        auto readbackBufferDescriptor = WGPUBufferDescriptor {
-            .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_MapRead,
-            .size = bufferSize,
-        };
+fn index(row: u32, column: u32, tileColumns: u32) -> u32 {{
+    return (((row >> 2) * tileColumns + (column >> 2)) << 4) + ((row & 3) << 2) + (column & 3);
+}}
 
-        auto pReadbackBuffer = gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> { wgpuDeviceCreateBuffer(
-            adapter->GetDevice(), &readbackBufferDescriptor) };
+fn combine(a: u32, b: u32) {{
+    let valueA = partialValues[a];
+    let valueB = partialValues[b];
+    if ({8}) {{
+        partialValues[a] = valueA + valueB;
+    }} else if (valueB > valueA || (valueB == valueA && partialIndices[b] < partialIndices[a])) {{
+        // The smaller index wins a tie, so the first maximum is picked.
+        partialValues[a] = valueB;
+        partialIndices[a] = partialIndices[b];
+    }}
+}}
 
-        auto commandEncoder = wgpuDeviceCreateCommandEncoder(adapter->GetDevice(), nullptr);
-        wgpuCommandEncoderCopyBufferToBuffer(commandEncoder, m_pBuffer.get(), 0, pReadbackBuffer.get(), 0, bufferSize);
-        auto commandBuffer = wgpuCommandEncoderFinish(commandEncoder, nullptr);
+@compute @workgroup_size({3})
+fn main(@builtin(workgroup_id) wid: vec3<u32>, @builtin(local_invocation_id) lid: vec3<u32>,
+    @builtin(num_workgroups) nwg: vec3<u32>) {{
+    for (var n = wid.x; n < {4}; n = n + nwg.x) {{
+        // Sum starts from zero, Max and ArgMax start from an element this invocation would visit anyway.
+        var k = min(lid.x, {5} - 1);
+        var value = select({1}({6}), {1}(0), {8});
+        var valueIndex = k;
+        for (k = lid.x; k < {5}; k = k + {3}) {{
+            let v = {1}({6});
+            if ({8}) {{
+                value = value + v;
+            }} else if (v > value) {{
+                value = v;
+                valueIndex = k;
+            }}
+        }}
+        partialValues[lid.x] = value;
+        partialIndices[lid.x] = valueIndex;
+        workgroupBarrier();
+
+        for (var stride = {3}u / 2; stride > 0; stride = stride / 2) {{
+            if (lid.x < stride) {{
+                combine(lid.x, lid.x + stride);
+            }}
+            workgroupBarrier();
+        }}
+
+        if (lid.x == 0) {{
+            {7}
+        }}
+        workgroupBarrier();
+    }}
+}}
+)",
+            WgslPrelude(), reduction == Reduction::Sum ? "f32" : WgslElementType(),
+            reduction == Reduction::ArgMax ? "@group(0) @binding(2) var<storage, read_write> outputIndices: array<u32>;"
+                                           : "",
+            kWorkgroupSize, count, length, element, store, reduction == Reduction::Sum, output, WgslLoadInput());
+        webgpu::Run({ label, { m_row, m_column }, ElementTypeName<T>() }, code,
+            { parameters.begin(), parameters.end() }, std::min(count, kMaxWorkgroupCount) * kWorkgroupSize,
+            kWorkgroupSize);
+    }
 
-        auto submitPromise = std::promise<WGPUQueueWorkDoneStatus>();
-        auto submitFuture = submitPromise.get_future();
-        wgpuQueueSubmit(adapter->GetQueue(), 1, &commandBuffer);
-        wgpuQueueOnSubmittedWorkDone(adapter->GetQueue(),
-            { .mode = WGPUCallbackMode_AllowProcessEvents,
-                .callback
-                = [](WGPUQueueWorkDoneStatus status, void* userdata1,
-                      void* userdata2) { ((std::promise<WGPUQueueWorkDoneStatus>*)userdata1)->set_value(status); },
-                .userdata1 = &submitPromise });
-        if (auto status = Wait(submitFuture); status != WGPUQueueWorkDoneStatus_Success) {
-            throw std::runtime_error { "wgpuQueueOnSubmittedWorkDone failed." };
-        }
+    // Declaration of the scalars passed to webgpu::Run(), they are bound right after the other parameters. They are
+    // declared as u32, sizes are read as they are and floats are bitcast. Declared as f32, the bits of a size would be
+    // a subnormal float, which may be flushed to zero on the way to the shader.
+    static std::string WgslScalars(size_t binding, size_t count)
+    {
+        return std::format(
+            "@group(0) @binding({}) var<uniform> scalars: array<vec4<u32>, {}>;", binding, (count + 3) / 4);
+    }
 
-        auto mapPromise = std::promise<WGPUMapAsyncStatus>();
-        auto mapFuture = mapPromise.get_future();
-        wgpuBufferMapAsync(pReadbackBuffer.get(), WGPUMapMode_Read, 0, bufferSize,
-            { .mode = WGPUCallbackMode_AllowProcessEvents,
-                .callback = [](WGPUMapAsyncStatus status, struct WGPUStringView message, void* userdata1,
-                                void* userdata2) { ((std::promise<WGPUMapAsyncStatus>*)userdata1)->set_value(status); },
-                .userdata1 = &mapPromise });
-        if (auto status = Wait(mapFuture); status != WGPUMapAsyncStatus_Success) {
-            throw std::runtime_error { "wgpuBufferMapAsync failed." };
-        }
+    static std::string WgslScalar(size_t index)
+    {
+        return std::format("{}(bitcast<f32>(scalars[{}][{}]))", WgslElementType(), index / 4, index % 4);
+    }
 
-        const auto* pMappedData = (T*)wgpuBufferGetConstMappedRange(pReadbackBuffer.get(), 0, bufferSize);
-        callback(pMappedData);
-        wgpuBufferUnmap(pReadbackBuffer.get());
+    // A size passed among the scalars, see WgslScalars().
+    static std::string WgslSize(size_t index)
+    {
+        return std::format("scalars[{}][{}]", index / 4, index % 4);
     }
 
-    template <typename R>
-    R Wait(std::future<R>& future) const
+    // WGSL of the vec4 at index i of the expression, inputs are bound in the order of the given vector and scalars
+    // are appended in the order they are met.
+    static std::string WgslExpression(
+        const Node& node, const std::vector<const WebGpuMatrix*>& inputs, std::vector<float>& scalars)
     {
-        while (future.wait_for(std::chrono::milliseconds {}) != std::future_status::ready) {
-            ProcessGpuInstanceEvents();
+        auto operand = [&](const auto& pNode) { return WgslExpression(*pNode, inputs, scalars); };
+        switch (node.op) {
+        case Node::Op::Input:
+            return std::format("unpack4(input{}[i])", std::ranges::find(inputs, node.pInput) - inputs.begin());
+        case Node::Op::Scalar:
+            scalars.push_back(node.scalar);
+            return WgslScalar(scalars.size() - 1);
+        case Node::Op::Add:
+            return std::format("({} + {})", operand(node.pLhs), operand(node.pRhs));
+        case Node::Op::Sub:
+            return std::format("({} - {})", operand(node.pLhs), operand(node.pRhs));
+        case Node::Op::Mul:
+            return std::format("({} * {})", operand(node.pLhs), operand(node.pRhs));
+        case Node::Op::Sigmoid:
+            return std::format("(1 / (1 + exp(-{})))", operand(node.pLhs));
+        case Node::Op::Relu:
+            return std::format("max({}, vec4<{}>(0.0))", operand(node.pLhs), WgslElementType());
         }
-        return future.get();
+        throw std::runtime_error { "Unknown expression op." };
     }
 
-    size_t m_row {};
-    size_t m_column {};
-    size_t m_paddingRow {};
-    size_t m_paddingColumn {};
-    gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> m_pBuffer {};
-};
+    std::future<void> WriteWithGpuLayoutConversion(std::span<T> data)
+    {
+        // Upload row-major data as it is, then convert it to mat4x4 tiles on GPU, chunk by chunk.
+        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        auto stagings = std::vector<std::shared_ptr<GpuStagingBuffer>> {};
+        for (const auto& chunk : m_chunks) {
+            auto [rowBegin, rowEnd] = ChunkRows(chunk);
+            if (rowBegin >= rowEnd) {
+                continue;
+            }
 
-template <MatrixElementType T>
-WebGpuMatrix<T> ScalarOp(T v, const WebGpuMatrix<T>& m, char op)
-{
-    auto adapter = GpuInstance::GetInstance().GetAdapter();
-    auto vbuffer = adapter->CreateBuffer<T>(1);
+            auto rows = rowEnd - rowBegin;
+            auto rowMajorBufferSize = RowMajorBufferSize(rows);
+            auto rowMajorLease = MemoryLease { MemoryKind::Gpu, rowMajorBufferSize, { rows, m_column } };
+            auto rowMajorBuffer = adapter->CreateBuffer<T>(rows * m_column);
+            auto pStaging = adapter->AcquireUploadBuffer(rowMajorBufferSize);
+            std::memcpy(pStaging->GetMappedRange(rowMajorBufferSize), data.data() + rowBegin * m_column,
+                sizeof(T) * rows * m_column);
+            adapter->Upload(*pStaging, rowMajorBuffer.get(), 0, rowMajorBufferSize);
+
+            // Each invocation writes one row of a mat4x4.
+            size_t N = chunk.tileRowCount * m_paddingColumn;
+            auto code = std::format(R"({0}
+@group(0) @binding(0) var<storage, read_write> input: array<stored_element>;
+@group(0) @binding(1) var<storage, read_write> output: array<stored_vec4>;
+{6}
+@compute @workgroup_size(256)
+fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
+    let i: u32 = global_id.x;
+    if (i < {2}) {{
+        let tile = i >> 2;
+        let row = ((tile / {5}) << 2) + (i & 3);
+        let column = (tile % {5}) << 2;
+        var v = vec4<{1}>(0);
+        if (row < {3}) {{
+            for (var c = 0u; c < 4u && column + c < {4}; c = c + 1u) {{
+                v[c] = load_input(row * {4} + column + c);
+            }}
+        }}
+        output[i] = pack4(v);
+    }}
+}}
+)",
+                WgslPrelude(), WgslElementType(), N, rows, m_column, m_paddingColumn >> 2, WgslLoadInput());
+            auto parameters = std::vector<Parameter> {
+                { rowMajorBuffer.get(), rowMajorBufferSize },
+                ChunkParameter(chunk),
+            };
+            webgpu::Run({ "WriteRetile", { m_row, m_column }, ElementTypeName<T>() }, code,
+                { parameters.begin(), parameters.end() }, N, 256);
+            stagings.push_back(std::move(pStaging));
+        }
+        return std::async(std::launch::deferred, [stagings = std::move(stagings)] {
+            for (const auto& pStaging : stagings) {
+                pStaging->Wait();
+            }
+        });
+    }
 
-    // Buffer need 4 bytes aligned, so always write 4 bytes even it is std::float16_t
-    std::float32_t tmp { v };
-    wgpuQueueWriteBuffer(adapter->GetQueue(), vbuffer.get(), 0, &v, sizeof(tmp));
+    std::future<std::vector<T>> ReadWithGpuLayoutConversion() const
+    {
+        // Convert mat4x4 tiles to row-major on GPU chunk by chunk, then download them as they are.
+        auto adapter = GpuInstance::GetInstance().GetAdapter();
+        auto stagings = std::vector<std::shared_ptr<GpuStagingBuffer>> {};
+        for (const auto& chunk : m_chunks) {
+            auto [rowBegin, rowEnd] = ChunkRows(chunk);
+            if (rowBegin >= rowEnd) {
+                continue;
+            }
 
-    auto output = WebGpuMatrix<T> { m.m_row, m.m_column };
+            auto rows = rowEnd - rowBegin;
+            auto rowMajorLease = MemoryLease { MemoryKind::Gpu, RowMajorBufferSize(rows), { rows, m_column } };
+            auto rowMajorBuffer = adapter->CreateBuffer<T>(rows * m_column);
 
-    // Caculate mat4x4
-    size_t N = (m.m_paddingRow >> 2) * m.m_paddingColumn;
-    auto code = std::format(R"({0}
-@group(0) @binding(0) var<storage, read_write> input1: {1};
-@group(0) @binding(1) var<storage, read_write> input2: array<vec4<{1}>>;
-@group(0) @binding(2) var<storage, read_write> output: array<vec4<{1}>>;
+            // Each invocation reads one row of a mat4x4.
+            size_t N = chunk.tileRowCount * m_paddingColumn;
+            auto code = std::format(R"({0}
+@group(0) @binding(0) var<storage, read_write> input: array<stored_vec4>;
+@group(0) @binding(1) var<storage, read_write> output: array<element>;
 @compute @workgroup_size(256)
 fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {{
     let i: u32 = global_id.x;
     if (i < {2}) {{
-        output[i] = input1 {3} input2[i];
+        let tile = i >> 2;
+        let row = ((tile / {5}) << 2) + (i & 3);
+        let column = (tile % {5}) << 2;
+        if (row < {3}) {{
+            let v = unpack4(input[i]);
+            for (var c = 0u; c < 4u && column + c < {4}; c = c + 1u) {{
+                output[row * {4} + column + c] = v[c];
+            }}
+        }}
     }}
 }}
 )",
-        WebGpuMatrix<T>::WgslFeatures(), WebGpuMatrix<T>::WgslElementType(), N, op);
-    auto parameters = std::vector<Parameter> {
-        { vbuffer.get(), sizeof(std::float32_t) },
-        { m.GetBuffer(), m.BufferSize() },
-        { output.GetBuffer(), output.BufferSize() },
-    };
-    webgpu::Run(code, { parameters.begin(), parameters.end() }, N, 256);
-    return output;
+                WgslPrelude(), WgslElementType(), N, rows, m_column, m_paddingColumn >> 2);
+            auto parameters = std::vector<Parameter> {
+                ChunkParameter(chunk),
+                { rowMajorBuffer.get(), RowMajorBufferSize(rows) },
+            };
+            webgpu::Run({ "ReadUntile", { m_row, m_column }, ElementTypeName<T>() }, code,
+                { parameters.begin(), parameters.end() }, N, 256);
+            stagings.push_back(adapter->Readback(rowMajorBuffer.get(), 0, RowMajorBufferSize(rows)));
+        }
+
+        return std::async(std::launch::deferred, [stagings = std::move(stagings), chunks = ChunkRowRanges(),
+                                                     column = m_column, size = m_row * m_column] {
+            std::vector<T> out(size);
+            for (auto n = 0u; n < stagings.size(); ++n) {
+                // Chunks without rows have no staging buffer, they are at the end.
+                auto [rowBegin, rowEnd] = chunks[n];
+                std::memcpy(out.data() + rowBegin * column, stagings[n]->GetConstMappedRange(),
+                    sizeof(T) * (rowEnd - rowBegin) * column);
+                stagings[n]->Unmap();
+            }
+            return out;
+        });
+    }
+
+    size_t RowMajorBufferSize(size_t rows) const
+    {
+        // Buffer need 4 bytes aligned.
+        return (sizeof(T) * rows * m_column + 3) & ~3;
+    }
+
+    int IndexInMat4x4ArrayMemory(int row, int column) const
+    {
+        return IndexInMat4x4ArrayMemory(row, column, m_paddingColumn);
+    }
+
+    static int IndexInMat4x4ArrayMemory(int row, int column, size_t paddingColumn)
+    {
+        return (((row >> 2) * (paddingColumn >> 2) + (column >> 2)) << 4) + (((row & 0x3) << 2) + (column & 0x3));
+    }
+
+    size_t m_row {};
+    size_t m_column {};
+    size_t m_paddingRow {};
+    size_t m_paddingColumn {};
+    std::vector<Chunk> m_chunks {};
+};
+
+template <MatrixElementType T>
+WebGpuMatrix<T> ScalarOp(T v, const WebGpuMatrix<T>& m, char op)
+{
+    using Node = WebGpuMatrix<T>::Node;
+    auto root = WebGpuMatrix<T>::BinaryNode(
+        op == '-' ? Node::Op::Sub : Node::Op::Mul, WebGpuMatrix<T>::ScalarNode(v), WebGpuMatrix<T>::InputNode(m));
+    return WebGpuMatrix<T>::EvaluateExpression(root, op == '-' ? "ScalarSub" : "ScalarMul");
 }
 
 export template <MatrixElementType T>
@@ -514,4 +1338,4 @@ WebGpuMatrix<T> operator*(T v, const WebGpuMatrix<T>& m)
 {
     return ScalarOp(v, m, '*');
 }
-}
\ No newline at end of file
+}
@@ -0,0 +1,74 @@
+module;
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+export module cpp_matrix:expression;
+
+namespace cpp_matrix {
+
+/// @brief A node of an element-wise expression tree, backends evaluate the whole tree in one pass.
+export template <typename M>
+struct ExpressionNode {
+    enum class Op {
+        Input,
+        Scalar,
+        Add,
+        Sub,
+        Mul,
+        Sigmoid,
+        Relu,
+    };
+
+    Op op {};
+
+    // Only valid for Op::Input, the matrix must outlive the evaluation.
+    const M* pInput {};
+
+    // Only valid for Op::Scalar.
+    float scalar {};
+
+    // Operand of unary ops, left operand of binary ops.
+    std::shared_ptr<const ExpressionNode> pLhs {};
+    std::shared_ptr<const ExpressionNode> pRhs {};
+};
+
+template <typename M>
+void CollectExpressionInputs(const ExpressionNode<M>& node, std::vector<const M*>& inputs)
+{
+    if (node.op == ExpressionNode<M>::Op::Input) {
+        if (std::ranges::find(inputs, node.pInput) == inputs.end()) {
+            inputs.push_back(node.pInput);
+        }
+        return;
+    }
+
+    if (node.pLhs) {
+        CollectExpressionInputs(*node.pLhs, inputs);
+    }
+    if (node.pRhs) {
+        CollectExpressionInputs(*node.pRhs, inputs);
+    }
+}
+
+/// @brief Get the distinct matrices of the expression in the order they are met, they must have the same shape.
+export template <typename M>
+std::vector<const M*> ExpressionInputs(const ExpressionNode<M>& root)
+{
+    auto inputs = std::vector<const M*> {};
+    CollectExpressionInputs(root, inputs);
+    if (inputs.empty()) {
+        throw std::runtime_error { "Expression has no matrix." };
+    }
+
+    for (const auto* pInput : inputs) {
+        if (pInput->Row() != inputs[0]->Row() || pInput->Column() != inputs[0]->Column()) {
+            throw std::runtime_error { "Shape is not the same." };
+        }
+    }
+    return inputs;
+}
+
+}
@@ -0,0 +1,87 @@
+module;
+
+#include <algorithm>
+#include <cstddef>
+#include <format>
+#include <stdexcept>
+
+export module cpp_matrix:loss_scaler;
+
+namespace cpp_matrix {
+
+/// @brief Dynamic loss scaling for training in f16 or bf16, whose small gradients would otherwise flush to zero.
+///
+/// Errors are multiplied by Scale() before backpropagation and the gradients divided by it before the update. A step
+/// whose gradients overflowed (inf or NaN) is skipped and the scale halves, growthInterval steps in a row without
+/// overflow double it again, up to maxScale. The scale never goes below kMinScale: gradients which overflow even
+/// unscaled can't be fixed by scaling, so Update() throws instead of training on with a scale of zero.
+export class LossScaler {
+public:
+    static constexpr float kMinScale = 1;
+
+    explicit LossScaler(float maxScale = 1 << 15, size_t growthInterval = 1000)
+        : m_scale { std::max(maxScale, kMinScale) }
+        , m_maxScale { m_scale }
+        , m_growthInterval { growthInterval }
+    {
+    }
+
+    float Scale() const
+    {
+        return m_scale;
+    }
+
+    size_t SkippedSteps() const
+    {
+        return m_skippedSteps;
+    }
+
+    /// @brief Good steps since the scale last changed, the scale doubles when it reaches growthInterval.
+    size_t StepsWithoutOverflow() const
+    {
+        return m_stepsWithoutOverflow;
+    }
+
+    /// @brief Continue from the state of another scaler with the same policy, e.g. one saved with a checkpoint.
+    void Restore(float scale, size_t stepsWithoutOverflow, size_t skippedSteps)
+    {
+        if (!(scale >= kMinScale && scale <= m_maxScale) || stepsWithoutOverflow >= m_growthInterval) {
+            throw std::runtime_error { std::format(
+                "Invalid loss scaler state: scale {}, {} steps without overflow.", scale, stepsWithoutOverflow) };
+        }
+        m_scale = scale;
+        m_stepsWithoutOverflow = stepsWithoutOverflow;
+        m_skippedSteps = skippedSteps;
+    }
+
+    /// @brief Record whether the gradients of a step are finite, returns true if the step should be applied.
+    bool Update(bool isFinite)
+    {
+        if (!isFinite) {
+            if (m_scale == kMinScale) {
+                throw std::runtime_error { std::format(
+                    "Gradients overflow at the minimum loss scale {}, after {} skipped steps.", kMinScale,
+                    m_skippedSteps) };
+            }
+            m_scale = std::max(m_scale / 2, kMinScale);
+            m_stepsWithoutOverflow = 0;
+            ++m_skippedSteps;
+            return false;
+        }
+
+        if (++m_stepsWithoutOverflow == m_growthInterval) {
+            m_scale = std::min(m_scale * 2, m_maxScale);
+            m_stepsWithoutOverflow = 0;
+        }
+        return true;
+    }
+
+private:
+    float m_scale {};
+    float m_maxScale {};
+    size_t m_growthInterval {};
+    size_t m_stepsWithoutOverflow {};
+    size_t m_skippedSteps {};
+};
+
+}
@@ -1,34 +1,95 @@
 module;
 
+#include <algorithm>
+#include <array>
+#include <future>
+#include <memory>
 #include <span>
 #include <stdexcept>
+#include <string_view>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
 export module cpp_matrix:matrix;
+import :cpu_kernels;
 import :cpu_matrix;
-import :webgpu_matrix;
+import :expression;
+import :matrix_file;
 import :matrix_type;
 import :std_patch;
+import trace;
+#if CPP_MATRIX_WITH_WEBGPU
+import :auto_matrix;
+import :webgpu_matrix;
+#endif
 
 namespace cpp_matrix {
 
+#if CPP_MATRIX_WITH_WEBGPU
+template <typename T>
+concept MatrixBackend = MatrixElementType<typename T::ElementType>
+    && (std::is_same_v<T, backend::CpuMatrix<typename T::ElementType>>
+        || std::is_same_v<T, backend::WebGpuMatrix<typename T::ElementType>>
+        || std::is_same_v<T, backend::AutoMatrix<typename T::ElementType>>);
+
+template <typename M>
+concept IsCpuBackend = std::is_same_v<M, backend::CpuMatrix<typename M::ElementType>>;
+
+template <typename M>
+concept IsWebGpuBackend = std::is_same_v<M, backend::WebGpuMatrix<typename M::ElementType>>;
+
+template <typename M>
+concept IsAutoBackend = std::is_same_v<M, backend::AutoMatrix<typename M::ElementType>>;
+#else
 template <typename T>
-concept MatrixBackend = std::is_same_v<T, backend::CpuMatrix<std::float16_t>>
-    || std::is_same_v<T, backend::CpuMatrix<std::float32_t>> || std::is_same_v<T, backend::WebGpuMatrix<std::float16_t>>
-    || std::is_same_v<T, backend::WebGpuMatrix<std::float32_t>>;
+concept MatrixBackend = MatrixElementType<typename T::ElementType>
+    && std::is_same_v<T, backend::CpuMatrix<typename T::ElementType>>;
+
+template <typename M>
+concept IsCpuBackend = std::is_same_v<M, backend::CpuMatrix<typename M::ElementType>>;
+
+// Without WebGPU there is neither WebGpuMatrix nor AutoMatrix, the members which need them are never available.
+template <typename M>
+concept IsWebGpuBackend = false;
+
+template <typename M>
+concept IsAutoBackend = false;
+#endif
+
+// The backend M with element type U, e.g. backend::CpuMatrix<std::float16_t> for backend::CpuMatrix<float>.
+template <typename M, typename U>
+struct WithElementType;
+
+template <template <MatrixElementType> typename B, MatrixElementType T, MatrixElementType U>
+struct WithElementType<B<T>, U> {
+    using type = B<U>;
+};
+
+template <MatrixBackend M>
+class Expression;
 
 template <MatrixBackend M>
 class Matrix {
 public:
     using ElementType = M::ElementType;
 
+    /// @brief Whether matrices may be used by several threads. WebGPU objects must stay on the thread which uses the
+    /// device, so it is false for the backends which may keep data on the GPU.
+    static constexpr bool kIsThreadSafe = !IsWebGpuBackend<M> && !IsAutoBackend<M>;
+
+    friend class Expression<M>;
     friend Matrix operator-(ElementType v, const Matrix& m);
     friend Matrix operator*(ElementType v, const Matrix& m);
 
+    // Cast() returns a matrix of another element type.
+    template <MatrixBackend>
+    friend class Matrix;
+
     /// @brief Create a matrix with random value (value will be between 0 and 1).
     static Matrix Random(size_t row, size_t column)
     {
+        auto scope = Trace("Random", { row, column }, row * column);
         auto matrix = Matrix { row, column };
         std::vector<ElementType> initData(row * column);
         for (auto& v : initData) {
@@ -38,6 +99,45 @@ public:
         return matrix;
     }
 
+    /// @brief Load a matrix written by Save(). A CpuMatrix borrows the mapped pages, other backends upload from them.
+    ///
+    /// A matrix stored as another element type is converted, which takes a copy on the host.
+    static Matrix Load(const MatrixFile& file, std::string_view name)
+    {
+        const auto& entry = file.GetEntry(name);
+        auto scope = Trace("Load", { entry.row, entry.column }, entry.row * entry.column);
+        if (entry.dataType != DataTypeOf<ElementType>()) {
+            auto data = entry.dataType == MatrixDataType::Float16
+                ? Convert<ElementType, std::float16_t>(file.GetData<std::float16_t>(name))
+                : entry.dataType == MatrixDataType::BFloat16
+                ? Convert<ElementType, std::bfloat16_t>(file.GetData<std::bfloat16_t>(name))
+                : Convert<ElementType, std::float32_t>(file.GetData<std::float32_t>(name));
+            return Matrix { entry.row, entry.column, data };
+        }
+
+        // A mapping of its own, so in place updates of one loaded matrix never reach another load of the same entry.
+        auto [data, pMapping] = file.MapPrivate<ElementType>(name);
+        if constexpr (IsCpuBackend<M>) {
+            return M::Borrow(entry.row, entry.column, data, std::move(pMapping));
+        } else {
+            return Matrix { entry.row, entry.column, data };
+        }
+    }
+
+    /// @brief Compile kernels recorded by previous runs (see GpuInstance::SetPipelineCacheDirectory()) in parallel.
+    static size_t WarmUp()
+        requires IsWebGpuBackend<M>
+    {
+        return M::WarmUp();
+    }
+
+    /// @brief Measure both devices and update the cost model which places every op, see backend::CostModel.
+    static void Calibrate()
+        requires IsAutoBackend<M>
+    {
+        M::Calibrate();
+    }
+
     Matrix()
         : Matrix { 0, 0 }
     {
@@ -54,35 +154,178 @@ public:
         Write(initData);
     }
 
+    /// @brief A matrix which copies the elements of view.
+    explicit Matrix(backend::MatrixView<const ElementType> view)
+        requires IsCpuBackend<M>
+        : m_matrix { view }
+    {
+    }
+
+    /// @brief The elements in place, see backend::MatrixView. Parts of it are passed to backend::CpuKernels without
+    /// copying them.
+    backend::MatrixView<ElementType> View()
+        requires IsCpuBackend<M>
+    {
+        return m_matrix.View();
+    }
+
+    backend::MatrixView<const ElementType> View() const
+        requires IsCpuBackend<M>
+    {
+        return m_matrix.View();
+    }
+
+    /// @brief Hint that the matrix is the left operand of many products, e.g. weights multiplied by every input. The
+    /// CPU backend packs it once for its GEMM kernel and again only after it changes, other backends ignore it.
+    void Pack()
+    {
+        if constexpr (IsCpuBackend<M>) {
+            m_matrix.Pack();
+        }
+    }
+
+    /// @brief Drop the hint set by Pack().
+    void Unpack()
+    {
+        if constexpr (IsCpuBackend<M>) {
+            m_matrix.Unpack();
+        }
+    }
+
     template <size_t N>
     void Write(std::span<ElementType, N> data)
     {
+        auto scope = Trace("Write", { Row(), Column() }, data.size());
         m_matrix.Write(data);
     }
 
+    /// @brief Start to upload data, data can be released once this function returns.
+    template <size_t N>
+    std::future<void> WriteAsync(std::span<ElementType, N> data)
+    {
+        auto scope = Trace("WriteAsync", { Row(), Column() }, data.size());
+        return m_matrix.WriteAsync(data);
+    }
+
     std::vector<ElementType> Read() const
     {
+        auto scope = Trace("Read", { Row(), Column() }, Size());
         return m_matrix.Read();
     }
 
+    /// @brief Start to download the matrix, several downloads can be in flight at the same time.
+    std::future<std::vector<ElementType>> ReadAsync() const
+    {
+        auto scope = Trace("ReadAsync", { Row(), Column() }, Size());
+        return m_matrix.ReadAsync();
+    }
+
+    /// @brief Start to download rows [rowBegin, rowEnd) in row-major layout.
+    std::future<std::vector<ElementType>> ReadRowsAsync(size_t rowBegin, size_t rowEnd) const
+    {
+        auto scope = Trace("ReadRowsAsync", { rowEnd - rowBegin, Column() }, (rowEnd - rowBegin) * Column());
+        return m_matrix.ReadRowsAsync(rowBegin, rowEnd);
+    }
+
+    /// @brief Whether the futures of ReadAsync(), ReadRowsAsync() and ReadBlocksAsync() may be got on another thread,
+    /// even if the matrix itself isn't thread-safe (see kIsThreadSafe).
+    static bool IsReadbackThreadSafe()
+    {
+        return M::IsReadbackThreadSafe();
+    }
+
+    /// @brief Append the matrix to writer as dataType, see MatrixFile. Storing f32 as f16 or bf16 halves the size.
+    ///
+    /// Rows are downloaded and written in blocks of about kSaveBlockByteSize, the next block downloads while one is
+    /// written, so the matrix is never copied to the host as a whole.
+    void Save(MatrixFileWriter& writer, std::string_view name,
+        MatrixDataType dataType = DataTypeOf<ElementType>()) const
+    {
+        auto scope = Trace("Save", { Row(), Column() }, Size());
+        auto blockRows = SaveBlockRows(Column());
+        writer.Begin(name, Row(), Column(), dataType);
+        auto block = ReadRowsAsync(0, std::min(blockRows, Row()));
+        for (auto rowBegin = size_t {}; rowBegin < Row(); rowBegin += blockRows) {
+            auto data = block.get();
+            if (auto next = rowBegin + blockRows; next < Row()) {
+                block = ReadRowsAsync(next, std::min(next + blockRows, Row()));
+            }
+            AppendBlock(writer, data, dataType);
+        }
+        writer.End();
+    }
+
+    /// @brief Start to download every block Save() would write, SaveBlocks() writes them later, e.g. on another
+    /// thread. The copies are queued now, so later changes of the matrix don't affect them.
+    std::vector<std::future<std::vector<ElementType>>> ReadBlocksAsync() const
+    {
+        auto scope = Trace("ReadBlocksAsync", { Row(), Column() }, Size());
+        auto blockRows = SaveBlockRows(Column());
+        auto blocks = std::vector<std::future<std::vector<ElementType>>> {};
+        for (auto rowBegin = size_t {}; rowBegin < Row(); rowBegin += blockRows) {
+            blocks.push_back(m_matrix.ReadRowsAsync(rowBegin, std::min(rowBegin + blockRows, Row())));
+        }
+        return blocks;
+    }
+
+    /// @brief Append a row x column matrix to writer as dataType from the blocks of ReadBlocksAsync(). It only gets
+    /// their futures, so it may run on another thread if IsReadbackThreadSafe().
+    static void SaveBlocks(MatrixFileWriter& writer, std::string_view name, size_t row, size_t column,
+        std::vector<std::future<std::vector<ElementType>>> blocks, MatrixDataType dataType = DataTypeOf<ElementType>())
+    {
+        writer.Begin(name, row, column, dataType);
+        for (auto& block : blocks) {
+            AppendBlock(writer, block.get(), dataType);
+        }
+        writer.End();
+    }
+
+    /// @brief Number of elements in the backend's internal tiled layout (padded to mat4x4 tiles).
+    size_t TiledSize() const
+        requires IsWebGpuBackend<M>
+    {
+        return m_matrix.TiledSize();
+    }
+
+    /// @brief Upload data which is already in the backend's internal tiled layout, skipping any conversion.
+    template <size_t N>
+    std::future<void> WriteTiledAsync(std::span<ElementType, N> data)
+        requires IsWebGpuBackend<M>
+    {
+        auto scope = Trace("WriteTiledAsync", { Row(), Column() }, data.size());
+        return m_matrix.WriteTiledAsync(data);
+    }
+
+    /// @brief Download the matrix in the backend's internal tiled layout, skipping any conversion.
+    std::future<std::vector<ElementType>> ReadTiledAsync() const
+        requires IsWebGpuBackend<M>
+    {
+        auto scope = Trace("ReadTiledAsync", { Row(), Column() }, Size());
+        return m_matrix.ReadTiledAsync();
+    }
+
     Matrix operator+(const Matrix& other) const
     {
+        auto scope = Trace("Add", { Row(), Column() }, 3 * Size());
         return m_matrix + other.m_matrix;
     }
 
     Matrix& operator+=(const Matrix& other)
     {
+        auto scope = Trace("AddInPlace", { Row(), Column() }, 3 * Size());
         m_matrix += other.m_matrix;
         return *this;
     }
 
     Matrix operator-(const Matrix& other) const
     {
+        auto scope = Trace("Sub", { Row(), Column() }, 3 * Size());
         return m_matrix - other.m_matrix;
     }
 
     Matrix operator+(ElementType v) const
     {
+        auto scope = Trace("AddScalar", { Row(), Column() }, 2 * Size());
         return m_matrix + v;
     }
 
@@ -93,6 +336,8 @@ public:
 
     Matrix operator*(const Matrix& other) const
     {
+        auto elements = Size() + other.Size() + Row() * other.Column();
+        auto scope = Trace("MatMul", { Row(), Column(), other.Column() }, elements);
         return m_matrix * other.m_matrix;
     }
 
@@ -108,6 +353,7 @@ public:
 
     Matrix& operator=(std::vector<ElementType> data)
     {
+        auto scope = Trace("Assign", { 1, data.size() }, data.size());
         m_matrix = std::move(data);
         return *this;
     }
@@ -124,21 +370,34 @@ public:
 
     Matrix Transpose() const
     {
+        auto scope = Trace("Transpose", { Row(), Column() }, 2 * Size());
         return m_matrix.Transpose();
     }
 
+    /// @brief A copy converted to element type U on the same backend, e.g. f16 working copies of f32 weights. The data
+    /// doesn't leave the device.
+    template <MatrixElementType U>
+    Matrix<typename WithElementType<M, U>::type> Cast() const
+    {
+        auto scope = Trace("Cast", { Row(), Column() }, 2 * Size());
+        return m_matrix.template Cast<U>();
+    }
+
     Matrix Sigmoid() const
     {
+        auto scope = Trace("Sigmoid", { Row(), Column() }, 2 * Size());
         return m_matrix.Sigmoid();
     }
 
     Matrix ElementProduct(const Matrix& other) const
     {
+        auto scope = Trace("ElementProduct", { Row(), Column() }, 3 * Size());
         return m_matrix.ElementProduct(other.m_matrix);
     }
 
     Matrix Relu() const
     {
+        auto scope = Trace("Relu", { Row(), Column() }, 2 * Size());
         return m_matrix.Relu();
     }
 
@@ -147,59 +406,363 @@ public:
         return m_matrix[row, column];
     }
 
+    /// @brief Sum of each row, the result is a row x 1 matrix.
+    Matrix RowSum() const
+    {
+        auto scope = Trace("RowSum", { Row(), Column() }, Size() + Row());
+        return m_matrix.RowSum();
+    }
+
+    /// @brief Sum of each column, the result is a 1 x column matrix.
+    Matrix ColumnSum() const
+    {
+        auto scope = Trace("ColumnSum", { Row(), Column() }, Size() + Column());
+        return m_matrix.ColumnSum();
+    }
+
+    /// @brief Sum of all elements, the result is a 1 x 1 matrix, so it stays on the backend until it is read.
+    Matrix Sum() const
+    {
+        auto scope = Trace("Sum", { Row(), Column() }, Size() + 1);
+        return m_matrix.Sum();
+    }
+
+    /// @brief Maximum of all elements, the result is a 1 x 1 matrix.
+    Matrix Max() const
+    {
+        auto scope = Trace("Max", { Row(), Column() }, Size() + 1);
+        return m_matrix.Max();
+    }
+
+    /// @brief Row index of the maximum of each column (e.g. the predicted class of each sample in a batch).
+    std::vector<size_t> ArgMax() const
+    {
+        auto scope = Trace("ArgMax", { Row(), Column() }, Size() + Column());
+        return m_matrix.ArgMax();
+    }
+
+    /// @brief Start to compute ArgMax(), only the indices are downloaded.
+    std::future<std::vector<size_t>> ArgMaxAsync() const
+    {
+        auto scope = Trace("ArgMaxAsync", { Row(), Column() }, Size() + Column());
+        return m_matrix.ArgMaxAsync();
+    }
+
+    /// @brief Start an element-wise expression, see Expression.
+    Expression<M> Fuse() const
+    {
+        return *this;
+    }
+
 private:
     Matrix(M m)
         : m_matrix { std::move(m) }
     {
     }
 
+    static constexpr const char* BackendName()
+    {
+        if constexpr (IsWebGpuBackend<M>) {
+            return "WebGpu";
+        } else if constexpr (IsAutoBackend<M>) {
+            return "Auto";
+        } else {
+            return "Cpu";
+        }
+    }
+
+    // Block size of Save(), big enough to keep the disk busy and small enough to keep host memory low.
+    static constexpr size_t kSaveBlockByteSize = 1 << 20;
+
+    static size_t SaveBlockRows(size_t column)
+    {
+        return std::max<size_t>(kSaveBlockByteSize / (sizeof(ElementType) * std::max<size_t>(column, 1)), 1);
+    }
+
+    static void AppendBlock(MatrixFileWriter& writer, std::span<const ElementType> data, MatrixDataType dataType)
+    {
+        if (dataType == DataTypeOf<ElementType>()) {
+            writer.Append(data);
+        } else if (dataType == MatrixDataType::Float16) {
+            writer.Append(std::span<const std::float16_t> { Convert<std::float16_t, ElementType>(data) });
+        } else if (dataType == MatrixDataType::BFloat16) {
+            writer.Append(std::span<const std::bfloat16_t> { Convert<std::bfloat16_t, ElementType>(data) });
+        } else {
+            writer.Append(std::span<const std::float32_t> { Convert<std::float32_t, ElementType>(data) });
+        }
+    }
+
+    template <typename To, typename From>
+    static std::vector<To> Convert(std::span<const From> data)
+    {
+        auto out = std::vector<To>(data.size());
+        // f16 and bf16 don't convert to each other directly, f32 holds both exactly.
+        std::ranges::transform(data, out.begin(), [](From v) { return (To)(float)v; });
+        return out;
+    }
+
+    static trace::TraceArgs TraceArgs(std::array<size_t, 3> shape, size_t elements)
+    {
+        return {
+            .shape = shape,
+            .dtype = ElementTypeName<ElementType>(),
+            .backend = BackendName(),
+            .bytes = elements * sizeof(ElementType),
+        };
+    }
+
+    // A span of op, elements estimates the traffic: every operand read and the result written once. Tracing is off by
+    // default, which makes it one branch.
+    static trace::TraceScope Trace(const char* op, std::array<size_t, 3> shape, size_t elements)
+    {
+        return trace::TraceScope { "matrix", op, TraceArgs(shape, elements) };
+    }
+
+    size_t Size() const
+    {
+        return Row() * Column();
+    }
+
     M m_matrix {};
 };
 
+/// @brief An element-wise expression of matrices, Evaluate() computes it in one pass without intermediate matrices.
+///
+/// On WebGPU the whole expression is one dispatch. Unlike Matrix, operator* is the element-wise product. It refers
+/// to its matrices, so evaluate it before the end of the full-expression which creates temporary operands, e.g.
+///
+///     auto gradients = (errors.Fuse() * outputs * (1.0f - outputs.Fuse())).Evaluate();
+export template <MatrixBackend M>
+class Expression {
+public:
+    using ElementType = M::ElementType;
+
+    Expression(const Matrix<M>& m)
+        : m_pNode { std::make_shared<const Node>(Node { .op = Op::Input, .pInput = &m.m_matrix }) }
+    {
+    }
+
+    Matrix<M> Evaluate() const
+    {
+        // The shape is only known once it is evaluated.
+        auto scope = trace::TraceScope { "matrix", "Fused" };
+        auto result = Matrix<M> { M::Evaluate(*m_pNode) };
+        scope.SetArgs(Matrix<M>::TraceArgs({ result.Row(), result.Column() }, result.Size()));
+        return result;
+    }
+
+    /// @brief Evaluate into the storage of out, which may be one of the matrices of the expression, e.g. an update in
+    /// place without allocating:
+    ///
+    ///     (weights.Fuse() + lr * gradients.Fuse()).Evaluate(weights);
+    void Evaluate(Matrix<M>& out) const
+    {
+        auto scope = trace::TraceScope { "matrix", "FusedInPlace",
+            Matrix<M>::TraceArgs({ out.Row(), out.Column() }, out.Size()) };
+        M::Evaluate(*m_pNode, out.m_matrix);
+    }
+
+    Expression Sigmoid() const
+    {
+        return Unary(Op::Sigmoid, *this);
+    }
+
+    Expression Relu() const
+    {
+        return Unary(Op::Relu, *this);
+    }
+
+    friend Expression operator+(const Expression& lhs, const Expression& rhs)
+    {
+        return Binary(Op::Add, lhs, rhs);
+    }
+
+    friend Expression operator-(const Expression& lhs, const Expression& rhs)
+    {
+        return Binary(Op::Sub, lhs, rhs);
+    }
+
+    friend Expression operator*(const Expression& lhs, const Expression& rhs)
+    {
+        return Binary(Op::Mul, lhs, rhs);
+    }
+
+    friend Expression operator+(const Expression& lhs, ElementType v)
+    {
+        return Binary(Op::Add, lhs, Scalar(v));
+    }
+
+    friend Expression operator+(ElementType v, const Expression& rhs)
+    {
+        return Binary(Op::Add, Scalar(v), rhs);
+    }
+
+    friend Expression operator-(const Expression& lhs, ElementType v)
+    {
+        return Binary(Op::Sub, lhs, Scalar(v));
+    }
+
+    friend Expression operator-(ElementType v, const Expression& rhs)
+    {
+        return Binary(Op::Sub, Scalar(v), rhs);
+    }
+
+    friend Expression operator*(const Expression& lhs, ElementType v)
+    {
+        return Binary(Op::Mul, lhs, Scalar(v));
+    }
+
+    friend Expression operator*(ElementType v, const Expression& rhs)
+    {
+        return Binary(Op::Mul, Scalar(v), rhs);
+    }
+
+private:
+    using Node = ExpressionNode<M>;
+    using Op = Node::Op;
+
+    Expression(std::shared_ptr<const Node> pNode)
+        : m_pNode { std::move(pNode) }
+    {
+    }
+
+    static Expression Scalar(ElementType v)
+    {
+        return std::make_shared<const Node>(Node { .op = Op::Scalar, .scalar = static_cast<float>(v) });
+    }
+
+    static Expression Unary(Op op, const Expression& operand)
+    {
+        return std::make_shared<const Node>(Node { .op = op, .pLhs = operand.m_pNode });
+    }
+
+    static Expression Binary(Op op, const Expression& lhs, const Expression& rhs)
+    {
+        return std::make_shared<const Node>(Node { .op = op, .pLhs = lhs.m_pNode, .pRhs = rhs.m_pNode });
+    }
+
+    std::shared_ptr<const Node> m_pNode {};
+};
+
 export template <MatrixElementType T>
 using CpuMatrix = Matrix<backend::CpuMatrix<T>>;
 
-export template <MatrixElementType T>
-using WebGpuMatrix = Matrix<backend::WebGpuMatrix<T>>;
 
 CpuMatrix<std::float16_t> operator-(std::float16_t v, const CpuMatrix<std::float16_t>& m)
 {
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
     return operator-(v, m.m_matrix);
 }
 
 CpuMatrix<std::float32_t> operator-(std::float32_t v, const CpuMatrix<std::float32_t>& m)
 {
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator-(v, m.m_matrix);
+}
+
+CpuMatrix<std::bfloat16_t> operator-(std::bfloat16_t v, const CpuMatrix<std::bfloat16_t>& m)
+{
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
     return operator-(v, m.m_matrix);
 }
 
 CpuMatrix<std::float16_t> operator*(std::float16_t v, const CpuMatrix<std::float16_t>& m)
 {
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
     return operator*(v, m.m_matrix);
 }
 
 CpuMatrix<std::float32_t> operator*(std::float32_t v, const CpuMatrix<std::float32_t>& m)
 {
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator*(v, m.m_matrix);
+}
+
+CpuMatrix<std::bfloat16_t> operator*(std::bfloat16_t v, const CpuMatrix<std::bfloat16_t>& m)
+{
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
     return operator*(v, m.m_matrix);
 }
 
+#if CPP_MATRIX_WITH_WEBGPU
+export template <MatrixElementType T>
+using WebGpuMatrix = Matrix<backend::WebGpuMatrix<T>>;
+
+export template <MatrixElementType T>
+using AutoMatrix = Matrix<backend::AutoMatrix<T>>;
+
 WebGpuMatrix<std::float16_t> operator-(std::float16_t v, const WebGpuMatrix<std::float16_t>& m)
 {
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
     return operator-(v, m.m_matrix);
 }
 
 WebGpuMatrix<std::float32_t> operator-(std::float32_t v, const WebGpuMatrix<std::float32_t>& m)
 {
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator-(v, m.m_matrix);
+}
+
+WebGpuMatrix<std::bfloat16_t> operator-(std::bfloat16_t v, const WebGpuMatrix<std::bfloat16_t>& m)
+{
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
     return operator-(v, m.m_matrix);
 }
 
 WebGpuMatrix<std::float16_t> operator*(std::float16_t v, const WebGpuMatrix<std::float16_t>& m)
 {
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
     return operator*(v, m.m_matrix);
 }
 
 WebGpuMatrix<std::float32_t> operator*(std::float32_t v, const WebGpuMatrix<std::float32_t>& m)
 {
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator*(v, m.m_matrix);
+}
+
+WebGpuMatrix<std::bfloat16_t> operator*(std::bfloat16_t v, const WebGpuMatrix<std::bfloat16_t>& m)
+{
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator*(v, m.m_matrix);
+}
+
+
+AutoMatrix<std::float16_t> operator-(std::float16_t v, const AutoMatrix<std::float16_t>& m)
+{
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator-(v, m.m_matrix);
+}
+
+AutoMatrix<std::float32_t> operator-(std::float32_t v, const AutoMatrix<std::float32_t>& m)
+{
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator-(v, m.m_matrix);
+}
+
+AutoMatrix<std::bfloat16_t> operator-(std::bfloat16_t v, const AutoMatrix<std::bfloat16_t>& m)
+{
+    auto scope = m.Trace("ScalarSub", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator-(v, m.m_matrix);
+}
+
+AutoMatrix<std::float16_t> operator*(std::float16_t v, const AutoMatrix<std::float16_t>& m)
+{
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator*(v, m.m_matrix);
+}
+
+AutoMatrix<std::float32_t> operator*(std::float32_t v, const AutoMatrix<std::float32_t>& m)
+{
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
+    return operator*(v, m.m_matrix);
+}
+
+AutoMatrix<std::bfloat16_t> operator*(std::bfloat16_t v, const AutoMatrix<std::bfloat16_t>& m)
+{
+    auto scope = m.Trace("ScalarMul", { m.Row(), m.Column() }, 2 * m.Size());
     return operator*(v, m.m_matrix);
 }
+#endif
 
 }
\ No newline at end of file
@@ -0,0 +1,441 @@
+module;
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <unistd.h>
+#include <vector>
+
+export module cpp_matrix:matrix_file;
+import :matrix_type;
+import :std_patch;
+
+namespace cpp_matrix {
+
+export enum class MatrixDataType : uint32_t {
+    Float32,
+    Float16,
+    BFloat16,
+};
+
+export enum class MatrixLayout : uint32_t {
+    RowMajor,
+};
+
+/// @brief A matrix stored in a MatrixFile, offset and byteSize locate its payload in the file.
+export struct MatrixFileEntry {
+    std::string name {};
+    size_t row {};
+    size_t column {};
+    MatrixDataType dataType {};
+    MatrixLayout layout {};
+    size_t offset {};
+    size_t byteSize {};
+    uint64_t checksum {};
+};
+
+/// @brief The MatrixDataType which stores T as is.
+export template <MatrixElementType T>
+constexpr MatrixDataType DataTypeOf()
+{
+    if constexpr (std::is_same_v<T, std::float16_t>) {
+        return MatrixDataType::Float16;
+    } else if constexpr (std::is_same_v<T, std::bfloat16_t>) {
+        return MatrixDataType::BFloat16;
+    } else {
+        return MatrixDataType::Float32;
+    }
+}
+
+// Little endian, the same as every target of the library.
+//
+//   FileHeader                 64 bytes
+//   payload of each matrix     each starts at a multiple of kPayloadAlignment
+//   directory                  per matrix: EntryHeader, then its name padded to 8 bytes
+struct FileHeader {
+    char magic[8] {};
+    uint32_t version {};
+    uint32_t entryCount {};
+    uint64_t directoryOffset {};
+    uint64_t directorySize {};
+    uint32_t alignment {};
+    uint8_t reserved[28] {};
+};
+static_assert(sizeof(FileHeader) == 64);
+
+struct EntryHeader {
+    uint64_t row {};
+    uint64_t column {};
+    uint32_t dataType {};
+    uint32_t layout {};
+    uint64_t offset {};
+    uint64_t byteSize {};
+    uint64_t checksum {};
+    uint32_t nameSize {};
+    uint32_t reserved {};
+};
+static_assert(sizeof(EntryHeader) == 56);
+
+constexpr char kMagic[8] = { 'C', 'P', 'P', 'M', 'A', 'T', 'R', 'X' };
+constexpr uint32_t kVersion = 1;
+
+// A cache line, and a multiple of the vector width of every target.
+constexpr size_t kPayloadAlignment = 64;
+
+constexpr size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+constexpr uint64_t kChecksumSeed = 14695981039346656037ull;
+
+// FNV-1a, good enough to catch truncated or corrupted files. Pass the checksum of the previous bytes as hash to
+// continue it.
+uint64_t Checksum(std::span<const std::byte> bytes, uint64_t hash = kChecksumSeed)
+{
+    for (auto byte : bytes) {
+        hash = (hash ^ (uint64_t)byte) * 1099511628211ull;
+    }
+    return hash;
+}
+
+size_t ElementSize(MatrixDataType dataType)
+{
+    return dataType == MatrixDataType::Float32 ? 4 : 2;
+}
+
+/// @brief Writes matrices into a new MatrixFile, see MatrixFile.
+///
+/// Payloads are streamed to disk as they are added. The file only appears at path once Close() succeeds, so readers
+/// never see a partial file.
+export class MatrixFileWriter {
+public:
+    MatrixFileWriter(std::filesystem::path path)
+        : m_path { std::move(path) }
+        , m_tmpPath { m_path }
+    {
+        m_tmpPath += std::format(".{}.tmp", getpid());
+        m_out.open(m_tmpPath, std::ios::binary | std::ios::trunc);
+        auto header = FileHeader {};
+        m_out.write((const char*)&header, sizeof(header));
+        m_size = sizeof(header);
+        if (!m_out) {
+            throw std::runtime_error { std::format("Can't create {}.", m_tmpPath.string()) };
+        }
+    }
+
+    MatrixFileWriter(const MatrixFileWriter&) = delete;
+    MatrixFileWriter& operator=(const MatrixFileWriter&) = delete;
+
+    ~MatrixFileWriter()
+    {
+        if (m_out.is_open()) {
+            m_out.close();
+            std::error_code ec {};
+            std::filesystem::remove(m_tmpPath, ec);
+        }
+    }
+
+    /// @brief Append a row x column matrix in row-major order, names must be unique.
+    template <MatrixElementType T>
+    void Add(std::string_view name, size_t row, size_t column, std::span<const T> data)
+    {
+        if (row * column != data.size()) {
+            throw std::runtime_error { "Elements size is not the same." };
+        }
+
+        Begin(name, row, column, DataTypeOf<T>());
+        Append(data);
+        End();
+    }
+
+    /// @brief Start a row x column matrix of dataType, its rows are then passed to Append() in order and End()
+    /// finishes it. Unlike Add(), the whole matrix never has to be in memory.
+    void Begin(std::string_view name, size_t row, size_t column, MatrixDataType dataType)
+    {
+        if (m_isAppending) {
+            throw std::runtime_error { "The previous matrix is not ended." };
+        }
+        if (std::ranges::any_of(m_entries, [&](const auto& entry) { return entry.name == name; })) {
+            throw std::runtime_error { std::format("Matrix {} is already added.", name) };
+        }
+
+        Pad(kPayloadAlignment);
+        m_entries.push_back(
+            { std::string { name }, row, column, dataType, MatrixLayout::RowMajor, m_size, 0, kChecksumSeed });
+        m_isAppending = true;
+    }
+
+    /// @brief Append the next elements of the matrix started by Begin(), T must be its element type.
+    template <MatrixElementType T>
+    void Append(std::span<const T> data)
+    {
+        if (!m_isAppending || m_entries.back().dataType != DataTypeOf<T>()) {
+            throw std::runtime_error { "No matrix of this element type is started." };
+        }
+
+        auto& entry = m_entries.back();
+        auto bytes = std::as_bytes(data);
+        if (entry.byteSize + bytes.size() > entry.row * entry.column * sizeof(T)) {
+            throw std::runtime_error { std::format("Too many elements for matrix {}.", entry.name) };
+        }
+        entry.byteSize += bytes.size();
+        entry.checksum = Checksum(bytes, entry.checksum);
+        Write(bytes);
+    }
+
+    void End()
+    {
+        if (!m_isAppending) {
+            throw std::runtime_error { "No matrix is started." };
+        }
+
+        const auto& entry = m_entries.back();
+        if (entry.byteSize != entry.row * entry.column * ElementSize(entry.dataType)) {
+            throw std::runtime_error { "Elements size is not the same." };
+        }
+        m_isAppending = false;
+    }
+
+    /// @brief Write the directory and move the file to its path.
+    void Close()
+    {
+        if (m_isAppending) {
+            throw std::runtime_error { "The last matrix is not ended." };
+        }
+
+        Pad(8);
+        auto header = FileHeader {
+            .version = kVersion,
+            .entryCount = (uint32_t)m_entries.size(),
+            .directoryOffset = m_size,
+            .alignment = kPayloadAlignment,
+        };
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        for (const auto& entry : m_entries) {
+            auto entryHeader = EntryHeader {
+                .row = entry.row,
+                .column = entry.column,
+                .dataType = (uint32_t)entry.dataType,
+                .layout = (uint32_t)entry.layout,
+                .offset = entry.offset,
+                .byteSize = entry.byteSize,
+                .checksum = entry.checksum,
+                .nameSize = (uint32_t)entry.name.size(),
+            };
+            Write(std::as_bytes(std::span { &entryHeader, 1 }));
+            Write(std::as_bytes(std::span { entry.name }));
+            Pad(8);
+        }
+        header.directorySize = m_size - header.directoryOffset;
+
+        m_out.seekp(0);
+        m_out.write((const char*)&header, sizeof(header));
+        m_out.close();
+        if (!m_out) {
+            throw std::runtime_error { std::format("Can't write {}.", m_tmpPath.string()) };
+        }
+        std::filesystem::rename(m_tmpPath, m_path);
+    }
+
+private:
+    void Write(std::span<const std::byte> bytes)
+    {
+        m_out.write((const char*)bytes.data(), bytes.size());
+        m_size += bytes.size();
+    }
+
+    void Pad(size_t alignment)
+    {
+        static constexpr std::byte kZeros[kPayloadAlignment] {};
+        Write({ kZeros, AlignUp(m_size, alignment) - m_size });
+    }
+
+    std::filesystem::path m_path {};
+    std::filesystem::path m_tmpPath {};
+    std::ofstream m_out {};
+    size_t m_size {};
+    std::vector<MatrixFileEntry> m_entries {};
+    bool m_isAppending {};
+};
+
+/// @brief A file of named matrices, mapped into memory so matrices are used in place rather than read.
+///
+/// The file is mapped read-only, so GetData() and Verify() always see what is on disk. Matrix::Load() gives each
+/// matrix its own private mapping of its payload (see MapPrivate()): a CpuMatrix borrows it and other backends upload
+/// straight from it. The page cache is shared by every mapping of the file, and a page is only copied once a matrix
+/// writes it (e.g. by training), so matrices loaded from the same entry never see each other's updates. Mapped data
+/// stays valid while any copy of the MatrixFile, or a matrix borrowing from it, is alive.
+export class MatrixFile {
+public:
+    MatrixFile() = default;
+
+    static MatrixFile Open(const std::filesystem::path& path)
+    {
+        auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error { std::format("Can't open {}.", path.string()) };
+        }
+
+        // The descriptor stays open for MapPrivate(), so it maps the same file even if path is replaced later.
+        auto closeFile = [](const int* pFd) {
+            close(*pFd);
+            delete pFd;
+        };
+        auto pFile = std::shared_ptr<const int> { new int { fd }, closeFile };
+        struct stat st {};
+        auto size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+        auto* pAddress = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (pAddress == MAP_FAILED) {
+            throw std::runtime_error { std::format("Can't map {}.", path.string()) };
+        }
+
+        auto file = MatrixFile {};
+        file.m_pFile = std::move(pFile);
+        file.m_pMapping
+            = std::shared_ptr<std::byte> { (std::byte*)pAddress, [size](std::byte* p) { munmap(p, size); } };
+        file.m_size = size;
+        file.ParseDirectory(path);
+        return file;
+    }
+
+    const std::vector<MatrixFileEntry>& GetEntries() const
+    {
+        return m_entries;
+    }
+
+    const MatrixFileEntry& GetEntry(std::string_view name) const
+    {
+        auto it = std::ranges::find(m_entries, name, &MatrixFileEntry::name);
+        if (it == m_entries.end()) {
+            throw std::runtime_error { std::format("Matrix {} is not in the file.", name) };
+        }
+        return *it;
+    }
+
+    /// @brief Mapped elements of a matrix, T must be its element type.
+    template <MatrixElementType T>
+    std::span<const T> GetData(std::string_view name) const
+    {
+        const auto& entry = CheckedEntry<T>(name);
+        return { (const T*)(m_pMapping.get() + entry.offset), entry.row * entry.column };
+    }
+
+    /// @brief Writable elements of a matrix in a mapping of their own, T must be its element type.
+    ///
+    /// Pages are shared with the page cache until they are written, writes reach neither the file nor any other
+    /// mapping. The returned pointer keeps the mapping alive, e.g. for CpuMatrix::Borrow().
+    template <MatrixElementType T>
+    std::pair<std::span<T>, std::shared_ptr<const void>> MapPrivate(std::string_view name) const
+    {
+        const auto& entry = CheckedEntry<T>(name);
+
+        // mmap() takes a page aligned offset, payloads are only aligned to kPayloadAlignment.
+        auto pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        auto begin = entry.offset / pageSize * pageSize;
+        auto size = std::max<size_t>(entry.offset - begin + entry.byteSize, 1);
+        auto* pAddress = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, *m_pFile, (off_t)begin);
+        if (pAddress == MAP_FAILED) {
+            throw std::runtime_error { std::format("Can't map matrix {}.", name) };
+        }
+
+        auto pMapping = std::shared_ptr<std::byte> { (std::byte*)pAddress, [size](std::byte* p) { munmap(p, size); } };
+        auto* pData = (T*)(pMapping.get() + (entry.offset - begin));
+        return { std::span<T> { pData, entry.row * entry.column }, std::move(pMapping) };
+    }
+
+    /// @brief Check payloads against their checksums. It reads every page, so it is not done by Open().
+    bool Verify() const
+    {
+        return std::ranges::all_of(m_entries, [&](const auto& entry) {
+            return Checksum({ m_pMapping.get() + entry.offset, entry.byteSize }) == entry.checksum;
+        });
+    }
+
+private:
+    template <MatrixElementType T>
+    const MatrixFileEntry& CheckedEntry(std::string_view name) const
+    {
+        const auto& entry = GetEntry(name);
+        if (entry.dataType != DataTypeOf<T>()) {
+            throw std::runtime_error { std::format("Matrix {} has another element type.", name) };
+        }
+        return entry;
+    }
+
+    void ParseDirectory(const std::filesystem::path& path)
+    {
+        auto fail = [&](std::string_view reason) {
+            throw std::runtime_error { std::format("{} is not a valid matrix file ({}).", path.string(), reason) };
+        };
+
+        auto header = FileHeader {};
+        if (m_size < sizeof(header)) {
+            fail("too small");
+        }
+        std::memcpy(&header, m_pMapping.get(), sizeof(header));
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) || header.version != kVersion) {
+            fail("unknown magic or version");
+        }
+        if (header.directoryOffset > m_size || header.directorySize > m_size - header.directoryOffset) {
+            fail("directory is out of the file");
+        }
+
+        auto offset = (size_t)header.directoryOffset;
+        auto end = offset + header.directorySize;
+        for (auto i = 0u; i < header.entryCount; ++i) {
+            auto entryHeader = EntryHeader {};
+            if (end - offset < sizeof(entryHeader)) {
+                fail("directory is truncated");
+            }
+            std::memcpy(&entryHeader, m_pMapping.get() + offset, sizeof(entryHeader));
+            offset += sizeof(entryHeader);
+            if (end - offset < entryHeader.nameSize) {
+                fail("directory is truncated");
+            }
+
+            auto& entry = m_entries.emplace_back(MatrixFileEntry {
+                .name = { (const char*)m_pMapping.get() + offset, entryHeader.nameSize },
+                .row = entryHeader.row,
+                .column = entryHeader.column,
+                .dataType = (MatrixDataType)entryHeader.dataType,
+                .layout = (MatrixLayout)entryHeader.layout,
+                .offset = entryHeader.offset,
+                .byteSize = entryHeader.byteSize,
+                .checksum = entryHeader.checksum,
+            });
+            offset = std::min(AlignUp(offset + entryHeader.nameSize, 8), end);
+
+            if (entryHeader.dataType > (uint32_t)MatrixDataType::BFloat16
+                || entryHeader.layout != (uint32_t)MatrixLayout::RowMajor) {
+                fail("unknown element type or layout");
+            }
+            if (entry.offset % kPayloadAlignment || entry.offset > m_size || entry.byteSize > m_size - entry.offset
+                || entry.byteSize != entry.row * entry.column * ElementSize(entry.dataType)) {
+                fail(std::format("payload of {} is out of the file", entry.name));
+            }
+        }
+    }
+
+    std::shared_ptr<const int> m_pFile {};
+    std::shared_ptr<std::byte> m_pMapping {};
+    size_t m_size {};
+    std::vector<MatrixFileEntry> m_entries {};
+};
+
+}
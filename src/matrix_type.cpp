@@ -9,6 +9,20 @@ import :std_patch;
 namespace cpp_matrix {
 
 export template <typename T>
-concept MatrixElementType = std::is_same_v<T, std::float32_t> || std::is_same_v<T, std::float16_t>;
+concept MatrixElementType
+    = std::is_same_v<T, std::float32_t> || std::is_same_v<T, std::float16_t> || std::is_same_v<T, std::bfloat16_t>;
+
+/// @brief Short name of T in profiles, traces and benchmarks.
+export template <MatrixElementType T>
+constexpr const char* ElementTypeName()
+{
+    if constexpr (std::is_same_v<T, std::float16_t>) {
+        return "f16";
+    } else if constexpr (std::is_same_v<T, std::bfloat16_t>) {
+        return "bf16";
+    } else {
+        return "f32";
+    }
+}
 
 }
\ No newline at end of file
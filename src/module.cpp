@@ -1,9 +1,19 @@
 module;
 
 export module cpp_matrix;
+export import :expression;
+export import :loss_scaler;
 export import :matrix;
+export import :matrix_file;
 export import :matrix_type;
 export import :std_patch;
 
+export import :cost_model;
+export import :cpu_kernels;
+export import :cpu_matrix;
+export import :cpu_profiler;
+export import :memory_tracker;
+#if CPP_MATRIX_WITH_WEBGPU
+export import :auto_matrix;
 export import :webgpu_matrix;
-export import :cpu_matrix;
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -10,11 +10,16 @@ namespace std {
 export using float16_t = _Float16;
 #endif
 
+#if __STDCPP_BFLOAT16_T__ != 1
+export using bfloat16_t = __bf16;
+#endif
+
 #if __STDCPP_FLOAT32_T__ != 1
 export using float32_t = float;
 #endif
 
 static_assert(sizeof(std::float16_t) == 2);
+static_assert(sizeof(std::bfloat16_t) == 2);
 static_assert(sizeof(std::float32_t) == 4);
 
 }
\ No newline at end of file
@@ -0,0 +1,294 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+export module trace;
+
+namespace trace {
+
+/// @brief Arguments of an event, dtype and backend must be string literals. Zero dimensions of shape are omitted.
+export struct TraceArgs {
+    std::array<size_t, 3> shape {};
+    const char* dtype {};
+    const char* backend {};
+    size_t bytes {};
+};
+
+/// @brief Records spans and instant events into per thread ring buffers and writes them as Chrome trace JSON, which
+/// chrome://tracing and ui.perfetto.dev can open.
+///
+/// It is disabled by default, set CPP_MATRIX_TRACE to a file path to enable it and write the trace there at exit.
+/// While it is disabled, recording an event costs one branch. Each thread keeps its last kEventsPerThread events.
+export class Tracer {
+public:
+    static constexpr size_t kEventsPerThread = 64 * 1024;
+
+    static Tracer& GetInstance()
+    {
+        static Tracer s_tracer {};
+        return s_tracer;
+    }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    ~Tracer()
+    {
+        // Events recorded by destructors of other statics after this point would go to freed buffers.
+        s_isEnabled.store(false, std::memory_order_relaxed);
+        if (m_path.empty()) {
+            return;
+        }
+
+        try {
+            Write(m_path);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+        }
+    }
+
+    // Member functions defined in a module interface are not implicitly inline, the ones on the hot path are marked
+    // inline so that importers compile a disabled tracer down to one branch.
+    static inline bool IsEnabled()
+    {
+        return s_isEnabled.load(std::memory_order_relaxed);
+    }
+
+    static void Enable(bool enable = true)
+    {
+        s_isEnabled.store(enable, std::memory_order_relaxed);
+    }
+
+    /// @brief Monotonic timestamp in nanoseconds, the unit of Record().
+    static uint64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /// @brief Record an event of the calling thread, phase is 'X' (a span) or 'i' (an instant event). Category and
+    /// name must be string literals.
+    ///
+    /// Every thread writes its own buffer, so recording takes no lock except the first time a thread records.
+    void Record(char phase, const char* category, const char* name, uint64_t startNanoseconds,
+        uint64_t durationNanoseconds, const TraceArgs& args = {})
+    {
+        auto* pBuffer = t_pBuffer ? t_pBuffer : AddThreadBuffer();
+        auto head = pBuffer->head.load(std::memory_order_relaxed);
+        pBuffer->events[head % kEventsPerThread] = Event {
+            .phase = phase,
+            .category = category,
+            .name = name,
+            .startNanoseconds = startNanoseconds,
+            .durationNanoseconds = durationNanoseconds,
+            .args = args,
+        };
+        pBuffer->head.store(head + 1, std::memory_order_release);
+    }
+
+    /// @brief Drop all recorded events. Like ToJson(), other threads must not record at the same time.
+    void Reset()
+    {
+        auto lock = std::lock_guard { m_mutex };
+        for (auto& pBuffer : m_buffers) {
+            pBuffer->head.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /// @brief Chrome trace JSON of recorded events, timestamps start from the earliest one.
+    ///
+    /// A thread which recorded more than kEventsPerThread events has overwritten its oldest ones, the number of lost
+    /// events is in otherData.dropped_events.
+    std::string ToJson() const
+    {
+        auto lock = std::lock_guard { m_mutex };
+        auto origin = std::numeric_limits<uint64_t>::max();
+        for (const auto& pBuffer : m_buffers) {
+            auto [begin, end] = pBuffer->Range();
+            for (auto i = begin; i < end; ++i) {
+                origin = std::min(origin, pBuffer->events[i % kEventsPerThread].startNanoseconds);
+            }
+        }
+
+        auto json = std::string { "{\"traceEvents\": [\n" };
+        auto separator = "";
+        auto droppedEvents = size_t {};
+        auto pid = getpid();
+        for (const auto& pBuffer : m_buffers) {
+            auto [begin, end] = pBuffer->Range();
+            droppedEvents += begin;
+            for (auto i = begin; i < end; ++i) {
+                const auto& event = pBuffer->events[i % kEventsPerThread];
+                json += std::format(R"({}  {{"name": "{}", "cat": "{}", "ph": "{}", "ts": {:.3f}, )", separator,
+                    event.name, event.category, event.phase, (event.startNanoseconds - origin) / 1000.);
+                if (event.phase == 'X') {
+                    json += std::format(R"("dur": {:.3f}, )", event.durationNanoseconds / 1000.);
+                } else {
+                    json += R"("s": "t", )";
+                }
+                json += std::format(R"("pid": {}, "tid": {}, "args": {{{}}}}})", pid, pBuffer->threadId,
+                    ToJson(event.args));
+                separator = ",\n";
+            }
+        }
+        return json + std::format("\n], \"otherData\": {{\"dropped_events\": {}}}}}\n", droppedEvents);
+    }
+
+    void Write(const std::filesystem::path& path) const
+    {
+        auto out = std::ofstream { path, std::ios::trunc };
+        out << ToJson();
+        if (!out.flush()) {
+            throw std::runtime_error { std::format("Can't write trace to {}.", path.string()) };
+        }
+    }
+
+private:
+    struct Event {
+        char phase {};
+        const char* category {};
+        const char* name {};
+        uint64_t startNanoseconds {};
+        uint64_t durationNanoseconds {};
+        TraceArgs args {};
+    };
+
+    // Only its thread writes events, it publishes them by head, so readers never see a half written event unless the
+    // ring wraps around while they read.
+    struct ThreadBuffer {
+        size_t threadId {};
+        std::atomic<size_t> head {};
+        std::vector<Event> events = std::vector<Event>(kEventsPerThread);
+
+        std::pair<size_t, size_t> Range() const
+        {
+            auto end = head.load(std::memory_order_acquire);
+            return { end > kEventsPerThread ? end - kEventsPerThread : 0, end };
+        }
+    };
+
+    Tracer()
+    {
+        if (auto* path = std::getenv("CPP_MATRIX_TRACE")) {
+            m_path = path;
+        }
+    }
+
+    // Buffers are owned by the tracer rather than the thread, so events of finished threads are still written.
+    ThreadBuffer* AddThreadBuffer()
+    {
+        auto lock = std::lock_guard { m_mutex };
+        auto& pBuffer = m_buffers.emplace_back(std::make_unique<ThreadBuffer>());
+        pBuffer->threadId = m_buffers.size();
+        t_pBuffer = pBuffer.get();
+        return t_pBuffer;
+    }
+
+    static std::string ToJson(const TraceArgs& args)
+    {
+        auto json = std::string {};
+        auto add = [&](std::string field) {
+            json += json.empty() ? field : ", " + field;
+        };
+        if (args.shape[0]) {
+            auto shape = std::to_string(args.shape[0]);
+            for (auto i = 1u; i < args.shape.size() && args.shape[i]; ++i) {
+                shape += std::format("x{}", args.shape[i]);
+            }
+            add(std::format(R"("shape": "{}")", shape));
+        }
+        if (args.dtype) {
+            add(std::format(R"("dtype": "{}")", args.dtype));
+        }
+        if (args.backend) {
+            add(std::format(R"("backend": "{}")", args.backend));
+        }
+        if (args.bytes) {
+            add(std::format(R"("bytes": {})", args.bytes));
+        }
+        return json;
+    }
+
+    static inline std::atomic<bool> s_isEnabled { std::getenv("CPP_MATRIX_TRACE") != nullptr };
+    static inline thread_local ThreadBuffer* t_pBuffer {};
+
+    std::filesystem::path m_path {};
+    mutable std::mutex m_mutex {};
+    std::vector<std::unique_ptr<ThreadBuffer>> m_buffers {};
+};
+
+/// @brief Records a span from its construction to End() or its destruction, e.g.
+///
+///     auto scope = trace::TraceScope { "webgpu", "Submit" };
+export class TraceScope {
+public:
+    TraceScope() = default;
+
+    inline TraceScope(const char* category, const char* name, const TraceArgs& args = {})
+    {
+        if (Tracer::IsEnabled()) {
+            m_category = category;
+            m_name = name;
+            m_args = args;
+            m_startNanoseconds = Tracer::Now();
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    inline ~TraceScope()
+    {
+        End();
+    }
+
+    /// @brief Replace the arguments, e.g. once the shape of the result is known.
+    void SetArgs(const TraceArgs& args)
+    {
+        m_args = args;
+    }
+
+    inline void End()
+    {
+        if (m_name) {
+            Tracer::GetInstance().Record(
+                'X', m_category, m_name, m_startNanoseconds, Tracer::Now() - m_startNanoseconds, m_args);
+            m_name = nullptr;
+        }
+    }
+
+private:
+    const char* m_category {};
+    const char* m_name {};
+    TraceArgs m_args {};
+    uint64_t m_startNanoseconds {};
+};
+
+/// @brief Record an instant event, e.g. an allocation.
+export inline void TraceInstant(const char* category, const char* name, const TraceArgs& args = {})
+{
+    if (Tracer::IsEnabled()) {
+        Tracer::GetInstance().Record('i', category, name, Tracer::Now(), 0, args);
+    }
+}
+
+}
@@ -1,38 +1,59 @@
 module;
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <format>
+#include <functional>
 #include <future>
 #include <memory>
+#include <optional>
 #include <span>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 #include <webgpu/webgpu.h>
 
 export module webgpu:adapter;
 import :gpu_ref_ptr;
+import :memory_hook;
+import :pipeline_cache;
+import :profiler;
+import :staging_ring;
+import :wait;
+import trace;
 
 namespace webgpu {
 
-void ProcessGpuInstanceEvents();
-
 export class GpuAdapter {
 public:
     GpuAdapter() = default;
 
-    GpuAdapter(WGPUAdapter adapter, WGPUDevice device)
-        : m_pAdapter { std::move(adapter) }
+    GpuAdapter(WGPUAdapter adapter, WGPUDevice device, std::unique_ptr<GpuPipelineCache> pPipelineCache = {})
+        : m_pPipelineCache { std::move(pPipelineCache) }
+        , m_pAdapter { std::move(adapter) }
         , m_pDevice { std::move(device) }
     {
         m_pQueue.reset(wgpuDeviceGetQueue(m_pDevice.get()));
 
+        // The device is requested with the adapter's limits, see GpuInstance::RequestDevice().
         WGPUSupportedLimits supportedLimits {};
-        if (wgpuAdapterGetLimits(m_pAdapter.get(), &supportedLimits) != WGPUStatus_Success) {
-            throw std::runtime_error { "wgpuAdapterGetLimits failed." };
+        if (wgpuDeviceGetLimits(m_pDevice.get(), &supportedLimits) != WGPUStatus_Success) {
+            throw std::runtime_error { "wgpuDeviceGetLimits failed." };
         }
         m_limits = supportedLimits.limits;
         m_isFloat16Supported = wgpuDeviceHasFeature(m_pDevice.get(), WGPUFeatureName_ShaderF16);
+        m_isTimestampSupported = wgpuDeviceHasFeature(m_pDevice.get(), WGPUFeatureName_TimestampQuery);
+        m_isThreadSafe = wgpuDeviceHasFeature(m_pDevice.get(), WGPUFeatureName_ImplicitDeviceSynchronization);
+
+        m_readbackRing = GpuStagingRing {
+            m_pDevice.get(), WGPUBufferUsage_CopyDst | WGPUBufferUsage_MapRead, m_limits.maxBufferSize
+        };
+        m_uploadRing = GpuStagingRing {
+            m_pDevice.get(), WGPUBufferUsage_MapWrite | WGPUBufferUsage_CopySrc, m_limits.maxBufferSize
+        };
     }
 
     template <typename T>
@@ -48,6 +69,13 @@ public:
         return DoCreateBuffer(sizeof(_Float16) * elementSize);
     }
 
+    template <>
+    gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> CreateBuffer<__bf16>(size_t elementSize)
+    {
+        // WGSL has no bf16, kernels unpack it from u32, so it needs no feature.
+        return DoCreateBuffer(sizeof(__bf16) * elementSize);
+    }
+
     template <>
     gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> CreateBuffer<float>(size_t elementSize)
     {
@@ -60,6 +88,19 @@ public:
         return CreateBuffer<T>(row * column);
     }
 
+    /// @brief The biggest buffer which can be bound as one storage buffer, larger data must be split.
+    size_t GetMaxStorageBufferSize() const
+    {
+        return std::min<uint64_t>(m_limits.maxStorageBufferBindingSize, m_limits.maxBufferSize) & ~3;
+    }
+
+    /// @brief Whether the staging buffers returned by Readback() may be waited for, read and released by another
+    /// thread than the one which uses the device. Everything else must stay on that thread.
+    bool IsThreadSafe() const
+    {
+        return m_isThreadSafe;
+    }
+
     WGPUDevice GetDevice() const
     {
         return m_pDevice.get();
@@ -70,17 +111,168 @@ public:
         return m_pQueue.get();
     }
 
-    void Execute(std::string_view shaderScript, std::span<Parameter> parameters, size_t N, size_t batchSize)
+    /// @brief Get a mapped staging buffer which can hold at least byteSize bytes, fill it then call Upload().
+    std::shared_ptr<GpuStagingBuffer> AcquireUploadBuffer(size_t byteSize)
     {
-        auto hash = std::hash<std::string_view> {}(shaderScript);
-        auto it = m_cachedShaderModules.find(hash);
-        if (it == m_cachedShaderModules.end()) {
-            it = m_cachedShaderModules.emplace(hash, BuildShaderModule(shaderScript)).first;
+        return m_uploadRing.Acquire(byteSize);
+    }
+
+    /// @brief Copy the first byteSize bytes of the staging buffer into buffer.
+    ///
+    /// It doesn't wait for the copy, call Wait() of the staging buffer if the caller needs to know it is done.
+    void Upload(GpuStagingBuffer& staging, WGPUBuffer buffer, size_t offset, size_t byteSize)
+    {
+        staging.Unmap();
+        CopyBufferToBuffer(staging.GetBuffer(), 0, buffer, offset, byteSize);
+
+        // Map it again for the next upload, it finishes after the copy is done. One-off buffers are dropped instead,
+        // but Wait() must still wait for their copy.
+        if (GpuStagingRing::IsPooled(staging.Size())) {
+            staging.MapAsync(staging.Size());
+        } else {
+            staging.OnSubmittedWorkDone(m_pQueue.get());
+        }
+    }
+
+    /// @brief Copy byteSize bytes of buffer (start from offset) into a staging buffer and map it.
+    ///
+    /// It doesn't wait for the copy, GetConstMappedRange() of the returned staging buffer waits for the data.
+    std::shared_ptr<GpuStagingBuffer> Readback(WGPUBuffer buffer, size_t offset, size_t byteSize)
+    {
+        auto pStaging = m_readbackRing.Acquire(byteSize);
+        CopyBufferToBuffer(buffer, offset, pStaging->GetBuffer(), 0, byteSize);
+        pStaging->MapAsync(byteSize);
+        return pStaging;
+    }
+
+    /// @brief Maximum number of scalars one dispatch can take, see Execute().
+    static constexpr size_t kMaxScalarCount = 64;
+
+    /// @brief Dispatch shaderScript, parameters are bound in order.
+    ///
+    /// If scalars is not empty, it is bound right after parameters as var<uniform> array<vec4<u32>, n>, where n is
+    /// (scalars.size() + 3) / 4, their bits are copied as they are and shaders bitcast<f32>() the floats. All
+    /// dispatches share one uniform buffer, so passing scalars never allocates.
+    void Execute(const KernelLabel& label, std::string_view shaderScript, std::span<Parameter> parameters, size_t N,
+        size_t batchSize, std::span<const float> scalars = {})
+    {
+        auto scope = trace::TraceScope { "webgpu", label.op, { .shape = label.shape, .dtype = label.dtype } };
+        auto computePipeline = GetComputePipeline(shaderScript);
+        auto bindings = std::vector<Parameter> { parameters.begin(), parameters.end() };
+        if (!scalars.empty()) {
+            bindings.push_back(WriteScalars(scalars));
+        }
+
+        auto& profiler = GpuProfiler::GetInstance();
+        if (!profiler.IsEnabled()) {
+            Execute(computePipeline, bindings, N, batchSize, nullptr);
+            return;
+        }
+
+        // Pipeline compilation above is excluded, so host time is the overhead of recording, submitting and waiting.
+        auto start = std::chrono::steady_clock::now();
+        auto pTimestamps = std::shared_ptr<GpuStagingBuffer> {};
+        Execute(computePipeline, bindings, N, batchSize, &pTimestamps);
+        auto wallMicroseconds
+            = std::chrono::duration<double, std::micro> { std::chrono::steady_clock::now() - start }.count();
+
+        auto gpuMicroseconds = std::optional<double> {};
+        if (pTimestamps) {
+            uint64_t timestamps[2] {};
+            std::memcpy(timestamps, pTimestamps->GetConstMappedRange(), sizeof(timestamps));
+            pTimestamps->Unmap();
+            if (timestamps[1] >= timestamps[0]) {
+                gpuMicroseconds = (timestamps[1] - timestamps[0]) / 1000.;
+            }
+        }
+        profiler.Record(label, gpuMicroseconds, wallMicroseconds);
+    }
+
+    /// @brief Compile shaders recorded in the pipeline cache directory in parallel, so their first use is fast.
+    ///
+    /// Only shaders accepted by filter are compiled, returns how many pipelines are created.
+    size_t WarmUp(const std::function<bool(std::string_view)>& filter)
+    {
+        if (!m_pPipelineCache) {
+            return 0;
+        }
+
+        struct Request {
+            size_t hash {};
+            GpuShaderModulePtr pShaderModule {};
+            std::promise<GpuComputePipelinePtr> promise {};
+            std::future<GpuComputePipelinePtr> future {};
+            WGPUFuture gpuFuture {};
+        };
+
+        // Issue all requests first, so Dawn compiles them at the same time.
+        auto requests = std::vector<std::unique_ptr<Request>> {};
+        for (const auto& shaderScript : m_pPipelineCache->LoadShaders()) {
+            auto hash = std::hash<std::string_view> {}(shaderScript);
+            if (!filter(shaderScript) || m_cachedPipelines.contains(hash)) {
+                continue;
+            }
+
+            auto pRequest = std::make_unique<Request>();
+            pRequest->hash = hash;
+            pRequest->pShaderModule = BuildShaderModule(shaderScript);
+            pRequest->future = pRequest->promise.get_future();
+            auto computePipelineDesc = ComputePipelineDescriptor(pRequest->pShaderModule.get());
+            pRequest->gpuFuture = wgpuDeviceCreateComputePipelineAsync(m_pDevice.get(), &computePipelineDesc,
+                { .mode = WGPUCallbackMode_AllowProcessEvents,
+                    .callback =
+                        [](WGPUCreatePipelineAsyncStatus status, WGPUComputePipeline pipeline,
+                            struct WGPUStringView message, void* userdata1, void* userdata2) {
+                            auto pPipeline = GpuComputePipelinePtr { pipeline };
+                            if (status != WGPUCreatePipelineAsyncStatus_Success) {
+                                pPipeline = nullptr;
+                            }
+                            ((std::promise<GpuComputePipelinePtr>*)userdata1)->set_value(std::move(pPipeline));
+                        },
+                    .userdata1 = &pRequest->promise });
+            requests.push_back(std::move(pRequest));
+        }
+
+        auto count = size_t {};
+        for (auto& pRequest : requests) {
+            if (auto pPipeline = Wait(pRequest->future, pRequest->gpuFuture)) {
+                m_cachedPipelines.emplace(pRequest->hash, std::move(pPipeline));
+                ++count;
+            }
         }
-        Execute(it->second.get(), { parameters.begin(), parameters.end() }, N, batchSize);
+        return count;
     }
 
 private:
+    static WGPUComputePipelineDescriptor ComputePipelineDescriptor(WGPUShaderModule shaderModule)
+    {
+        // Bind group layout is deduced from the shader, so the pipeline can be reused for any buffers.
+        return WGPUComputePipelineDescriptor {
+            .layout = nullptr,
+            .compute = {
+                .module = shaderModule,
+                .entryPoint = {
+                    .data = "main",
+                    .length = 4 },
+            },
+        };
+    }
+
+    WGPUComputePipeline GetComputePipeline(std::string_view shaderScript)
+    {
+        auto hash = std::hash<std::string_view> {}(shaderScript);
+        auto it = m_cachedPipelines.find(hash);
+        if (it == m_cachedPipelines.end()) {
+            it = m_cachedPipelines.emplace(hash, BuildComputePipeline(shaderScript)).first;
+        }
+
+        // Pipelines compiled by WarmUp() are stored too, which marks them as used for the eviction of the cache.
+        if (m_pPipelineCache && m_storedShaders.insert(hash).second) {
+            m_pPipelineCache->StoreShader(hash, shaderScript);
+        }
+        return it->second.get();
+    }
+
     GpuShaderModulePtr BuildShaderModule(std::string_view shaderScript)
     {
         // Create wgsl
@@ -95,28 +287,42 @@ private:
         return GpuShaderModulePtr { wgpuDeviceCreateShaderModule(m_pDevice.get(), &shaderModuleDesc) };
     }
 
-    void Execute(WGPUShaderModule shaderModule, std::span<Parameter> parameters, size_t N, size_t batchSize)
+    GpuComputePipelinePtr BuildComputePipeline(std::string_view shaderScript)
     {
-        // Create layout entries for parameters.
-        auto layoutEntries = std::vector<WGPUBindGroupLayoutEntry>(parameters.size());
-        for (auto i = 0u; i < parameters.size(); ++i) {
-            layoutEntries[i] = WGPUBindGroupLayoutEntry {
-                .binding = i,
-                .visibility = WGPUShaderStage_Compute,
-                .buffer = WGPUBufferBindingLayout {
-                    .type = WGPUBufferBindingType_Storage,
-                    .minBindingSize = parameters[i].size,
-                },
-            };
-        }
+        auto pShaderModule = BuildShaderModule(shaderScript);
 
-        auto layoutDesc = WGPUBindGroupLayoutDescriptor {
-            .entryCount = layoutEntries.size(),
-            .entries = layoutEntries.data(),
-        };
+        auto compilationPromise = std::promise<void> {};
+        auto compilationFuture = compilationPromise.get_future();
+        auto compilationGpuFuture = wgpuShaderModuleGetCompilationInfo(pShaderModule.get(),
+            { .mode = WGPUCallbackMode_AllowProcessEvents,
+                .callback =
+                    [](WGPUCompilationInfoRequestStatus status, struct WGPUCompilationInfo const* compilationInfo,
+                        void* userdata1, void* userdata2) {
+                        if (compilationInfo) {
+                            for (uint32_t i = 0; i < compilationInfo->messageCount; ++i) {
+                                printf("Message %d: %s\n", i,
+                                    std::string { compilationInfo->messages[i].message.data,
+                                        compilationInfo->messages[i].message.length }
+                                        .c_str());
+                            }
+                            ((std::promise<void>*)userdata1)->set_value();
+                        }
+                    },
+                .userdata1 = &compilationPromise });
+        Wait(compilationFuture, compilationGpuFuture);
+
+        auto computePipelineDesc = ComputePipelineDescriptor(pShaderModule.get());
+        return GpuComputePipelinePtr { wgpuDeviceCreateComputePipeline(m_pDevice.get(), &computePipelineDesc) };
+    }
 
+    // If ppTimestamps is not null and timestamp query is supported, it receives the mapped begin / end timestamps
+    // (in nanoseconds) of the compute pass.
+    void Execute(WGPUComputePipeline computePipeline, std::span<Parameter> parameters, size_t N, size_t batchSize,
+        std::shared_ptr<GpuStagingBuffer>* ppTimestamps)
+    {
+        auto recordScope = trace::TraceScope { "webgpu", "Record" };
         auto layout = gpu_ref_ptr<WGPUBindGroupLayout, wgpuBindGroupLayoutAddRef, wgpuBindGroupLayoutRelease> {
-            wgpuDeviceCreateBindGroupLayout(m_pDevice.get(), &layoutDesc)
+            wgpuComputePipelineGetBindGroupLayout(computePipeline, 0)
         };
 
         // Create bind group entries.
@@ -139,78 +345,121 @@ private:
             wgpuDeviceCreateBindGroup(m_pDevice.get(), &bindGroupDesc)
         };
 
-        // Create pipeline.
-        auto pipelineLayoutDesc = WGPUPipelineLayoutDescriptor {
-            .bindGroupLayoutCount = 1,
-            .bindGroupLayouts = layout.get_addr(),
-        };
-
-        auto pipelineLayout = gpu_ref_ptr<WGPUPipelineLayout, wgpuPipelineLayoutAddRef, wgpuPipelineLayoutRelease> {
-            wgpuDeviceCreatePipelineLayout(m_pDevice.get(), &pipelineLayoutDesc)
-        };
-
-        // Create wgsl pipeline.
-        auto computePipelineDesc = WGPUComputePipelineDescriptor {
-            .layout = pipelineLayout.get(),
-            .compute = {
-                .module = shaderModule,
-                .entryPoint = {
-                    .data = "main",
-                    .length = 4 },
-            },
-        };
-
-        auto computePipeline = gpu_ref_ptr<WGPUComputePipeline, wgpuComputePipelineAddRef, wgpuComputePipelineRelease> {
-            wgpuDeviceCreateComputePipeline(m_pDevice.get(), &computePipelineDesc)
-        };
-
         // reset command buffer.
         auto commandEncoder = gpu_ref_ptr<WGPUCommandEncoder, wgpuCommandEncoderAddRef, wgpuCommandEncoderRelease> {
             wgpuDeviceCreateCommandEncoder(m_pDevice.get(), nullptr)
         };
+        auto isTimestampEnabled = ppTimestamps && m_isTimestampSupported;
+        auto timestampWrites = WGPUComputePassTimestampWrites {};
+        auto computePassDesc = WGPUComputePassDescriptor {};
+        if (isTimestampEnabled) {
+            timestampWrites = WGPUComputePassTimestampWrites {
+                .querySet = GetTimestampQuerySet(),
+                .beginningOfPassWriteIndex = 0,
+                .endOfPassWriteIndex = 1,
+            };
+            computePassDesc.timestampWrites = &timestampWrites;
+        }
+
         auto computePassEncoder
             = gpu_ref_ptr<WGPUComputePassEncoder, wgpuComputePassEncoderAddRef, wgpuComputePassEncoderRelease> {
-                  wgpuCommandEncoderBeginComputePass(commandEncoder.get(), nullptr)
+                  wgpuCommandEncoderBeginComputePass(commandEncoder.get(), &computePassDesc)
               };
-        wgpuComputePassEncoderSetPipeline(computePassEncoder.get(), computePipeline.get());
+        wgpuComputePassEncoderSetPipeline(computePassEncoder.get(), computePipeline);
         wgpuComputePassEncoderSetBindGroup(computePassEncoder.get(), 0, bindGroup.get(), 0, nullptr);
         wgpuComputePassEncoderDispatchWorkgroups(computePassEncoder.get(), (N + (batchSize - 1)) / batchSize, 1, 1);
         wgpuComputePassEncoderEnd(computePassEncoder.get());
 
+        // Resolve and copy timestamps in the same submit, so profiling adds no extra round trip.
+        if (isTimestampEnabled) {
+            constexpr auto kTimestampsSize = 2 * sizeof(uint64_t);
+            wgpuCommandEncoderResolveQuerySet(
+                commandEncoder.get(), m_pTimestampQuerySet.get(), 0, 2, m_pTimestampResolveBuffer.get(), 0);
+            *ppTimestamps = m_readbackRing.Acquire(kTimestampsSize);
+            wgpuCommandEncoderCopyBufferToBuffer(commandEncoder.get(), m_pTimestampResolveBuffer.get(), 0,
+                (*ppTimestamps)->GetBuffer(), 0, kTimestampsSize);
+        }
+
         auto commandBuffer = gpu_ref_ptr<WGPUCommandBuffer, wgpuCommandBufferAddRef, wgpuCommandBufferRelease> {
             wgpuCommandEncoderFinish(commandEncoder.get(), nullptr)
         };
 
-        auto compilationPromise = std::promise<void> {};
-        auto compilationFuture = compilationPromise.get_future();
-        wgpuShaderModuleGetCompilationInfo(computePipelineDesc.compute.module,
-            { .mode = WGPUCallbackMode_AllowProcessEvents,
-                .callback =
-                    [](WGPUCompilationInfoRequestStatus status, struct WGPUCompilationInfo const* compilationInfo,
-                        void* userdata1, void* userdata2) {
-                        if (compilationInfo) {
-                            for (uint32_t i = 0; i < compilationInfo->messageCount; ++i) {
-                                printf("Message %d: %s\n", i,
-                                    std::string { compilationInfo->messages[i].message.data,
-                                        compilationInfo->messages[i].message.length }
-                                        .c_str());
-                            }
-                            ((std::promise<void>*)userdata1)->set_value();
-                        }
-                    },
-                .userdata1 = &compilationPromise });
-        Wait(compilationFuture);
+        recordScope.End();
 
         // Submit the command buffer.
+        auto submitScope = trace::TraceScope { "webgpu", "Submit" };
         auto submitPromise = std::promise<void> {};
         auto submitFuture = submitPromise.get_future();
         wgpuQueueSubmit(m_pQueue.get(), 1, commandBuffer.get_addr());
-        wgpuQueueOnSubmittedWorkDone(m_pQueue.get(),
+        auto submitGpuFuture = wgpuQueueOnSubmittedWorkDone(m_pQueue.get(),
             { .mode = WGPUCallbackMode_AllowProcessEvents,
                 .callback = [](WGPUQueueWorkDoneStatus status, void* userdata1,
                                 void* userdata2) { ((std::promise<void>*)userdata1)->set_value(); },
                 .userdata1 = &submitPromise });
-        Wait(submitFuture);
+        submitScope.End();
+
+        auto waitScope = trace::TraceScope { "webgpu", "Wait" };
+        Wait(submitFuture, submitGpuFuture);
+        waitScope.End();
+
+        if (isTimestampEnabled) {
+            (*ppTimestamps)->MapAsync(2 * sizeof(uint64_t));
+        }
+    }
+
+    Parameter WriteScalars(std::span<const float> scalars)
+    {
+        if (scalars.size() > kMaxScalarCount) {
+            throw std::runtime_error { std::format(
+                "Too many scalars (required count is {}, limits is {}).", scalars.size(), kMaxScalarCount) };
+        }
+
+        if (!m_pScalarBuffer) {
+            auto bufferDesc = WGPUBufferDescriptor {
+                .usage = WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst,
+                .size = kMaxScalarCount * sizeof(float),
+            };
+            m_pScalarLease = LeaseBuffer(bufferDesc.size, "uniform");
+            m_pScalarBuffer.reset(wgpuDeviceCreateBuffer(m_pDevice.get(), &bufferDesc));
+        }
+
+        // Dispatches are submitted in order and the write is queued before the next submit, so one buffer is enough.
+        wgpuQueueWriteBuffer(m_pQueue.get(), m_pScalarBuffer.get(), 0, scalars.data(), scalars.size_bytes());
+        return { m_pScalarBuffer.get(), ((scalars.size() + 3) & ~3) * sizeof(float) };
+    }
+
+    WGPUQuerySet GetTimestampQuerySet()
+    {
+        if (!m_pTimestampQuerySet) {
+            m_pTimestampLease = LeaseBuffer(2 * sizeof(uint64_t), "timestamp");
+            auto querySetDesc = WGPUQuerySetDescriptor {
+                .type = WGPUQueryType_Timestamp,
+                .count = 2,
+            };
+            m_pTimestampQuerySet.reset(wgpuDeviceCreateQuerySet(m_pDevice.get(), &querySetDesc));
+
+            auto bufferDesc = WGPUBufferDescriptor {
+                .usage = WGPUBufferUsage_QueryResolve | WGPUBufferUsage_CopySrc,
+                .size = 2 * sizeof(uint64_t),
+            };
+            m_pTimestampResolveBuffer.reset(wgpuDeviceCreateBuffer(m_pDevice.get(), &bufferDesc));
+        }
+        return m_pTimestampQuerySet.get();
+    }
+
+    void CopyBufferToBuffer(WGPUBuffer source, size_t sourceOffset, WGPUBuffer destination, size_t destinationOffset,
+        size_t byteSize)
+    {
+        auto scope = trace::TraceScope { "webgpu", "CopyBufferToBuffer", { .bytes = byteSize } };
+        auto commandEncoder = gpu_ref_ptr<WGPUCommandEncoder, wgpuCommandEncoderAddRef, wgpuCommandEncoderRelease> {
+            wgpuDeviceCreateCommandEncoder(m_pDevice.get(), nullptr)
+        };
+        wgpuCommandEncoderCopyBufferToBuffer(
+            commandEncoder.get(), source, sourceOffset, destination, destinationOffset, byteSize);
+        auto commandBuffer = gpu_ref_ptr<WGPUCommandBuffer, wgpuCommandBufferAddRef, wgpuCommandBufferRelease> {
+            wgpuCommandEncoderFinish(commandEncoder.get(), nullptr)
+        };
+        wgpuQueueSubmit(m_pQueue.get(), 1, commandBuffer.get_addr());
     }
 
     gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> DoCreateBuffer(size_t byteSize)
@@ -223,6 +472,7 @@ private:
                 byteSize, m_limits.maxStorageBufferBindingSize, m_limits.maxBufferSize) };
         }
 
+        trace::TraceInstant("webgpu", "CreateBuffer", { .backend = "WebGpu", .bytes = byteSize });
         auto bufferDesc = WGPUBufferDescriptor {
             .usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst | WGPUBufferUsage_CopySrc,
             .size = byteSize,
@@ -232,21 +482,26 @@ private:
             m_pDevice.get(), &bufferDesc) };
     }
 
-    template <typename T>
-    T Wait(std::future<T>& future)
-    {
-        while (future.wait_for(std::chrono::milliseconds {}) != std::future_status::ready) {
-            ProcessGpuInstanceEvents();
-        }
-        return future.get();
-    }
-
+    // Device uses it, so it must be destroyed after the device.
+    std::unique_ptr<GpuPipelineCache> m_pPipelineCache {};
     gpu_ref_ptr<WGPUAdapter, wgpuAdapterAddRef, wgpuAdapterRelease> m_pAdapter {};
     gpu_ref_ptr<WGPUDevice, wgpuDeviceAddRef, wgpuDeviceRelease> m_pDevice {};
     gpu_ref_ptr<WGPUQueue, wgpuQueueAddRef, wgpuQueueRelease> m_pQueue {};
     WGPULimits m_limits {};
     bool m_isFloat16Supported {};
-    std::unordered_map<size_t, GpuShaderModulePtr> m_cachedShaderModules {};
+    bool m_isTimestampSupported {};
+    bool m_isThreadSafe {};
+    std::shared_ptr<const void> m_pScalarLease {};
+    gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> m_pScalarBuffer {};
+    gpu_ref_ptr<WGPUQuerySet, wgpuQuerySetAddRef, wgpuQuerySetRelease> m_pTimestampQuerySet {};
+    std::shared_ptr<const void> m_pTimestampLease {};
+    gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> m_pTimestampResolveBuffer {};
+    std::unordered_map<size_t, GpuComputePipelinePtr> m_cachedPipelines {};
+
+    // Shaders passed to the pipeline cache by this process.
+    std::unordered_set<size_t> m_storedShaders {};
+    GpuStagingRing m_readbackRing {};
+    GpuStagingRing m_uploadRing {};
 };
 
 }
\ No newline at end of file
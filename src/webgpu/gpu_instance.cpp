@@ -1,14 +1,23 @@
 module;
 
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
 #include <functional>
 #include <future>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 #include <webgpu/webgpu.h>
 
 export module webgpu:gpu_instance;
 import :adapter;
 import :gpu_ref_ptr;
+import :pipeline_cache;
+import :wait;
 
 namespace webgpu {
 
@@ -16,15 +25,27 @@ export class GpuInstance {
 public:
     static GpuInstance& GetInstance()
     {
-        static GpuInstance s_gpuInstance { wgpuCreateInstance(nullptr) };
+        static GpuInstance s_gpuInstance { CreateInstance() };
         return s_gpuInstance;
     }
 
     GpuInstance() = default;
 
-    GpuInstance(WGPUInstance instance)
+    GpuInstance(WGPUInstance instance, bool isTimedWaitSupported = false)
         : m_pInstance { instance }
+        , m_isTimedWaitSupported { isTimedWaitSupported }
     {
+        if (auto* directory = std::getenv("CPP_MATRIX_GPU_CACHE_DIR")) {
+            m_pipelineCacheDirectory = directory;
+        }
+    }
+
+    /// @brief Persist compiled pipelines in directory, it must be called before the first GetAdapter().
+    ///
+    /// Default is CPP_MATRIX_GPU_CACHE_DIR if it is set, otherwise there is no on-disk cache.
+    void SetPipelineCacheDirectory(std::filesystem::path directory)
+    {
+        m_pipelineCacheDirectory = std::move(directory);
     }
 
     std::shared_ptr<GpuAdapter> GetAdapter()
@@ -38,13 +59,44 @@ public:
         wgpuInstanceProcessEvents(m_pInstance.get());
     }
 
+    /// @brief Block until future is completed or timed out, returns false if timed out or timed wait is not supported.
+    bool WaitAny(WGPUFuture future, uint64_t timeoutNs)
+    {
+        if (!m_isTimedWaitSupported) {
+            return false;
+        }
+
+        auto waitInfo = WGPUFutureWaitInfo { .future = future };
+        switch (wgpuInstanceWaitAny(m_pInstance.get(), 1, &waitInfo, timeoutNs)) {
+        case WGPUWaitStatus_Success:
+            return waitInfo.completed;
+        case WGPUWaitStatus_TimedOut:
+            return false;
+        default:
+            // Don't try it again, callers will fall back to process events.
+            m_isTimedWaitSupported = false;
+            return false;
+        }
+    }
+
 private:
+    static GpuInstance CreateInstance()
+    {
+        // Timed wait lets WaitMode::Block sleep in wgpuInstanceWaitAny instead of polling.
+        auto desc = WGPUInstanceDescriptor {};
+        desc.features.timedWaitAnyEnable = true;
+        if (auto instance = wgpuCreateInstance(&desc)) {
+            return GpuInstance { instance, /*isTimedWaitSupported=*/true };
+        }
+        return GpuInstance { wgpuCreateInstance(nullptr) };
+    }
+
     std::shared_ptr<GpuAdapter> RequestAdapter()
     {
         // Request adapter.
         auto adapterPromise = std::promise<GpuAdapterPtr>();
         auto adapterFuture = adapterPromise.get_future();
-        wgpuInstanceRequestAdapter(m_pInstance.get(), nullptr,
+        auto adapterGpuFuture = wgpuInstanceRequestAdapter(m_pInstance.get(), nullptr,
             { .mode = WGPUCallbackMode_AllowProcessEvents,
                 .callback =
                     [](WGPURequestAdapterStatus status, WGPUAdapter adapter, struct WGPUStringView message,
@@ -52,29 +104,73 @@ private:
                         ((std::promise<GpuAdapterPtr>*)userdata1)->set_value(GpuAdapterPtr { adapter });
                     },
                 .userdata1 = &adapterPromise });
-        auto pAdapter = Wait(adapterFuture);
+        auto pAdapter = Wait(adapterFuture, adapterGpuFuture);
 
-        // Request device.
-        try {
-            auto pDevice = RequestDevice(pAdapter.get(), { WGPUFeatureName_ShaderF16 });
-            return std::make_shared<GpuAdapter>(pAdapter.release(), pDevice.release());
-        } catch (std::runtime_error) {
-            // F16 might not supported, that's fine, let's create device without F16 feature.
+        // Ask for optional features the adapter has, so the device is requested only once.
+        auto features = std::vector<WGPUFeatureName> {};
+        if (wgpuAdapterHasFeature(pAdapter.get(), WGPUFeatureName_ShaderF16)) {
+            features.push_back(WGPUFeatureName_ShaderF16);
+        }
+        if (wgpuAdapterHasFeature(pAdapter.get(), WGPUFeatureName_TimestampQuery)) {
+            features.push_back(WGPUFeatureName_TimestampQuery);
+        }
+        // Dawn then locks the device in every call, so readbacks can be waited for on another thread.
+        if (wgpuAdapterHasFeature(pAdapter.get(), WGPUFeatureName_ImplicitDeviceSynchronization)) {
+            features.push_back(WGPUFeatureName_ImplicitDeviceSynchronization);
         }
 
-        auto pDevice = RequestDevice(pAdapter.get(), {});
-        return std::make_shared<GpuAdapter>(pAdapter.release(), pDevice.release());
+        // Compiled pipelines are loaded from / stored to the cache directory by Dawn.
+        auto pPipelineCache = std::unique_ptr<GpuPipelineCache> {};
+        if (!m_pipelineCacheDirectory.empty()) {
+            pPipelineCache
+                = std::make_unique<GpuPipelineCache>(m_pipelineCacheDirectory, GetAdapterKey(pAdapter.get()));
+        }
+
+        auto pDevice = RequestDevice(
+            pAdapter.get(), features, pPipelineCache ? pPipelineCache->GetDeviceDescriptorChain() : nullptr);
+        return std::make_shared<GpuAdapter>(pAdapter.release(), pDevice.release(), std::move(pPipelineCache));
+    }
+
+    static std::string GetAdapterKey(WGPUAdapter adapter)
+    {
+        auto info = WGPUAdapterInfo {};
+        if (wgpuAdapterGetInfo(adapter, &info) != WGPUStatus_Success) {
+            return "unknown";
+        }
+
+        auto toStringView = [](WGPUStringView s) {
+            if (!s.data) {
+                return std::string_view {};
+            }
+            return s.length == WGPU_STRLEN ? std::string_view { s.data } : std::string_view { s.data, s.length };
+        };
+        auto key = std::format("{}|{}|{}|{}|{}|{:x}|{:x}", toStringView(info.vendor), toStringView(info.architecture),
+            toStringView(info.device), toStringView(info.description), (int)info.backendType, info.vendorID,
+            info.deviceID);
+        wgpuAdapterInfoFreeMembers(info);
+        return key;
     }
 
-    static GpuDevicePtr RequestDevice(WGPUAdapter adapter, std::initializer_list<WGPUFeatureName> features)
+    static GpuDevicePtr RequestDevice(
+        WGPUAdapter adapter, const std::vector<WGPUFeatureName>& features, const WGPUChainedStruct* nextInChain)
     {
         // Request device.
         auto devicePromise = std::promise<GpuDevicePtr>();
         auto deviceFuture = devicePromise.get_future();
+        // Default limits cap a storage buffer at 128 MiB, ask for what the adapter can do.
+        auto requiredLimits = WGPURequiredLimits {};
+        WGPUSupportedLimits supportedLimits {};
+        if (wgpuAdapterGetLimits(adapter, &supportedLimits) != WGPUStatus_Success) {
+            throw std::runtime_error { "wgpuAdapterGetLimits failed." };
+        }
+        requiredLimits.limits = supportedLimits.limits;
+
         WGPUDeviceDescriptor desc = WGPU_DEVICE_DESCRIPTOR_INIT;
+        desc.nextInChain = nextInChain;
+        desc.requiredLimits = &requiredLimits;
         desc.requiredFeatureCount = features.size();
-        desc.requiredFeatures = std::data(features);
-        wgpuAdapterRequestDevice(adapter, &desc,
+        desc.requiredFeatures = features.data();
+        auto deviceGpuFuture = wgpuAdapterRequestDevice(adapter, &desc,
             { .mode = WGPUCallbackMode_AllowProcessEvents,
                 .callback =
                     [](WGPURequestDeviceStatus status, WGPUDevice device, struct WGPUStringView message,
@@ -88,19 +184,12 @@ private:
                         }
                     },
                 .userdata1 = &devicePromise });
-        return Wait(deviceFuture);
-    }
-
-    template <typename T>
-    static T Wait(std::future<T>& future)
-    {
-        while (future.wait_for(std::chrono::milliseconds {}) != std::future_status::ready) {
-            ProcessGpuInstanceEvents();
-        }
-        return future.get();
+        return Wait(deviceFuture, deviceGpuFuture);
     }
 
     gpu_ref_ptr<WGPUInstance, wgpuInstanceAddRef, wgpuInstanceRelease> m_pInstance {};
+    bool m_isTimedWaitSupported {};
+    std::filesystem::path m_pipelineCacheDirectory {};
 };
 
 void ProcessGpuInstanceEvents()
@@ -108,4 +197,9 @@ void ProcessGpuInstanceEvents()
     GpuInstance::GetInstance().ProcessEvents();
 }
 
+bool WaitGpuInstanceAny(WGPUFuture future, uint64_t timeoutNs)
+{
+    return GpuInstance::GetInstance().WaitAny(future, timeoutNs);
+}
+
 }
\ No newline at end of file
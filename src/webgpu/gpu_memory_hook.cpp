@@ -0,0 +1,36 @@
+module;
+
+#include <functional>
+#include <memory>
+#include <utility>
+
+export module webgpu:memory_hook;
+
+namespace webgpu {
+
+/// @brief Accounts a buffer which the webgpu module allocates for itself (staging, uniform and timestamp buffers).
+///
+/// It returns a handle which is held as long as the buffer lives, and throws to refuse the allocation. The webgpu
+/// module can't depend on cpp_matrix, so cpp_matrix installs a hook which takes a MemoryLease.
+export using BufferLeaseHook = std::function<std::shared_ptr<const void>(size_t byteSize, const char* label)>;
+
+BufferLeaseHook& GetBufferLeaseHook()
+{
+    static BufferLeaseHook s_hook {};
+    return s_hook;
+}
+
+/// @brief Install hook, it must be set before the first buffer is allocated.
+export void SetBufferLeaseHook(BufferLeaseHook hook)
+{
+    GetBufferLeaseHook() = std::move(hook);
+}
+
+/// @brief Account a buffer of byteSize bytes before it is created, label must be a string literal.
+export std::shared_ptr<const void> LeaseBuffer(size_t byteSize, const char* label)
+{
+    const auto& hook = GetBufferLeaseHook();
+    return hook ? hook(byteSize, label) : nullptr;
+}
+
+}
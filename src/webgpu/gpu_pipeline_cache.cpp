@@ -0,0 +1,186 @@
+module;
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+#include <webgpu/webgpu.h>
+
+export module webgpu:pipeline_cache;
+
+namespace webgpu {
+
+/// @brief Persists compiled pipelines (through Dawn's blob cache) and the WGSL sources of them in a directory.
+///
+/// Layout of the directory:
+///   blobs/<adapter key hash>/<blob key hash>: size of the blob key, blob key and the compiled blob.
+///   shaders/<shader hash>.wgsl: every shader used by this process, WarmUp() compiles them on next start.
+///
+/// Both keep the most recently used kMaxShaderCount and kMaxBlobCount files, older ones are removed as new ones are
+/// stored, so kernels of shapes which are no longer used don't pile up and WarmUp() compiles a bounded set.
+export class GpuPipelineCache {
+public:
+    static constexpr size_t kMaxShaderCount = 256;
+    static constexpr size_t kMaxBlobCount = 256;
+
+    GpuPipelineCache(std::filesystem::path directory, std::string adapterKey)
+        : m_directory { std::move(directory) }
+        , m_adapterKey { std::move(adapterKey) }
+    {
+        m_blobDirectory = m_directory / "blobs" / std::format("{:016x}", std::hash<std::string> {}(m_adapterKey));
+        std::error_code ec {};
+        std::filesystem::create_directories(m_blobDirectory, ec);
+        std::filesystem::create_directories(m_directory / "shaders", ec);
+
+        m_cacheDesc = WGPUDawnCacheDeviceDescriptor {
+            .chain = { .sType = WGPUSType_DawnCacheDeviceDescriptor },
+            .isolationKey = { m_adapterKey.data(), m_adapterKey.length() },
+            .loadDataFunction = &LoadData,
+            .storeDataFunction = &StoreData,
+            .functionUserdata = this,
+        };
+    }
+
+    GpuPipelineCache(const GpuPipelineCache&) = delete;
+    GpuPipelineCache& operator=(const GpuPipelineCache&) = delete;
+
+    /// @brief Chain it into WGPUDeviceDescriptor, this object must outlive the device.
+    const WGPUChainedStruct* GetDeviceDescriptorChain() const
+    {
+        return &m_cacheDesc.chain;
+    }
+
+    /// @brief Record that this process uses the shader, call it once per shader and process.
+    void StoreShader(size_t hash, std::string_view shaderScript)
+    {
+        auto path = m_directory / "shaders" / std::format("{:016x}.wgsl", hash);
+        std::error_code ec {};
+        if (std::filesystem::exists(path, ec)) {
+            Touch(path);
+            return;
+        }
+        WriteFile(path, { shaderScript.data(), shaderScript.length() }, {});
+        Evict(m_directory / "shaders", kMaxShaderCount);
+    }
+
+    std::vector<std::string> LoadShaders() const
+    {
+        std::vector<std::string> shaders {};
+        std::error_code ec {};
+        for (const auto& entry : std::filesystem::directory_iterator { m_directory / "shaders", ec }) {
+            if (entry.path().extension() == ".wgsl") {
+                auto in = std::ifstream { entry.path(), std::ios::binary };
+                shaders.emplace_back(std::istreambuf_iterator<char> { in }, std::istreambuf_iterator<char> {});
+            }
+        }
+        return shaders;
+    }
+
+private:
+    static size_t LoadData(const void* key, size_t keySize, void* value, size_t valueSize, void* userdata)
+    {
+        auto pThis = (GpuPipelineCache*)userdata;
+        auto in = std::ifstream { pThis->BlobPath(key, keySize), std::ios::binary };
+        uint64_t storedKeySize {};
+        if (!in.read((char*)&storedKeySize, sizeof(storedKeySize)) || storedKeySize != keySize) {
+            return 0;
+        }
+
+        // Different keys might have the same hash, so compare the whole key.
+        auto storedKey = std::string(keySize, '\0');
+        if (!in.read(storedKey.data(), keySize) || storedKey != std::string_view { (const char*)key, keySize }) {
+            return 0;
+        }
+
+        auto offset = in.tellg();
+        in.seekg(0, std::ios::end);
+        auto blobSize = (size_t)(in.tellg() - offset);
+        if (value && valueSize >= blobSize) {
+            in.seekg(offset);
+            if (!in.read((char*)value, blobSize)) {
+                return 0;
+            }
+            Touch(pThis->BlobPath(key, keySize));
+        }
+        return blobSize;
+    }
+
+    static void StoreData(const void* key, size_t keySize, const void* value, size_t valueSize, void* userdata)
+    {
+        auto pThis = (GpuPipelineCache*)userdata;
+        uint64_t storedKeySize { keySize };
+        auto header = std::string { (const char*)&storedKeySize, sizeof(storedKeySize) };
+        header.append((const char*)key, keySize);
+        pThis->WriteFile(pThis->BlobPath(key, keySize), header, { (const char*)value, valueSize });
+        Evict(pThis->m_blobDirectory, kMaxBlobCount);
+    }
+
+    // The modification time orders the files by their last use.
+    static void Touch(const std::filesystem::path& path)
+    {
+        std::error_code ec {};
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+    }
+
+    // Remove the least recently used files of directory beyond maxCount. Temporary files of writes in progress are
+    // left alone.
+    static void Evict(const std::filesystem::path& directory, size_t maxCount)
+    {
+        auto files = std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> {};
+        std::error_code ec {};
+        for (const auto& entry : std::filesystem::directory_iterator { directory, ec }) {
+            if (entry.is_regular_file(ec) && entry.path().extension() != ".tmp") {
+                files.emplace_back(entry.last_write_time(ec), entry.path());
+            }
+        }
+        if (files.size() <= maxCount) {
+            return;
+        }
+
+        auto evictCount = files.size() - maxCount;
+        std::ranges::nth_element(files, files.begin() + evictCount);
+        for (auto i = 0u; i < evictCount; ++i) {
+            std::filesystem::remove(files[i].second, ec);
+        }
+    }
+
+    std::filesystem::path BlobPath(const void* key, size_t keySize) const
+    {
+        return m_blobDirectory / std::format("{:016x}", std::hash<std::string_view> {}({ (const char*)key, keySize }));
+    }
+
+    static void WriteFile(const std::filesystem::path& path, std::string_view header, std::string_view data)
+    {
+        // Write to a temporary file then rename it, so other processes never see a partial file.
+        auto tmpPath = path;
+        tmpPath += std::format(".{}.tmp", getpid());
+        auto succeeded = false;
+        {
+            auto out = std::ofstream { tmpPath, std::ios::binary | std::ios::trunc };
+            succeeded = out.write(header.data(), header.length()) && out.write(data.data(), data.length());
+        }
+        std::error_code ec {};
+        if (succeeded) {
+            std::filesystem::rename(tmpPath, path, ec);
+        }
+        if (!succeeded || ec) {
+            std::filesystem::remove(tmpPath, ec);
+        }
+    }
+
+    std::filesystem::path m_directory {};
+    std::filesystem::path m_blobDirectory {};
+    std::string m_adapterKey {};
+    WGPUDawnCacheDeviceDescriptor m_cacheDesc {};
+};
+
+}
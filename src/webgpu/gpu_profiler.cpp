@@ -0,0 +1,150 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+export module webgpu:profiler;
+
+namespace webgpu {
+
+/// @brief Describes a dispatched kernel, op and dtype must be string literals.
+export struct KernelLabel {
+    const char* op {};
+    std::array<size_t, 3> shape {};
+    const char* dtype {};
+};
+
+/// @brief Accumulated cost of all dispatches which have the same op, shape and dtype.
+export struct KernelStats {
+    std::string op {};
+    std::string shape {};
+    std::string dtype {};
+    size_t dispatchCount {};
+
+    // Total GPU time measured by timestamp queries, it is only valid when hasGpuTime is true.
+    double gpuMicroseconds {};
+
+    // Total time spent on host (recording, submitting and waiting) which is not covered by GPU time.
+    double hostMicroseconds {};
+    bool hasGpuTime {};
+};
+
+/// @brief Collects per kernel GPU time (through timestamp queries) and host overhead of GpuAdapter::Execute().
+///
+/// It is disabled by default, set CPP_MATRIX_GPU_PROFILE=1 to enable it and dump the report to stderr at exit.
+export class GpuProfiler {
+public:
+    static GpuProfiler& GetInstance()
+    {
+        static GpuProfiler s_profiler {};
+        return s_profiler;
+    }
+
+    GpuProfiler()
+    {
+        if (auto* env = std::getenv("CPP_MATRIX_GPU_PROFILE"); env && std::string_view { env } == "1") {
+            m_isEnabled = true;
+            m_dumpAtExit = true;
+        }
+    }
+
+    ~GpuProfiler()
+    {
+        if (m_dumpAtExit) {
+            Dump(stderr);
+        }
+    }
+
+    void Enable(bool enable = true)
+    {
+        m_isEnabled = enable;
+    }
+
+    bool IsEnabled() const
+    {
+        return m_isEnabled;
+    }
+
+    void SetDumpAtExit(bool dumpAtExit)
+    {
+        m_dumpAtExit = dumpAtExit;
+    }
+
+    /// @brief Record one dispatch, gpuMicroseconds is empty if timestamp query is not supported by the device.
+    void Record(const KernelLabel& label, std::optional<double> gpuMicroseconds, double wallMicroseconds)
+    {
+        auto& stats = m_stats[{ label.op, label.shape, label.dtype }];
+        ++stats.dispatchCount;
+        if (gpuMicroseconds) {
+            stats.hasGpuTime = true;
+            stats.gpuMicroseconds += *gpuMicroseconds;
+            stats.hostMicroseconds += std::max(wallMicroseconds - *gpuMicroseconds, 0.);
+        } else {
+            stats.hostMicroseconds += wallMicroseconds;
+        }
+    }
+
+    void Reset()
+    {
+        m_stats.clear();
+    }
+
+    /// @brief Get the report, sorted by total GPU time (or host time if GPU time is not available) descending.
+    std::vector<KernelStats> GetReport() const
+    {
+        std::vector<KernelStats> report {};
+        for (const auto& [key, stats] : m_stats) {
+            const auto& [op, shape, dtype] = key;
+            auto& row = report.emplace_back(stats);
+            row.op = op;
+            row.dtype = dtype;
+            for (auto dim : shape) {
+                if (dim) {
+                    row.shape += row.shape.empty() ? std::to_string(dim) : std::format("x{}", dim);
+                }
+            }
+        }
+        std::ranges::sort(report, [](const auto& a, const auto& b) {
+            return std::tie(a.gpuMicroseconds, a.hostMicroseconds) > std::tie(b.gpuMicroseconds, b.hostMicroseconds);
+        });
+        return report;
+    }
+
+    void Dump(FILE* out) const
+    {
+        auto report = GetReport();
+        if (report.empty()) {
+            return;
+        }
+
+        fprintf(out, "%-16s %-16s %-5s %10s %14s %14s %14s\n", "op", "shape", "dtype", "dispatches", "gpu us",
+            "gpu us/op", "host us/op");
+        for (const auto& row : report) {
+            auto gpu = std::string { "n/a" };
+            auto gpuPerOp = std::string { "n/a" };
+            if (row.hasGpuTime) {
+                gpu = std::format("{:.1f}", row.gpuMicroseconds);
+                gpuPerOp = std::format("{:.1f}", row.gpuMicroseconds / row.dispatchCount);
+            }
+            fprintf(out, "%-16s %-16s %-5s %10zu %14s %14s %14.1f\n", row.op.c_str(), row.shape.c_str(),
+                row.dtype.c_str(), row.dispatchCount, gpu.c_str(), gpuPerOp.c_str(),
+                row.hostMicroseconds / row.dispatchCount);
+        }
+    }
+
+private:
+    bool m_isEnabled {};
+    bool m_dumpAtExit {};
+    std::map<std::tuple<std::string, std::array<size_t, 3>, std::string>, KernelStats> m_stats {};
+};
+
+}
@@ -1,7 +1,6 @@
 module;
 
 #include <cstddef>
-#include <future>
 #include <webgpu/webgpu.h>
 
 export module webgpu:gpu_ref_ptr;
@@ -126,14 +125,7 @@ export using GpuQueuePtr = gpu_ref_ptr<WGPUQueue, wgpuQueueAddRef, wgpuQueueRele
 export using GpuAdapterPtr = gpu_ref_ptr<WGPUAdapter, wgpuAdapterAddRef, wgpuAdapterRelease>;
 export using GpuShaderModule = gpu_ref_ptr<WGPUShaderModule, wgpuShaderModuleAddRef, wgpuShaderModuleRelease>;
 export using GpuShaderModulePtr = gpu_ref_ptr<WGPUShaderModule, wgpuShaderModuleAddRef, wgpuShaderModuleRelease>;
-
-template <typename T>
-T Wait(std::future<T>& future)
-{
-    while (future.wait_for(std::chrono::milliseconds {}) != std::future_status::ready) {
-        ProcessGpuInstanceEvents();
-    }
-    return future.get();
-}
+export using GpuComputePipelinePtr
+    = gpu_ref_ptr<WGPUComputePipeline, wgpuComputePipelineAddRef, wgpuComputePipelineRelease>;
 
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <format>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <webgpu/webgpu.h>
+
+export module webgpu:staging_ring;
+import :gpu_ref_ptr;
+import :memory_hook;
+import :wait;
+import trace;
+
+namespace webgpu {
+
+/// @brief A host visible buffer (MapRead or MapWrite) used to move data between host and GPU.
+export class GpuStagingBuffer {
+public:
+    GpuStagingBuffer(WGPUDevice device, WGPUBufferUsage usage, size_t byteSize)
+        : m_usage { usage }
+        , m_size { byteSize }
+        , m_pLease { LeaseBuffer(byteSize, "staging") }
+    {
+        // Upload buffers are always handed out mapped, so map them at creation.
+        auto bufferDesc = WGPUBufferDescriptor {
+            .usage = usage,
+            .size = byteSize,
+            .mappedAtCreation = IsUploadBuffer(),
+        };
+        trace::TraceInstant("webgpu", "CreateStagingBuffer", { .backend = "WebGpu", .bytes = byteSize });
+        m_pBuffer.reset(wgpuDeviceCreateBuffer(device, &bufferDesc));
+        m_isMapped = IsUploadBuffer();
+    }
+
+    GpuStagingBuffer(const GpuStagingBuffer&) = delete;
+    GpuStagingBuffer& operator=(const GpuStagingBuffer&) = delete;
+
+    ~GpuStagingBuffer()
+    {
+        // The map callback references this object, it must be fired before we go away.
+        WaitUntilSettled();
+    }
+
+    WGPUBuffer GetBuffer() const
+    {
+        return m_pBuffer.get();
+    }
+
+    size_t Size() const
+    {
+        return m_size;
+    }
+
+    bool IsUploadBuffer() const
+    {
+        return m_usage & WGPUBufferUsage_MapWrite;
+    }
+
+    bool IsPending() const
+    {
+        return m_isPending;
+    }
+
+    bool IsMapped() const
+    {
+        return m_isMapped;
+    }
+
+    /// @brief Request to map the first byteSize bytes, use Wait() or GetConstMappedRange() to get the result.
+    void MapAsync(size_t byteSize)
+    {
+        m_isPending = true;
+        m_mappedSize = byteSize;
+        m_mapPromise = std::promise<WGPUMapAsyncStatus> {};
+        m_mapFuture = m_mapPromise.get_future();
+        auto mode = IsUploadBuffer() ? WGPUMapMode_Write : WGPUMapMode_Read;
+        m_gpuFuture = wgpuBufferMapAsync(m_pBuffer.get(), mode, 0, byteSize,
+            { .mode = WGPUCallbackMode_AllowProcessEvents,
+                .callback =
+                    [](WGPUMapAsyncStatus status, struct WGPUStringView message, void* userdata1, void* userdata2) {
+                        // Settled last, the ring and the destructor may use the buffer once it is.
+                        auto pThis = (GpuStagingBuffer*)userdata1;
+                        pThis->m_isMapped = status == WGPUMapAsyncStatus_Success;
+                        pThis->m_mapPromise.set_value(status);
+                        pThis->m_isPending = false;
+                    },
+                .userdata1 = this });
+    }
+
+    /// @brief Request to know when the work submitted to queue so far is done, use Wait() to wait for it.
+    ///
+    /// A one-off upload buffer is not mapped again after its copy, this lets Wait() still wait for the copy.
+    void OnSubmittedWorkDone(WGPUQueue queue)
+    {
+        m_isPending = true;
+        m_mapPromise = std::promise<WGPUMapAsyncStatus> {};
+        m_mapFuture = m_mapPromise.get_future();
+        m_gpuFuture = wgpuQueueOnSubmittedWorkDone(queue,
+            { .mode = WGPUCallbackMode_AllowProcessEvents,
+                .callback =
+                    [](WGPUQueueWorkDoneStatus status, void* userdata1, void* userdata2) {
+                        auto pThis = (GpuStagingBuffer*)userdata1;
+                        pThis->m_mapPromise.set_value(status == WGPUQueueWorkDoneStatus_Success
+                                ? WGPUMapAsyncStatus_Success
+                                : WGPUMapAsyncStatus_Error);
+                        pThis->m_isPending = false;
+                    },
+                .userdata1 = this });
+    }
+
+    /// @brief Block (in wgpuInstanceWaitAny where it is supported) until the pending MapAsync() request finished, its
+    /// result is left to Wait().
+    void WaitUntilSettled()
+    {
+        WaitUntil([this] { return !m_isPending; }, m_gpuFuture, WaitMode::Block);
+    }
+
+    /// @brief Wait for the pending MapAsync() or OnSubmittedWorkDone() request.
+    void Wait()
+    {
+        if (m_mapFuture.valid()) {
+            auto scope = trace::TraceScope { "webgpu", "MapWait", { .bytes = m_mappedSize } };
+            if (auto status = webgpu::Wait(m_mapFuture, m_gpuFuture); status != WGPUMapAsyncStatus_Success) {
+                throw std::runtime_error { "Staging buffer request failed." };
+            }
+        }
+    }
+
+    const void* GetConstMappedRange()
+    {
+        Wait();
+        return wgpuBufferGetConstMappedRange(m_pBuffer.get(), 0, m_mappedSize);
+    }
+
+    void* GetMappedRange(size_t byteSize)
+    {
+        Wait();
+        return wgpuBufferGetMappedRange(m_pBuffer.get(), 0, byteSize);
+    }
+
+    void Unmap()
+    {
+        if (m_isMapped) {
+            wgpuBufferUnmap(m_pBuffer.get());
+            m_isMapped = false;
+        }
+    }
+
+private:
+    WGPUBufferUsage m_usage {};
+    size_t m_size {};
+    size_t m_mappedSize {};
+    // Map callbacks may fire on any thread which processes events, see GpuAdapter::IsThreadSafe().
+    std::atomic<bool> m_isPending {};
+    std::atomic<bool> m_isMapped {};
+    std::promise<WGPUMapAsyncStatus> m_mapPromise {};
+    std::future<WGPUMapAsyncStatus> m_mapFuture {};
+    WGPUFuture m_gpuFuture {};
+    std::shared_ptr<const void> m_pLease {};
+    gpu_ref_ptr<WGPUBuffer, wgpuBufferAddRef, wgpuBufferRelease> m_pBuffer {};
+};
+
+/// @brief A fixed number of staging buffers reused round-robin.
+///
+/// A staging buffer is handed out as a shared_ptr, it goes back to the ring once every holder released it and its
+/// pending map request finished. Upload buffers are handed out mapped, readback buffers unmapped. Buffers bigger than
+/// kMaxPooledBufferSize are one-off, the ring would otherwise keep up to kSlotCount of them alive forever.
+export class GpuStagingRing {
+public:
+    static constexpr size_t kSlotCount = 8;
+    static constexpr size_t kMinimumBufferSize = 256;
+    static constexpr size_t kMaxPooledBufferSize = 64 * 1024 * 1024;
+
+    GpuStagingRing() = default;
+
+    GpuStagingRing(WGPUDevice device, WGPUBufferUsage usage, size_t maxBufferSize)
+        : m_device { device }
+        , m_usage { usage }
+        , m_maxBufferSize { maxBufferSize }
+    {
+    }
+
+    /// @brief Whether a buffer of byteSize bytes (as returned by Size()) goes back to the ring after use.
+    static bool IsPooled(size_t byteSize)
+    {
+        return byteSize <= kMaxPooledBufferSize;
+    }
+
+    std::shared_ptr<GpuStagingBuffer> Acquire(size_t byteSize)
+    {
+        if (byteSize > m_maxBufferSize) {
+            throw std::runtime_error { std::format(
+                "Staging buffer is too big (required size is {}, limits is {}).", byteSize, m_maxBufferSize) };
+        }
+
+        // Round up so a slot fits the next few requests, but never past what the device can allocate.
+        byteSize = std::min(std::bit_ceil(std::max(byteSize, kMinimumBufferSize)), m_maxBufferSize);
+        if (!IsPooled(byteSize)) {
+            return std::make_shared<GpuStagingBuffer>(m_device, m_usage, byteSize);
+        }
+
+        for (;;) {
+            auto pPending = std::shared_ptr<GpuStagingBuffer> {};
+            for (auto i = 0u; i < m_slots.size(); ++i) {
+                auto index = (m_next + i) % m_slots.size();
+                auto& pSlot = m_slots[index];
+                if (pSlot.use_count() > 1) {
+                    continue;
+                }
+
+                if (pSlot->IsPending()) {
+                    pPending = pPending ? pPending : pSlot;
+                    continue;
+                }
+
+                if (pSlot->Size() < byteSize || (pSlot->IsUploadBuffer() && !pSlot->IsMapped())) {
+                    pSlot = std::make_shared<GpuStagingBuffer>(m_device, m_usage, byteSize);
+                } else if (!pSlot->IsUploadBuffer()) {
+                    // The result of a previous readback was never consumed.
+                    pSlot->Unmap();
+                }
+                m_next = index + 1;
+                return pSlot;
+            }
+
+            if (m_slots.size() < kSlotCount) {
+                return m_slots.emplace_back(std::make_shared<GpuStagingBuffer>(m_device, m_usage, byteSize));
+            }
+
+            if (!pPending) {
+                // Every slot is held by the caller, use a one-off buffer rather than waiting forever.
+                return std::make_shared<GpuStagingBuffer>(m_device, m_usage, byteSize);
+            }
+
+            // Sleep until the first pending slot comes back rather than polling events.
+            pPending->WaitUntilSettled();
+        }
+    }
+
+private:
+    WGPUDevice m_device {};
+    WGPUBufferUsage m_usage {};
+    size_t m_maxBufferSize {};
+    size_t m_next {};
+    std::vector<std::shared_ptr<GpuStagingBuffer>> m_slots {};
+};
+
+}
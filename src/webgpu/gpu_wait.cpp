@@ -0,0 +1,98 @@
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <future>
+#include <string_view>
+#include <thread>
+#include <webgpu/webgpu.h>
+
+export module webgpu:wait;
+
+namespace webgpu {
+
+/// @brief How the host waits for GPU operations.
+export enum class WaitMode {
+    /// Keep processing events until the operation is done, lowest latency but burns a whole CPU core.
+    Spin,
+
+    /// Spin for a short while, then sleep with exponential backoff between processing events.
+    Hybrid,
+
+    /// Block in wgpuInstanceWaitAny until the operation is done, falls back to Hybrid if it is not supported.
+    Block,
+};
+
+void ProcessGpuInstanceEvents();
+
+// Returns true if the future is completed (and its callback is fired), false if timed out or not supported.
+bool WaitGpuInstanceAny(WGPUFuture future, uint64_t timeoutNs);
+
+static WaitMode WaitModeFromEnvironment()
+{
+    auto* env = std::getenv("CPP_MATRIX_GPU_WAIT");
+    auto mode = std::string_view { env ? env : "" };
+    if (mode == "spin") {
+        return WaitMode::Spin;
+    } else if (mode == "block") {
+        return WaitMode::Block;
+    }
+    return WaitMode::Hybrid;
+}
+
+// Set by any thread, read by every wait.
+static std::atomic<WaitMode> s_waitMode = WaitModeFromEnvironment();
+
+/// @brief Set wait mode for all following GPU operations, default is Hybrid or CPP_MATRIX_GPU_WAIT (spin, hybrid or
+/// block) if it is set.
+export void SetWaitMode(WaitMode mode)
+{
+    s_waitMode.store(mode, std::memory_order_relaxed);
+}
+
+export WaitMode GetWaitMode()
+{
+    return s_waitMode.load(std::memory_order_relaxed);
+}
+
+/// @brief Wait until isDone() returns true, it is made true by the callback of the GPU call which returned gpuFuture.
+template <typename F>
+void WaitUntil(F&& isDone, WGPUFuture gpuFuture, WaitMode mode = GetWaitMode())
+{
+    // Most GPU operations we issue finish within this duration, spinning through it keeps their latency low.
+    constexpr auto kSpinDuration = std::chrono::microseconds { 50 };
+    constexpr auto kMinimumBackoff = std::chrono::microseconds { 10 };
+    constexpr auto kMaximumBackoff = std::chrono::microseconds { 1000 };
+    constexpr auto kBlockTimeoutNs = uint64_t { 100'000'000 };
+
+    auto start = std::chrono::steady_clock::now();
+    auto backoff = kMinimumBackoff;
+    while (!isDone()) {
+        if (mode == WaitMode::Block && gpuFuture.id && WaitGpuInstanceAny(gpuFuture, kBlockTimeoutNs)) {
+            continue;
+        }
+
+        ProcessGpuInstanceEvents();
+        if (mode == WaitMode::Spin || std::chrono::steady_clock::now() - start < kSpinDuration) {
+            continue;
+        }
+
+        if (!isDone()) {
+            std::this_thread::sleep_for(backoff);
+            backoff = std::min(backoff * 2, kMaximumBackoff);
+        }
+    }
+}
+
+/// @brief Wait for a future which is completed by a GPU callback, gpuFuture is returned by the same GPU call.
+template <typename T>
+T Wait(std::future<T>& future, WGPUFuture gpuFuture = {})
+{
+    WaitUntil([&] { return future.wait_for(std::chrono::milliseconds {}) == std::future_status::ready; }, gpuFuture);
+    return future.get();
+}
+
+}
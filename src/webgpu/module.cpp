@@ -3,4 +3,9 @@ module;
 export module webgpu;
 export import :gpu_ref_ptr;
 export import :gpu_instance;
+export import :memory_hook;
+export import :pipeline_cache;
+export import :profiler;
+export import :staging_ring;
+export import :wait;
 export import :webgpu;
\ No newline at end of file
@@ -6,12 +6,17 @@ module;
 export module webgpu:webgpu;
 import :gpu_instance;
 import :gpu_ref_ptr;
+import :profiler;
 
 namespace webgpu {
 
-export void Run(std::string_view shaderScript, std::span<Parameter> parameters, size_t N, size_t batchSize)
+/// @brief Run shaderScript, label identifies the kernel in GpuProfiler reports.
+///
+/// scalars are bound after parameters as a uniform array of vec4<u32>, see GpuAdapter::Execute().
+export void Run(const KernelLabel& label, std::string_view shaderScript, std::span<Parameter> parameters, size_t N,
+    size_t batchSize, std::span<const float> scalars = {})
 {
-    GpuInstance::GetInstance().GetAdapter()->Execute(shaderScript, parameters, N, batchSize);
+    GpuInstance::GetInstance().GetAdapter()->Execute(label, shaderScript, parameters, N, batchSize, scalars);
 }
 
 }
\ No newline at end of file
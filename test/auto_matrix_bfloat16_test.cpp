@@ -0,0 +1,9 @@
+#include <gtest/gtest.h>
+
+import cpp_matrix;
+
+#define MATRIX_TEST(X) TEST(AutoMatrixBFloat16Test, X)
+
+using Matrix = cpp_matrix::AutoMatrix<std::bfloat16_t>;
+
+#include "matrix_test.cpp"
@@ -0,0 +1,9 @@
+#include <gtest/gtest.h>
+
+import cpp_matrix;
+
+#define MATRIX_TEST(X) TEST(AutoMatrixFloat16Test, X)
+
+using Matrix = cpp_matrix::AutoMatrix<std::float16_t>;
+
+#include "matrix_test.cpp"
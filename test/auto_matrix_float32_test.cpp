@@ -0,0 +1,82 @@
+#include <filesystem>
+#include <gtest/gtest.h>
+
+import cpp_matrix;
+
+#define MATRIX_TEST(X) TEST(AutoMatrixFloat32Test, X)
+
+using Matrix = cpp_matrix::AutoMatrix<std::float32_t>;
+
+#include "matrix_test.cpp"
+
+/// @brief Restore the shared cost model when the scope ends, so measured or loaded costs survive the test.
+struct CostModelScope {
+    CostModelScope()
+        : saved { cpp_matrix::backend::CostModel::GetInstance() }
+    {
+    }
+
+    ~CostModelScope()
+    {
+        cpp_matrix::backend::CostModel::GetInstance() = saved;
+    }
+
+    cpp_matrix::backend::CostModel saved;
+};
+
+MATRIX_TEST(PlaceOpsByCost)
+{
+    using cpp_matrix::backend::CostModel;
+    using cpp_matrix::backend::Device;
+    using cpp_matrix::backend::OpKind;
+    using Backend = cpp_matrix::backend::AutoMatrix<std::float32_t>;
+
+    std::vector<float> data { 1, 2, 3, 4, 5, 6 };
+    Backend x { 2, 3 }, y { 3, 2 };
+    x.Write(data);
+    y.Write(data);
+
+    // Small ops stay on CPU, the GPU overhead is much bigger than the work.
+    auto restore = CostModelScope {};
+    auto& model = CostModel::GetInstance();
+    model.Reset();
+    auto z = x * y;
+    ASSERT_TRUE(z.IsOn(Device::Cpu));
+    ASSERT_FALSE(z.IsOn(Device::Gpu));
+
+    // Matmul and uploads are free on GPU, so operands are moved there and keep their CPU copy.
+    model.Set("f32", Device::Gpu, OpKind::MatMul, {});
+    model.Set("f32", Device::Gpu, OpKind::Transfer, {});
+    z = x * y;
+    ASSERT_TRUE(z.IsOn(Device::Gpu));
+    ASSERT_FALSE(z.IsOn(Device::Cpu));
+    ASSERT_TRUE(x.IsOn(Device::Cpu) && x.IsOn(Device::Gpu));
+    ASSERT_EQ(z.Read(), (std::vector<float> { 22, 28, 49, 64 }));
+
+    // Moving z back costs more than adding on GPU.
+    auto w = z + z;
+    ASSERT_TRUE(w.IsOn(Device::Gpu));
+    ASSERT_EQ(w.Read(), (std::vector<float> { 44, 56, 98, 128 }));
+}
+
+MATRIX_TEST(SaveAndLoadCostModel)
+{
+    using cpp_matrix::backend::CostModel;
+    using cpp_matrix::backend::Device;
+    using cpp_matrix::backend::OpKind;
+
+    auto path = std::filesystem::temp_directory_path() / "cpp_matrix_cost_model_test.txt";
+    auto model = CostModel {};
+    model.Set("f32", Device::Gpu, OpKind::MatMul, { 12.5, 0.25 });
+    model.Set("f16", Device::Cpu, OpKind::Transfer, { 3, 4 });
+    model.Save(path);
+
+    auto loaded = CostModel {};
+    ASSERT_TRUE(loaded.Load(path));
+    ASSERT_DOUBLE_EQ(loaded.Get("f32", Device::Gpu, OpKind::MatMul).overheadMicroseconds, 12.5);
+    ASSERT_DOUBLE_EQ(loaded.Get("f32", Device::Gpu, OpKind::MatMul).nanosecondsPerUnit, 0.25);
+    ASSERT_DOUBLE_EQ(loaded.Get("f16", Device::Cpu, OpKind::Transfer).Estimate(1000), 7);
+    std::filesystem::remove(path);
+
+    ASSERT_FALSE(loaded.Load(path));
+}
@@ -0,0 +1,9 @@
+#include <gtest/gtest.h>
+
+import cpp_matrix;
+
+#define MATRIX_TEST(X) TEST(CpuMatrixBFloat16Test, X)
+
+using Matrix = cpp_matrix::CpuMatrix<std::bfloat16_t>;
+
+#include "matrix_test.cpp"
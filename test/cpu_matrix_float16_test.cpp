@@ -6,4 +6,38 @@ import cpp_matrix;
 
 using Matrix = cpp_matrix::CpuMatrix<std::float16_t>;
 
-#include "matrix_test.cpp"
\ No newline at end of file
+#include "matrix_test.cpp"
+
+MATRIX_TEST(AccumulateInFloat32)
+{
+    // Summed in half precision, 784 values of 0.1 come to 78.19 instead of 78.38.
+    auto ones = std::vector<std::float16_t>(784 * 8, 1.0f16);
+    auto values = std::vector<std::float16_t>(784, 0.1f16);
+    auto a = Matrix { 1, 784, values };
+    auto expected = 784 * static_cast<float>(0.1f16);
+
+    // 8 columns take the packed kernel, 1 column the dot product.
+    for (auto column : { 8u, 1u }) {
+        for (auto v : (a * Matrix { 784, column, std::span { ones.data(), 784 * column } }).Read()) {
+            ASSERT_NEAR(v, expected, 0.05);
+        }
+    }
+    ASSERT_NEAR((a.Sum()[0, 0]), expected, 0.05);
+    ASSERT_NEAR((a.RowSum()[0, 0]), expected, 0.05);
+}
+
+MATRIX_TEST(DeepPackedProduct)
+{
+    // Deeper than the stack strip which f16 blocks of b are widened into, with a partial block of 3 columns.
+    constexpr size_t k = 1500, columns = 11;
+    auto quarters = std::vector<std::float16_t>(3 * k, 0.25f16);
+    auto a = Matrix { 3, k, quarters };
+    auto data = std::vector<std::float16_t>(k * columns);
+    for (auto i = 0u; i < data.size(); ++i) {
+        data[i] = static_cast<std::float16_t>(i % columns);
+    }
+    auto res = (a * Matrix { k, columns, data }).Read();
+    for (auto i = 0u; i < res.size(); ++i) {
+        ASSERT_NEAR(res[i], 0.25f * k * (i % columns), 2);
+    }
+}
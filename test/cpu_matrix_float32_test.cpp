@@ -1,9 +1,371 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
 #include <gtest/gtest.h>
 
 import cpp_matrix;
+import trace;
 
 #define MATRIX_TEST(X) TEST(CpuMatrixFloat32Test, X)
 
 using Matrix = cpp_matrix::CpuMatrix<std::float32_t>;
 
-#include "matrix_test.cpp"
\ No newline at end of file
+#include "matrix_test.cpp"
+
+/// @brief Set a memory budget for the scope, the previous one is restored even when an assertion returns early.
+struct MemoryBudgetScope {
+    MemoryBudgetScope(cpp_matrix::backend::MemoryKind kind, size_t bytes)
+        : kind { kind }
+        , previous { cpp_matrix::backend::MemoryTracker::GetInstance().GetBudget(kind) }
+    {
+        cpp_matrix::backend::MemoryTracker::GetInstance().SetBudget(kind, bytes);
+    }
+
+    ~MemoryBudgetScope()
+    {
+        cpp_matrix::backend::MemoryTracker::GetInstance().SetBudget(kind, previous);
+    }
+
+    cpp_matrix::backend::MemoryKind kind;
+    size_t previous;
+};
+
+MATRIX_TEST(Trace)
+{
+    auto& tracer = trace::Tracer::GetInstance();
+    auto wasEnabled = trace::Tracer::IsEnabled();
+    tracer.Reset();
+    trace::Tracer::Enable();
+    auto x = Matrix::Random(3, 4);
+    auto y = x * x.Transpose();
+    trace::Tracer::Enable(false);
+
+    // Nothing is recorded while it is disabled.
+    y = y.Sigmoid();
+    trace::Tracer::Enable(wasEnabled);
+
+    auto json = tracer.ToJson();
+    ASSERT_TRUE(json.starts_with(R"({"traceEvents": [)"));
+    ASSERT_NE(json.find(R"("name": "Allocate", "cat": "cpu", "ph": "i")"), std::string::npos);
+    ASSERT_NE(json.find(R"("name": "Random", "cat": "matrix", "ph": "X")"), std::string::npos);
+    ASSERT_NE(json.find(R"("name": "MatMul", "cat": "matrix", "ph": "X")"), std::string::npos);
+
+    // 3x4 times 4x3: both operands are read and the 3x3 result is written.
+    ASSERT_NE(json.find(R"("shape": "3x4x3", "dtype": "f32", "backend": "Cpu", "bytes": 132)"), std::string::npos);
+    ASSERT_EQ(json.find(R"("name": "Sigmoid")"), std::string::npos);
+}
+
+MATRIX_TEST(CpuProfiler)
+{
+    auto& profiler = cpp_matrix::backend::CpuProfiler::GetInstance();
+    auto wasEnabled = profiler.IsEnabled();
+    profiler.Reset();
+    profiler.Enable();
+    auto x = Matrix::Random(3, 5);
+    auto y = Matrix::Random(5, 3);
+    auto z = x * y;
+    profiler.Enable(wasEnabled);
+
+    // Hardware counters may not be available (e.g. in a container), so only the op accounting is checked.
+    auto report = profiler.GetReport();
+    auto it = std::ranges::find_if(report, [](const auto& row) { return row.op == "MatMul"; });
+    ASSERT_NE(it, report.end());
+    ASSERT_EQ(it->shape, "4x8x4");
+    ASSERT_EQ(it->dtype, "f32");
+    ASSERT_EQ(it->callCount, 1);
+    ASSERT_DOUBLE_EQ(it->flops, 2 * 3 * 5 * 3);
+    ASSERT_DOUBLE_EQ(it->bytes, (15 + 15 + 9) * sizeof(float));
+}
+
+MATRIX_TEST(MemoryTracker)
+{
+    using cpp_matrix::backend::MemoryKind;
+    auto& tracker = cpp_matrix::backend::MemoryTracker::GetInstance();
+    auto live = tracker.GetStats(MemoryKind::Host).liveBytes;
+    {
+        auto tag = cpp_matrix::backend::MemoryTag { "test" };
+        auto x = Matrix { 100, 200 };
+        auto y = x;
+
+        // Padding of rows is accounted too.
+        auto bytes = 100 * x.View().Stride() * sizeof(float);
+        ASSERT_EQ(tracker.GetStats(MemoryKind::Host).liveBytes, live + 2 * bytes);
+        ASSERT_GE(tracker.GetStats(MemoryKind::Host).peakBytes, live + 2 * bytes);
+
+        auto largest = tracker.GetLargestAllocations(1);
+        ASSERT_EQ(largest.size(), 1);
+        ASSERT_EQ(largest[0].bytes, bytes);
+        ASSERT_EQ(largest[0].shape, (std::array<size_t, 2> { 100, 200 }));
+        ASSERT_EQ(largest[0].tag, "test");
+    }
+    ASSERT_EQ(tracker.GetStats(MemoryKind::Host).liveBytes, live);
+
+    // Over the budget, it throws before allocating.
+    {
+        auto budget = MemoryBudgetScope { MemoryKind::Host, live + 1024 };
+        ASSERT_THROW((Matrix { 100, 200 }), std::runtime_error);
+    }
+    ASSERT_EQ(tracker.GetStats(MemoryKind::Host).liveBytes, live);
+}
+
+MATRIX_TEST(LoadBorrowsMappedPages)
+{
+    auto path = std::filesystem::temp_directory_path() / "cpp_matrix_borrow_test.bin";
+    auto x = Matrix::Random(64, 32);
+    {
+        auto writer = cpp_matrix::MatrixFileWriter { path };
+        x.Save(writer, "x");
+        writer.Close();
+    }
+
+    using cpp_matrix::backend::MemoryKind;
+    auto& tracker = cpp_matrix::backend::MemoryTracker::GetInstance();
+    auto live = tracker.GetStats(MemoryKind::Host).liveBytes;
+    auto loaded = Matrix::Load(cpp_matrix::MatrixFile::Open(path), "x");
+
+    // No copy: nothing is allocated, and the matrix outlives the MatrixFile which mapped it.
+    ASSERT_EQ(tracker.GetStats(MemoryKind::Host).liveBytes, live);
+    ASSERT_EQ(loaded.Read(), x.Read());
+
+    auto file = cpp_matrix::MatrixFile::Open(path);
+    ASSERT_THROW(file.GetData<std::float16_t>("x"), std::runtime_error);
+    std::filesystem::remove(path);
+}
+
+MATRIX_TEST(LoadsDoNotShareUpdates)
+{
+    auto path = std::filesystem::temp_directory_path() / "cpp_matrix_private_load_test.bin";
+    auto x = Matrix::Random(64, 32);
+    {
+        auto writer = cpp_matrix::MatrixFileWriter { path };
+        x.Save(writer, "x");
+        writer.Close();
+    }
+
+    // Both borrow pages of the same entry, an in place update of one must reach neither the other nor the file.
+    auto file = cpp_matrix::MatrixFile::Open(path);
+    auto a = Matrix::Load(file, "x");
+    auto b = Matrix::Load(file, "x");
+    a += x;
+    ASSERT_EQ(b.Read(), x.Read());
+    ASSERT_EQ((a - x).Read(), x.Read());
+    ASSERT_TRUE(file.Verify());
+    ASSERT_TRUE(cpp_matrix::MatrixFile::Open(path).Verify());
+    std::filesystem::remove(path);
+}
+
+MATRIX_TEST(MatrixView)
+{
+    using Kernels = cpp_matrix::backend::CpuKernels<std::float32_t>;
+    std::vector<std::float32_t> data(4 * 6);
+    for (auto i = 0u; i < data.size(); ++i) {
+        data[i] = (std::float32_t)i;
+    }
+    Matrix x { 4, 6, data };
+
+    // Slices are views of the same elements.
+    auto block = x.View().Block(1, 2, 2, 3);
+    ASSERT_EQ(block.Stride(), 6);
+    ASSERT_FALSE(block.IsContiguous());
+    ASSERT_EQ((block[0, 0]), 8);
+    ASSERT_EQ((block[1, 2]), 16);
+    ASSERT_EQ((x.View().Rows(2, 4)[0, 1]), 13);
+    ASSERT_EQ((x.View().Columns(5, 6)[3, 0]), 23);
+    ASSERT_THROW(x.View().Rows(3, 5), std::runtime_error);
+    ASSERT_EQ(Matrix { block }.Read(), (std::vector<std::float32_t> { 8, 9, 10, 14, 15, 16 }));
+
+    // Kernels read and write parts of matrices in place, the rest of the output is untouched.
+    auto y = Matrix { 4, 6 };
+    Kernels::Add(x.View().Columns(0, 3), x.View().Columns(3, 6), y.View().Columns(3, 6));
+    ASSERT_EQ((y[0, 2]), 0);
+    ASSERT_EQ((y[0, 3]), 0 + 3);
+    ASSERT_EQ((y[3, 5]), 20 + 23);
+
+    auto product = Matrix { 2, 2 };
+    Kernels::MatMul(x.View().Block(0, 0, 2, 3), x.View().Block(1, 1, 3, 2), product.View());
+    auto expected = Matrix { x.View().Block(0, 0, 2, 3) } * Matrix { x.View().Block(1, 1, 3, 2) };
+    ASSERT_EQ(product.Read(), expected.Read());
+
+    auto transposed = Matrix { 3, 2 };
+    Kernels::Transpose(block, transposed.View());
+    ASSERT_EQ(transposed.Read(), (std::vector<std::float32_t> { 8, 14, 9, 15, 10, 16 }));
+
+    auto sums = Matrix { 1, 3 };
+    Kernels::ColumnSum(block, sums.View());
+    ASSERT_EQ(sums.Read(), (std::vector<std::float32_t> { 22, 24, 26 }));
+    ASSERT_EQ(Kernels::Sum(block), 72);
+    ASSERT_EQ(Kernels::ArgMax(block), (std::vector<size_t> { 1, 1, 1 }));
+    ASSERT_THROW(Kernels::Add(block, x.View().Rows(0, 2), y.View().Rows(0, 2)), std::runtime_error);
+}
+
+MATRIX_TEST(PaddedStride)
+{
+    // Rows start on a cache line and power of two strides are skewed, shapes and values are unchanged.
+    for (auto column : { 3u, 16u, 100u, 128u, 1024u }) {
+        auto x = Matrix::Random(5, column);
+        auto view = x.View();
+        ASSERT_GE(view.Stride(), column);
+        if (column >= 16) {
+            ASSERT_EQ(view.Stride() * sizeof(float) % 64, 0);
+            ASSERT_NE(view.Stride() * sizeof(float) % 512, 0);
+            ASSERT_EQ((uintptr_t)view.RowData(1) % 64, 0);
+        }
+
+        auto data = x.Read();
+        ASSERT_EQ(data.size(), 5 * column);
+        ASSERT_EQ((x[4, column - 1]), data.back());
+        ASSERT_EQ(Matrix { x.View() }.Read(), data);
+        ASSERT_EQ((x + x).Read(), (2.0f * Matrix { 5, column, data }).Read());
+        ASSERT_EQ(x.Transpose().Transpose().Read(), data);
+    }
+
+    // Vectors are not padded.
+    ASSERT_EQ(Matrix { 100, 1 }.View().Stride(), 1);
+    ASSERT_EQ(Matrix { 1, 100 }.View().Stride(), 100);
+}
+
+MATRIX_TEST(Pack)
+{
+    // A plain triple loop over the elements, independent of every MatMul kernel.
+    auto reference = [](const Matrix& a, const Matrix& b) {
+        auto x = a.Read();
+        auto y = b.Read();
+        auto out = std::vector<float>(a.Row() * b.Column());
+        for (auto r = 0u; r < a.Row(); ++r) {
+            for (auto c = 0u; c < b.Column(); ++c) {
+                for (auto k = 0u; k < a.Column(); ++k) {
+                    out[r * b.Column() + c] += x[r * a.Column() + k] * y[k * b.Column() + c];
+                }
+            }
+        }
+        return out;
+    };
+    auto expectNear = [](const Matrix& a, const std::vector<float>& expected) {
+        auto x = a.Read();
+        ASSERT_EQ(x.size(), expected.size());
+        for (auto i = 0u; i < x.size(); ++i) {
+            ASSERT_NEAR(x[i], expected[i], 1e-4);
+        }
+    };
+
+    // 13 rows leave a partial panel, products of 1, 5 and 11 columns take every path of the kernel. The second
+    // product reuses the panels packed by the first.
+    auto weights = Matrix::Random(13, 20);
+    weights.Pack();
+    for (auto column : { 1u, 5u, 11u }) {
+        auto inputs = Matrix::Random(20, column);
+        expectNear(weights * inputs, reference(weights, inputs));
+        expectNear(weights * inputs, reference(weights, inputs));
+    }
+
+    // Updates repack before the next product.
+    auto inputs = Matrix::Random(20, 5);
+    weights += weights;
+    expectNear(weights * inputs, reference(weights, inputs));
+
+    auto copy = weights;
+    auto data = std::vector<std::float32_t>(13 * 20, 1.0f);
+    copy.Write(std::span { data });
+    expectNear(weights * inputs, reference(weights, inputs));
+    expectNear(copy * inputs, reference(copy, inputs));
+
+    // Without the hint, products use the elements as they are.
+    weights.Unpack();
+    weights += weights;
+    expectNear(weights * inputs, reference(weights, inputs));
+}
+
+MATRIX_TEST(QuantizedMatMul)
+{
+    using Kernels = cpp_matrix::backend::CpuKernels<std::float32_t>;
+    auto weights = Matrix::Random(13, 20) - 0.5f;
+    auto inputs = Matrix::Random(20, 5);
+    auto expected = weights * inputs;
+
+    auto calibrator = cpp_matrix::backend::QuantizationCalibrator {};
+    calibrator.Observe(inputs.View());
+    auto quantized = cpp_matrix::backend::QuantizedMatrix { weights.View() };
+    ASSERT_EQ(quantized.Row(), 13);
+    ASSERT_EQ(quantized.Column(), 20);
+
+    // Each product is off by at most half a level of either operand, a level is at most 1/127 of 0.5 or 1.
+    auto product = Matrix { 13, 5 };
+    Kernels::QuantizedMatMul(quantized, inputs.View(), calibrator.Scale(), product.View());
+    auto tolerance = 20 * (0.5 / 127 / 2 + 1.0 / 127 / 2 * 0.5);
+    for (auto r = 0u; r < 13; ++r) {
+        for (auto c = 0u; c < 5; ++c) {
+            ASSERT_NEAR((product[r, c]), (expected[r, c]), tolerance);
+        }
+    }
+
+    // The fused sigmoid is Sigmoid() of the dequantized product.
+    auto activated = Matrix { 13, 5 };
+    Kernels::QuantizedMatMul(quantized, inputs.View(), calibrator.Scale(), activated.View(), /*sigmoid=*/true);
+    auto sigmoid = product.Sigmoid();
+    for (auto r = 0u; r < 13; ++r) {
+        for (auto c = 0u; c < 5; ++c) {
+            ASSERT_NEAR((activated[r, c]), (sigmoid[r, c]), 1e-6);
+        }
+    }
+
+    // Inputs beyond the calibrated range saturate, rows of zeros stay zero.
+    ASSERT_EQ(cpp_matrix::backend::QuantizedMatrix::Quantize(3.f, calibrator.Scale()), 127);
+    auto zeros = cpp_matrix::backend::QuantizedMatrix { Matrix { 2, 20 }.View() };
+    auto zeroProduct = Matrix { 2, 5 };
+    Kernels::QuantizedMatMul(zeros, inputs.View(), calibrator.Scale(), zeroProduct.View());
+    ASSERT_EQ(zeroProduct.Read(), std::vector<std::float32_t>(10, 0));
+    ASSERT_THROW(Kernels::QuantizedMatMul(quantized, weights.View(), 1.f, product.View()), std::runtime_error);
+}
+
+MATRIX_TEST(LossScaler)
+{
+    auto scaler = cpp_matrix::LossScaler { /*maxScale=*/8, /*growthInterval=*/3 };
+    ASSERT_EQ(scaler.Scale(), 8);
+
+    // An overflow skips the step and halves the scale.
+    ASSERT_FALSE(scaler.Update(false));
+    ASSERT_EQ(scaler.Scale(), 4);
+    ASSERT_EQ(scaler.SkippedSteps(), 1);
+
+    // It doubles after growthInterval good steps in a row, an overflow restarts the count.
+    ASSERT_TRUE(scaler.Update(true));
+    ASSERT_TRUE(scaler.Update(true));
+    ASSERT_FALSE(scaler.Update(false));
+    ASSERT_EQ(scaler.Scale(), 2);
+    for (auto i = 0; i < 3; ++i) {
+        ASSERT_TRUE(scaler.Update(true));
+    }
+    ASSERT_EQ(scaler.Scale(), 4);
+    for (auto i = 0; i < 6; ++i) {
+        ASSERT_TRUE(scaler.Update(true));
+    }
+    ASSERT_EQ(scaler.Scale(), 8);
+
+    // Never above maxScale.
+    for (auto i = 0; i < 3; ++i) {
+        ASSERT_TRUE(scaler.Update(true));
+    }
+    ASSERT_EQ(scaler.Scale(), 8);
+
+    // Never below kMinScale, an overflow at it throws instead.
+    for (auto i = 0; i < 3; ++i) {
+        ASSERT_FALSE(scaler.Update(false));
+    }
+    ASSERT_EQ(scaler.Scale(), cpp_matrix::LossScaler::kMinScale);
+    ASSERT_THROW(scaler.Update(false), std::runtime_error);
+    ASSERT_EQ(scaler.SkippedSteps(), 5);
+
+    // A restored scaler continues where the saved one stopped.
+    auto restored = cpp_matrix::LossScaler { /*maxScale=*/8, /*growthInterval=*/3 };
+    restored.Restore(2, 2, 7);
+    ASSERT_EQ(restored.Scale(), 2);
+    ASSERT_EQ(restored.StepsWithoutOverflow(), 2);
+    ASSERT_EQ(restored.SkippedSteps(), 7);
+    ASSERT_TRUE(restored.Update(true));
+    ASSERT_EQ(restored.Scale(), 4);
+    ASSERT_EQ(restored.StepsWithoutOverflow(), 0);
+    ASSERT_THROW(restored.Restore(16, 0, 0), std::runtime_error);
+    ASSERT_THROW(restored.Restore(0.5f, 0, 0), std::runtime_error);
+    ASSERT_THROW(restored.Restore(4, 3, 0), std::runtime_error);
+}
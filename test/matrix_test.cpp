@@ -1,11 +1,19 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
 #include <format>
+#include <future>
 #include <span>
+#include <utility>
 
 static constexpr Matrix::ElementType operator""_mf(long double v)
 {
     return v;
 }
 
+// f16 and bf16 are too coarse for the cumulative error of large cases.
+static constexpr bool kIsLowPrecision = !std::is_same_v<Matrix::ElementType, std::float32_t>;
+
 MATRIX_TEST(DefaultConstructor)
 {
     Matrix x {};
@@ -283,8 +291,8 @@ MATRIX_TEST(MatrixSub)
     test(100, 100, 0.2_mf);
     test(100, 100, 0.3_mf);
 
-    if (std::is_same_v<Matrix::ElementType, std::float16_t>) {
-        // Ignore following test cases for float16_t, the precision is too low and
+    if (kIsLowPrecision) {
+        // Ignore following test cases for float16_t and bfloat16_t, the precision is too low and
         // the cumulative error precision is big.
         return;
     }
@@ -336,8 +344,8 @@ MATRIX_TEST(MatrixSubScalar)
 
 MATRIX_TEST(MatrixMul)
 {
-    if (std::is_same_v<Matrix::ElementType, std::float16_t>) {
-        // Ignore this test for float16_t, the precision is too low and
+    if (kIsLowPrecision) {
+        // Ignore this test for float16_t and bfloat16_t, the precision is too low and
         // the cumulative error precision is big.
         return;
     }
@@ -395,8 +403,8 @@ MATRIX_TEST(MatrixMul)
 
 MATRIX_TEST(MatrixElementProduct)
 {
-    if (std::is_same_v<Matrix::ElementType, std::float16_t>) {
-        // Ignore this test for float16_t, the precision is too low and
+    if (kIsLowPrecision) {
+        // Ignore this test for float16_t and bfloat16_t, the precision is too low and
         // the cumulative error precision is big.
         return;
     }
@@ -529,9 +537,14 @@ MATRIX_TEST(MatrixSigmoid)
     ASSERT_EQ(z.Column(), 1);
 
     auto res = z.Read();
-    ASSERT_FLOAT_EQ(res[0], 0.76133269_mf);
-    ASSERT_FLOAT_EQ(res[1], 0.60348326_mf);
-    ASSERT_FLOAT_EQ(res[2], 0.65021855_mf);
+    auto expected = std::vector { 0.76133269_mf, 0.60348326_mf, 0.65021855_mf };
+    if (std::is_same_v<Matrix::ElementType, std::bfloat16_t>) {
+        // bf16 rounds the inputs enough to change the rounded result, so it is the sigmoid of the stored inputs.
+        std::ranges::transform(initData, expected.begin(), [](float v) { return 1 / (1 + std::exp(-v)); });
+    }
+    ASSERT_FLOAT_EQ(res[0], expected[0]);
+    ASSERT_FLOAT_EQ(res[1], expected[1]);
+    ASSERT_FLOAT_EQ(res[2], expected[2]);
 }
 
 MATRIX_TEST(MatrixTranspose)
@@ -553,7 +566,7 @@ MATRIX_TEST(MatrixTranspose)
         auto res = z.Read();
         for (auto n = 0; n < N; ++n) {
             for (auto m = 0; m < M; ++m) {
-                ASSERT_FLOAT_EQ(res[n * M + m], m * 100 + n);
+                ASSERT_FLOAT_EQ(res[n * M + m], initData[m * N + n]);
             }
         }
     };
@@ -565,6 +578,35 @@ MATRIX_TEST(MatrixTranspose)
     }
 }
 
+MATRIX_TEST(Cast)
+{
+    auto test = [](size_t M, size_t N) {
+        // Integers below 256 are exact in every element type.
+        std::vector<Matrix::ElementType> initData(M * N);
+        for (auto i = 0u; i < initData.size(); ++i) {
+            initData[i] = (Matrix::ElementType)(i % 256);
+        }
+        Matrix x { M, N, initData };
+
+        auto expect = [&](const auto& y) {
+            ASSERT_EQ(y.Row(), M);
+            ASSERT_EQ(y.Column(), N);
+            auto res = y.Read();
+            for (auto i = 0u; i < initData.size(); ++i) {
+                ASSERT_EQ((float)res[i], (float)initData[i]);
+            }
+        };
+        expect(x.template Cast<std::float32_t>());
+        expect(x.template Cast<std::float16_t>());
+        expect(x.template Cast<std::bfloat16_t>());
+        expect(x.template Cast<std::float32_t>().template Cast<Matrix::ElementType>());
+    };
+
+    for (auto [m, n] : std::vector<std::pair<size_t, size_t>> { { 1, 1 }, { 3, 5 }, { 8, 8 }, { 17, 30 } }) {
+        test(m, n);
+    }
+}
+
 MATRIX_TEST(Relu)
 {
     auto test = [](size_t row, size_t column) {
@@ -593,4 +635,375 @@ MATRIX_TEST(Relu)
             test(m, n);
         }
     }
-}
\ No newline at end of file
+}
+
+MATRIX_TEST(ReadAndWriteAsync)
+{
+    auto test = [](size_t row, size_t column) {
+        std::vector<Matrix> matrices {};
+        std::vector<std::vector<Matrix::ElementType>> initDatas {};
+        for (auto n = 0; n < 10; ++n) {
+            std::vector<Matrix::ElementType> initData(row * column);
+            for (auto i = 0; i < row * column; ++i) {
+                initData[i] = (n + i) % 100;
+            }
+
+            Matrix x { row, column };
+            x.WriteAsync(std::span<Matrix::ElementType> { initData }).get();
+            matrices.push_back(std::move(x));
+            initDatas.push_back(std::move(initData));
+        }
+
+        // Keep every readback in flight before consuming any of them.
+        std::vector<std::future<std::vector<Matrix::ElementType>>> futures {};
+        for (const auto& x : matrices) {
+            futures.push_back(x.ReadAsync());
+        }
+
+        for (auto n = 0; n < futures.size(); ++n) {
+            auto res = futures[n].get();
+            ASSERT_EQ(res.size(), row * column);
+            for (auto i = 0; i < row * column; ++i) {
+                ASSERT_FLOAT_EQ(res[i], initDatas[n][i]);
+            }
+        }
+    };
+
+    test(1, 1);
+    test(3, 5);
+    test(17, 9);
+    test(100, 100);
+}
+
+MATRIX_TEST(ReadAndWriteLargeMatrix)
+{
+    // Big enough to let backend convert layout on GPU.
+    auto test = [](size_t row, size_t column) {
+        std::vector<Matrix::ElementType> initData(row * column);
+        for (auto i = 0; i < row * column; ++i) {
+            initData[i] = i % 1000;
+        }
+
+        Matrix x { row, column };
+        x.Write(std::span<Matrix::ElementType> { initData });
+        ASSERT_FLOAT_EQ((x[row - 1, column - 1]), initData.back());
+
+        auto res = x.Read();
+        ASSERT_EQ(res.size(), row * column);
+        for (auto i = 0; i < row * column; ++i) {
+            ASSERT_FLOAT_EQ(res[i], initData[i]);
+        }
+
+        auto y = x.Transpose().Transpose();
+        res = y.Read();
+        for (auto i = 0; i < row * column; ++i) {
+            ASSERT_FLOAT_EQ(res[i], initData[i]);
+        }
+    };
+
+    test(128, 128);
+    test(129, 131);
+    test(1, 20000);
+    test(20000, 1);
+    test(1000, 1000);
+}
+
+MATRIX_TEST(FusedExpression)
+{
+    auto tolerance = std::is_same_v<Matrix::ElementType, std::float32_t> ? 1e-5
+        : std::is_same_v<Matrix::ElementType, std::float16_t>            ? 1e-2
+                                                                         : 3e-2;
+    auto test = [tolerance](size_t row, size_t column) {
+        std::vector<Matrix::ElementType> errData(row * column);
+        std::vector<Matrix::ElementType> outData(row * column);
+        for (auto i = 0; i < row * column; ++i) {
+            errData[i] = (i % 7) / 7.0 - 0.5;
+            outData[i] = (i % 11) / 11.0;
+        }
+
+        Matrix err { row, column, errData };
+        Matrix out { row, column, outData };
+
+        // Same result as the unfused operations.
+        auto z = (err.Fuse() * out * (1.0_mf - out.Fuse())).Evaluate();
+        ASSERT_EQ(z.Row(), row);
+        ASSERT_EQ(z.Column(), column);
+        auto expected = err.ElementProduct(out).ElementProduct(1.0_mf - out).Read();
+        auto res = z.Read();
+        ASSERT_EQ(res.size(), row * column);
+        for (auto i = 0; i < row * column; ++i) {
+            ASSERT_NEAR(res[i], expected[i], tolerance);
+        }
+
+        res = (0.5_mf * (err.Fuse() + out).Sigmoid() - err.Fuse().Relu() + 0.25_mf).Evaluate().Read();
+        auto sigmoid = (err + out).Sigmoid().Read();
+        for (auto i = 0; i < row * column; ++i) {
+            auto v = 0.5 * sigmoid[i] - std::max<double>(errData[i], 0) + 0.25;
+            ASSERT_NEAR(res[i], v, tolerance);
+        }
+
+        // Padding of the result must stay zero, otherwise the matrix product picks it up.
+        auto ones = (0.0_mf * out.Fuse() + 1.0_mf).Evaluate();
+        auto product = (ones.Transpose() * ones).Read();
+        for (const auto& v : product) {
+            ASSERT_NEAR(v, row, tolerance * row);
+        }
+    };
+
+    test(1, 1);
+    test(3, 5);
+    test(17, 9);
+    test(100, 100);
+}
+
+MATRIX_TEST(FusedExpressionShapeMismatch)
+{
+    Matrix x { 2, 3 };
+    Matrix y { 3, 2 };
+    ASSERT_THROW((x.Fuse() + y).Evaluate(), std::runtime_error);
+}
+
+MATRIX_TEST(FusedExpressionInPlace)
+{
+    auto test = [](size_t row, size_t column) {
+        std::vector<Matrix::ElementType> xData(row * column);
+        std::vector<Matrix::ElementType> yData(row * column);
+        for (auto i = 0; i < row * column; ++i) {
+            xData[i] = (i % 5) * 0.25;
+            yData[i] = (i % 3) * 0.5;
+        }
+
+        // x is read for the right operand after the left one is computed, so it must not be overwritten before.
+        Matrix x { row, column, xData };
+        Matrix y { row, column, yData };
+        (y.Fuse() - 2.0_mf * x.Fuse()).Evaluate(x);
+        ASSERT_EQ(x.Row(), row);
+        ASSERT_EQ(x.Column(), column);
+        auto res = x.Read();
+        for (auto i = 0; i < row * column; ++i) {
+            ASSERT_FLOAT_EQ(res[i], yData[i] - 2 * xData[i]);
+        }
+
+        Matrix z { row, column };
+        (x.Fuse() + y).Evaluate(z);
+        res = z.Read();
+        for (auto i = 0; i < row * column; ++i) {
+            ASSERT_FLOAT_EQ(res[i], 2 * yData[i] - 2 * xData[i]);
+        }
+
+        y += y;
+        res = y.Read();
+        for (auto i = 0; i < row * column; ++i) {
+            ASSERT_FLOAT_EQ(res[i], 2 * yData[i]);
+        }
+    };
+
+    test(1, 1);
+    test(17, 9);
+    test(3, 300);
+
+    Matrix x { 2, 3 };
+    Matrix y { 3, 2 };
+    ASSERT_THROW(x.Fuse().Evaluate(y), std::runtime_error);
+}
+
+MATRIX_TEST(ScalarChangesBetweenOperations)
+{
+    // Kernels are reused with different scalars, every result must see its own scalar.
+    std::vector<Matrix::ElementType> initData { 1.0_mf, 2.0_mf, 3.0_mf, 4.0_mf, 5.0_mf };
+    Matrix x { 1, 5, initData };
+    std::vector<Matrix> results {};
+    for (auto n = 0; n < 8; ++n) {
+        results.push_back(x + Matrix::ElementType(n));
+        results.push_back(Matrix::ElementType(n) * x);
+        results.push_back((Matrix::ElementType(n) - x.Fuse()).Evaluate());
+    }
+
+    for (auto n = 0; n < 8; ++n) {
+        auto sum = results[n * 3].Read();
+        auto product = results[n * 3 + 1].Read();
+        auto difference = results[n * 3 + 2].Read();
+        for (auto i = 0; i < initData.size(); ++i) {
+            ASSERT_FLOAT_EQ(sum[i], initData[i] + n);
+            ASSERT_FLOAT_EQ(product[i], initData[i] * n);
+            ASSERT_FLOAT_EQ(difference[i], n - initData[i]);
+        }
+    }
+}
+
+MATRIX_TEST(Reductions)
+{
+    auto test = [](size_t row, size_t column) {
+        // Small integers, so sums are exact in f32 and only rounded once to Matrix::ElementType. The totals stay below
+        // the largest f16 (65504), so an overflowed or doubly rounded Sum() fails instead of comparing inf to inf.
+        std::vector<Matrix::ElementType> initData(row * column);
+        for (auto i = 0; i < row * column; ++i) {
+            initData[i] = (i * 7) % 5;
+        }
+        Matrix x { row, column, initData };
+
+        auto rowSum = x.RowSum();
+        ASSERT_EQ(rowSum.Row(), row);
+        ASSERT_EQ(rowSum.Column(), 1);
+        auto rowSumData = rowSum.Read();
+        auto total = 0.0;
+        for (auto r = 0; r < row; ++r) {
+            auto sum = 0.0;
+            for (auto c = 0; c < column; ++c) {
+                sum += initData[r * column + c];
+            }
+            ASSERT_FLOAT_EQ(rowSumData[r], (float)(Matrix::ElementType)sum);
+            total += sum;
+        }
+
+        auto columnSum = x.ColumnSum();
+        ASSERT_EQ(columnSum.Row(), 1);
+        ASSERT_EQ(columnSum.Column(), column);
+        auto columnSumData = columnSum.Read();
+        for (auto c = 0; c < column; ++c) {
+            auto sum = 0.0;
+            for (auto r = 0; r < row; ++r) {
+                sum += initData[r * column + c];
+            }
+            ASSERT_FLOAT_EQ(columnSumData[c], (float)(Matrix::ElementType)sum);
+        }
+
+        ASSERT_FLOAT_EQ((x.Sum()[0, 0]), (float)(Matrix::ElementType)total);
+        ASSERT_FLOAT_EQ((x.Max()[0, 0]), *std::max_element(initData.begin(), initData.end()));
+    };
+
+    for (auto row = 1u; row <= 9; ++row) {
+        for (auto column = 1u; column <= 9; ++column) {
+            test(row, column);
+        }
+    }
+    test(1, 1000);
+    test(1000, 1);
+    test(100, 257);
+}
+
+MATRIX_TEST(ArgMax)
+{
+    auto test = [](size_t row, size_t column) {
+        std::vector<Matrix::ElementType> initData(row * column);
+        std::vector<size_t> expected(column);
+        for (auto c = 0; c < column; ++c) {
+            expected[c] = (c * 31) % row;
+            for (auto r = 0; r < row; ++r) {
+                initData[r * column + c] = (r + c) % 4;
+            }
+            initData[expected[c] * column + c] = 8;
+        }
+        Matrix x { row, column, initData };
+        ASSERT_EQ(x.ArgMax(), expected);
+        ASSERT_EQ(x.ArgMaxAsync().get(), expected);
+    };
+
+    test(1, 1);
+    test(10, 1);
+    test(10, 7);
+    test(1000, 3);
+    test(3, 1000);
+
+    // The first maximum wins.
+    std::vector<Matrix::ElementType> initData { 1.0_mf, 3.0_mf, 2.0_mf, 3.0_mf };
+    Matrix x { 4, 1, initData };
+    ASSERT_EQ(x.ArgMax(), std::vector<size_t> { 1 });
+}
+
+MATRIX_TEST(SaveAndLoad)
+{
+    auto suite = ::testing::UnitTest::GetInstance()->current_test_info()->test_suite_name();
+    auto path = std::filesystem::temp_directory_path() / std::format("cpp_matrix_{}.bin", suite);
+    std::vector<Matrix::ElementType> dataX { 1.0_mf, 2.0_mf, 3.0_mf, 4.0_mf, 5.0_mf, 6.0_mf };
+    Matrix x { 2, 3, dataX };
+    auto y = Matrix::Random(17, 5);
+    {
+        auto writer = cpp_matrix::MatrixFileWriter { path };
+        x.Save(writer, "x");
+        y.Save(writer, "y");
+        writer.Close();
+    }
+
+    auto file = cpp_matrix::MatrixFile::Open(path);
+    ASSERT_EQ(file.GetEntries().size(), 2);
+    ASSERT_TRUE(file.Verify());
+    for (const auto& entry : file.GetEntries()) {
+        ASSERT_EQ(entry.offset % 64, 0);
+    }
+
+    auto loadedX = Matrix::Load(file, "x");
+    auto loadedY = Matrix::Load(file, "y");
+    ASSERT_EQ(loadedX.Row(), 2);
+    ASSERT_EQ(loadedX.Column(), 3);
+    ASSERT_EQ(loadedX.Read(), dataX);
+    ASSERT_EQ(loadedY.Row(), 17);
+    ASSERT_EQ(loadedY.Read(), y.Read());
+    ASSERT_THROW(Matrix::Load(file, "z"), std::runtime_error);
+
+    // Updating a loaded matrix never writes the file.
+    loadedX += loadedX;
+    ASSERT_EQ(Matrix::Load(cpp_matrix::MatrixFile::Open(path), "x").Read(), dataX);
+    std::filesystem::remove(path);
+}
+
+MATRIX_TEST(ReadRowsAsync)
+{
+    auto x = Matrix::Random(9, 6);
+    auto data = x.Read();
+    auto rows = x.ReadRowsAsync(3, 7).get();
+    ASSERT_EQ(rows, decltype(data)(data.begin() + 3 * 6, data.begin() + 7 * 6));
+    ASSERT_TRUE(x.ReadRowsAsync(5, 5).get().empty());
+    ASSERT_THROW(x.ReadRowsAsync(5, 10), std::runtime_error);
+}
+
+MATRIX_TEST(SaveBlocks)
+{
+    auto suite = ::testing::UnitTest::GetInstance()->current_test_info()->test_suite_name();
+    auto path = std::filesystem::temp_directory_path() / std::format("cpp_matrix_{}_blocks.bin", suite);
+
+    // Several blocks of every element type.
+    auto x = Matrix::Random(600, 1000);
+    auto data = x.Read();
+    auto blocks = x.ReadBlocksAsync();
+    ASSERT_GT(blocks.size(), 1);
+
+    // Changes after the downloads started are not saved.
+    x += x;
+    auto policy = Matrix::IsReadbackThreadSafe() ? std::launch::async : std::launch::deferred;
+    std::async(policy, [&] {
+        auto writer = cpp_matrix::MatrixFileWriter { path };
+        Matrix::SaveBlocks(writer, "x", 600, 1000, std::move(blocks));
+        writer.Close();
+    }).get();
+
+    auto file = cpp_matrix::MatrixFile::Open(path);
+    ASSERT_TRUE(file.Verify());
+    ASSERT_EQ(Matrix::Load(file, "x").Read(), data);
+    std::filesystem::remove(path);
+}
+
+MATRIX_TEST(SaveAsOtherElementType)
+{
+    auto suite = ::testing::UnitTest::GetInstance()->current_test_info()->test_suite_name();
+    auto path = std::filesystem::temp_directory_path() / std::format("cpp_matrix_{}_converted.bin", suite);
+    std::vector<Matrix::ElementType> dataX { 1.0_mf, 2.0_mf, 3.0_mf, 4.0_mf, 5.0_mf, 6.0_mf };
+    Matrix x { 3, 2, dataX };
+    {
+        auto writer = cpp_matrix::MatrixFileWriter { path };
+        x.Save(writer, "f16", cpp_matrix::MatrixDataType::Float16);
+        x.Save(writer, "bf16", cpp_matrix::MatrixDataType::BFloat16);
+        x.Save(writer, "f32", cpp_matrix::MatrixDataType::Float32);
+        writer.Close();
+    }
+
+    auto file = cpp_matrix::MatrixFile::Open(path);
+    ASSERT_TRUE(file.Verify());
+    ASSERT_EQ(file.GetEntry("f16").byteSize, 6 * 2);
+    ASSERT_EQ(file.GetEntry("bf16").byteSize, 6 * 2);
+    ASSERT_EQ(file.GetEntry("f32").byteSize, 6 * 4);
+    ASSERT_EQ(Matrix::Load(file, "f16").Read(), dataX);
+    ASSERT_EQ(Matrix::Load(file, "bf16").Read(), dataX);
+    ASSERT_EQ(Matrix::Load(file, "f32").Read(), dataX);
+    std::filesystem::remove(path);
+}
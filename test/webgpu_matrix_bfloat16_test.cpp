@@ -0,0 +1,9 @@
+#include <gtest/gtest.h>
+
+import cpp_matrix;
+
+#define MATRIX_TEST(X) TEST(WebGpuMatrixBFloat16Test, X)
+
+using Matrix = cpp_matrix::WebGpuMatrix<std::bfloat16_t>;
+
+#include "matrix_test.cpp"
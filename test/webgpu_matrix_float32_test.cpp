@@ -1,9 +1,150 @@
+#include <array>
+#include <filesystem>
+#include <format>
 #include <gtest/gtest.h>
+#include <limits>
 
 import cpp_matrix;
+import webgpu;
 
 #define MATRIX_TEST(X) TEST(WebGpuMatrixFloat32Test, X)
 
 using Matrix = cpp_matrix::WebGpuMatrix<std::float32_t>;
 
-#include "matrix_test.cpp"
\ No newline at end of file
+#include "matrix_test.cpp"
+
+/// @brief Set the chunk size for the scope, the default (0) is restored even when an assertion returns early.
+struct MaxChunkByteSizeScope {
+    explicit MaxChunkByteSizeScope(size_t byteSize)
+    {
+        Set(byteSize);
+    }
+
+    ~MaxChunkByteSizeScope()
+    {
+        Set(0);
+    }
+
+    void Set(size_t byteSize)
+    {
+        cpp_matrix::backend::WebGpuMatrix<std::float32_t>::SetMaxChunkByteSize(byteSize);
+    }
+};
+
+MATRIX_TEST(ReadAndWriteTiled)
+{
+    Matrix x { 5, 3 };
+    std::vector<Matrix::ElementType> tiled(x.TiledSize());
+    ASSERT_EQ(tiled.size(), 8 * 4);
+
+    // (row, column) is in tile (row / 4, column / 4), at (row % 4, column % 4) of that tile.
+    for (auto row = 0; row < 5; ++row) {
+        for (auto column = 0; column < 3; ++column) {
+            tiled[((row / 4) * 1 + (column / 4)) * 16 + (row % 4) * 4 + (column % 4)] = row * 10 + column;
+        }
+    }
+    x.WriteTiledAsync(std::span<Matrix::ElementType> { tiled }).get();
+
+    auto res = x.Read();
+    for (auto row = 0; row < 5; ++row) {
+        for (auto column = 0; column < 3; ++column) {
+            ASSERT_FLOAT_EQ(res[row * 3 + column], row * 10 + column);
+        }
+    }
+
+    ASSERT_EQ(x.ReadTiledAsync().get(), tiled);
+}
+
+MATRIX_TEST(Chunks)
+{
+    auto expectNear = [](const std::vector<float>& res, const std::vector<float>& expected) {
+        ASSERT_EQ(res.size(), expected.size());
+        for (auto i = 0; i < res.size(); ++i) {
+            ASSERT_NEAR(res[i], expected[i], 1e-3f);
+        }
+    };
+
+    auto test = [&](size_t row, size_t k, size_t column) {
+        std::vector<float> dataA(row * k), dataB(k * column), dataC(row * k);
+        for (auto i = 0; i < dataA.size(); ++i) {
+            dataA[i] = ((i * 7) % 11) / 8.0f - 0.5f;
+            dataC[i] = ((i * 5) % 13) / 8.0f;
+        }
+        for (auto i = 0; i < dataB.size(); ++i) {
+            dataB[i] = ((i * 3) % 7) / 4.0f;
+        }
+        cpp_matrix::CpuMatrix<float> a { row, k, dataA }, b { k, column, dataB }, c { row, k, dataC };
+        Matrix x { row, k, dataA }, y { k, column, dataB }, z { row, k, dataC };
+
+        expectNear(x.Read(), dataA);
+        expectNear((x * y).Read(), (a * b).Read());
+        expectNear(x.Transpose().Read(), a.Transpose().Read());
+        expectNear((x + z).Read(), (a + c).Read());
+        expectNear((2.0f - x).Sigmoid().Read(), (2.0f - a).Sigmoid().Read());
+        expectNear((x.Fuse() * z + 1.0f).Relu().Evaluate().Read(), (a.Fuse() * c + 1.0f).Relu().Evaluate().Read());
+        expectNear(x.RowSum().Read(), a.RowSum().Read());
+        expectNear(x.ColumnSum().Read(), a.ColumnSum().Read());
+        expectNear(x.Max().Read(), a.Max().Read());
+
+        // The f16 copy has its own chunk size, so chunks of both sides hold different tile rows.
+        expectNear(x.Cast<std::float16_t>().Cast<std::float32_t>().Read(), dataA);
+        ASSERT_EQ(z.ArgMax(), c.ArgMax());
+        ASSERT_FLOAT_EQ((x[row - 1, k - 1]), dataA.back());
+    };
+
+    // One tile row of a matrix with at most 16 columns per buffer.
+    auto chunkSize = MaxChunkByteSizeScope { sizeof(float) * 4 * 16 };
+    test(10, 7, 5);
+    test(13, 16, 9);
+    test(17, 3, 1);
+
+    // Big enough for the layout conversion on GPU, 2 tile rows per buffer.
+    chunkSize.Set(sizeof(float) * 4 * 200 * 2);
+    test(200, 200, 30);
+
+    chunkSize.Set(sizeof(float) * 4 * 4);
+    ASSERT_THROW((Matrix { 1, 8 }), std::runtime_error);
+}
+
+MATRIX_TEST(PipelineCacheEviction)
+{
+    auto directory = std::filesystem::temp_directory_path() / "cpp_matrix_pipeline_cache_test";
+    std::filesystem::remove_all(directory);
+    {
+        auto cache = webgpu::GpuPipelineCache { directory, "test adapter" };
+        auto count = webgpu::GpuPipelineCache::kMaxShaderCount + 10;
+        for (auto i = 0u; i < count; ++i) {
+            cache.StoreShader(i, std::format("// shader {}", i));
+        }
+
+        // File times may be too coarse to order shaders stored this quickly, so only the count is checked.
+        ASSERT_EQ(cache.LoadShaders().size(), webgpu::GpuPipelineCache::kMaxShaderCount);
+    }
+    std::filesystem::remove_all(directory);
+}
+
+MATRIX_TEST(LeaseInternalBuffers)
+{
+    using cpp_matrix::backend::MemoryKind;
+    auto& tracker = cpp_matrix::backend::MemoryTracker::GetInstance();
+    auto live = tracker.GetStats(MemoryKind::Gpu).liveBytes;
+
+    // The label is unique to this test, so the lease is the only allocation tagged with it.
+    auto leases = [&] {
+        auto allocations = tracker.GetLargestAllocations(std::numeric_limits<size_t>::max());
+        std::erase_if(allocations, [](const auto& allocation) { return allocation.tag != "LeaseInternalBuffers"; });
+        return allocations;
+    };
+    {
+        // Buffers the webgpu module allocates for itself are accounted like matrix buffers, without a shape.
+        auto pLease = webgpu::LeaseBuffer(4100, "LeaseInternalBuffers");
+        ASSERT_EQ(tracker.GetStats(MemoryKind::Gpu).liveBytes, live + 4100);
+        auto allocations = leases();
+        ASSERT_EQ(allocations.size(), 1);
+        ASSERT_EQ(allocations[0].kind, MemoryKind::Gpu);
+        ASSERT_EQ(allocations[0].bytes, 4100);
+        ASSERT_EQ(allocations[0].shape, (std::array<size_t, 2> {}));
+    }
+    ASSERT_EQ(tracker.GetStats(MemoryKind::Gpu).liveBytes, live);
+    ASSERT_TRUE(leases().empty());
+}